@@ -6,6 +6,9 @@
 #if !defined(CYCFI_Q_COUNT_BITS_HPP_MARCH_12_2018)
 #define CYCFI_Q_COUNT_BITS_HPP_MARCH_12_2018
 
+#include <cstdint>
+#include <type_traits>
+
 #ifdef _MSC_VER
 # include <intrin.h>
 # include <nmmintrin.h>
@@ -36,6 +39,31 @@ namespace cycfi::q::detail
 #endif
    }
 #endif // (!defined(_MSC_VER) || defined(_WIN64))
+
+   // Other unsigned integer types, by size. For example unsigned long long,
+   // where std::uint64_t is unsigned long.
+   template <typename T, typename = std::enable_if_t<std::is_unsigned_v<T>>>
+   inline T count_bits(T i)
+   {
+      if constexpr (sizeof(T) > sizeof(std::uint32_t))
+         return count_bits(std::uint64_t(i));
+      else
+         return count_bits(std::uint32_t(i));
+   }
+
+   // Returns the index of the least significant set bit. i must not be 0.
+   inline std::uint32_t count_trailing_zeros(std::uint32_t i)
+   {
+#if defined(_MSC_VER)
+      unsigned long index;
+      _BitScanForward(&index, i);
+      return index;
+#elif defined(__GNUC__)
+      return __builtin_ctz(i);
+#else
+# error Unsupported compiler
+#endif
+   }
 }
 
 #endif
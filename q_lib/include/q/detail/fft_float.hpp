@@ -0,0 +1,620 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_FFT_FLOAT_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_FFT_FLOAT_HPP_OCTOBER_17_2020
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <q/support/base.hpp>
+#include <q/detail/simd.hpp>
+
+namespace cycfi::q::detail
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // Single precision FFT kernels (see fft.hpp). The data is n complex
+   // numbers (2n floats, the interleaved real and imaginary parts), where
+   // n is a power of 2 >= 2.
+   //
+   // The FFT is an in-place decimation in time FFT: the data is first put
+   // in bit-reversed order, then combined by radix-4 stages. Each radix-4
+   // stage combines 4 FFTs of m points into one FFT of 4m points, with
+   // m = 1, 4, 16 ... n/4. If log2(n) is odd, a radix-2 stage comes first,
+   // and m = 2, 8, 32 ... n/4.
+   //
+   // The twiddles and the bit reversal permutation are precomputed (see
+   // init_fft_tables). For each radix-4 stage, there are three twiddles
+   // per point: w1 = W^j, w2 = W^2j and w3 = W^3j, where W = exp(-2*pi*i/4m)
+   // and j = 0 to m-1. Each twiddle is stored in two arrays, in a layout
+   // that does not depend on the vector width of the kernels:
+   //
+   //    re: c, c (the real part, twice)
+   //    im: -s, s (the imaginary part, negated then as is)
+   //
+   // such that the complex product a * w is simply a * re + swap(a) * im,
+   // where swap(a) swaps the real and imaginary parts of a. The arrays are
+   // padded to 8 floats (32 bytes), to keep all the arrays aligned for AVX.
+   //
+   // The kernels for each simd_level are selected at runtime (see
+   // get_fft_float). The SSE2 kernels process 2 complex numbers at a time,
+   // and the AVX2 kernels process 4 complex numbers at a time. The results
+   // of the kernels are not bit-identical, but are within the rounding
+   // errors of single precision floating point.
+   ////////////////////////////////////////////////////////////////////////////
+   constexpr std::size_t fft_log2(std::size_t n)
+   {
+      std::size_t p = 0;
+      while ((std::size_t(1) << p) < n)
+         ++p;
+      return p;
+   }
+
+   // The size of the first radix-4 stage sub-FFTs
+   constexpr std::size_t fft_first_m(std::size_t n)
+   {
+      return (fft_log2(n) % 2)? 2 : 1;
+   }
+
+   // The size (in floats) of each of the 6 twiddle arrays of a stage
+   constexpr std::size_t fft_twiddle_stride(std::size_t m)
+   {
+      return std::max<std::size_t>(2*m, 8);
+   }
+
+   // The size (in floats) of all the twiddles of an FFT of n points
+   constexpr std::size_t fft_twiddles_size(std::size_t n)
+   {
+      std::size_t size = 0;
+      for (auto m = fft_first_m(n); m*4 <= n; m *= 4)
+         size += 6 * fft_twiddle_stride(m);
+      return size;
+   }
+
+   // The twiddles and bit reversal permutation of an FFT of n points.
+   // bitrev holds pairs of indices (bitrev_size pairs) to be swapped.
+   struct fft_tables_view
+   {
+      std::size_t             n;
+      float const*            twiddles;
+      std::uint32_t const*    bitrev;
+      std::size_t             bitrev_size;
+   };
+
+   // twiddles: fft_twiddles_size(n) floats, bitrev: n integers. Returns
+   // the number of bit reversal pairs.
+   inline std::size_t init_fft_tables(
+      std::size_t n, float* twiddles, std::uint32_t* bitrev)
+   {
+      auto tw = twiddles;
+      for (auto m = fft_first_m(n); m*4 <= n; m *= 4)
+      {
+         auto stride = fft_twiddle_stride(m);
+         std::fill(tw, tw + 6*stride, 0.0f);
+         for (std::size_t k = 1; k <= 3; ++k)
+         {
+            auto re = tw + (k-1) * 2*stride;
+            auto im = re + stride;
+            for (std::size_t j = 0; j != m; ++j)
+            {
+               // Computed in double precision for accuracy
+               double angle = -2 * pi * double(k*j) / (4*m);
+               auto c = float(std::cos(angle));
+               auto s = float(std::sin(angle));
+               re[2*j] = c;
+               re[2*j+1] = c;
+               im[2*j] = -s;
+               im[2*j+1] = s;
+            }
+         }
+         tw += 6*stride;
+      }
+
+      auto bits = fft_log2(n);
+      std::size_t size = 0;
+      for (std::size_t i = 0; i != n; ++i)
+      {
+         std::size_t j = 0;
+         for (std::size_t b = 0; b != bits; ++b)
+            j |= ((i >> b) & 1) << (bits-1-b);
+         if (i < j)
+         {
+            bitrev[2*size] = i;
+            bitrev[2*size+1] = j;
+            ++size;
+         }
+      }
+      return size;
+   }
+
+   inline void fft_bitrev(float* data, fft_tables_view const& t)
+   {
+      for (std::size_t i = 0; i != t.bitrev_size; ++i)
+      {
+         auto a = data + 2*t.bitrev[2*i];
+         auto b = data + 2*t.bitrev[2*i+1];
+         std::swap(a[0], b[0]);
+         std::swap(a[1], b[1]);
+      }
+   }
+
+   inline void fft_scale(float* data, std::size_t n, float scale)
+   {
+      for (std::size_t i = 0; i != 2*n; ++i)
+         data[i] *= scale;
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // scalar
+   ////////////////////////////////////////////////////////////////////////////
+   namespace scalar
+   {
+      inline void radix2_first(float* data, std::size_t n)
+      {
+         for (std::size_t i = 0; i != 2*n; i += 4)
+         {
+            auto r0 = data[i], i0 = data[i+1];
+            auto r1 = data[i+2], i1 = data[i+3];
+            data[i] = r0 + r1;
+            data[i+1] = i0 + i1;
+            data[i+2] = r0 - r1;
+            data[i+3] = i0 - i1;
+         }
+      }
+
+      template <bool inverse>
+      inline void radix4(float* data, std::size_t n, std::size_t m, float const* tw)
+      {
+         auto stride = fft_twiddle_stride(m);
+         auto w1re = tw, w1im = tw + stride;
+         auto w2re = tw + 2*stride, w2im = tw + 3*stride;
+         auto w3re = tw + 4*stride, w3im = tw + 5*stride;
+
+         // Multiply (r, i) by the twiddle w[j] (conjugated if inverse)
+         auto cmul = [](float& r, float& i, float const* re, float const* im)
+         {
+            auto c = re[0];
+            auto s = inverse? -im[1] : im[1];
+            auto r_ = r*c - i*s;
+            i = r*s + i*c;
+            r = r_;
+         };
+
+         for (std::size_t base = 0; base != n; base += 4*m)
+         {
+            for (std::size_t j = 0; j != m; ++j)
+            {
+               auto p0 = data + 2*(base + j);
+               auto p1 = p0 + 2*m;
+               auto p2 = p0 + 4*m;
+               auto p3 = p0 + 6*m;
+
+               // The sub-FFTs are in bit-reversed order: p1 holds the FFT
+               // of the samples 2 mod 4 (t2) and p2 the samples 1 mod 4 (t1).
+               float t0r = p0[0], t0i = p0[1];
+               float t1r = p2[0], t1i = p2[1];
+               float t2r = p1[0], t2i = p1[1];
+               float t3r = p3[0], t3i = p3[1];
+               cmul(t1r, t1i, w1re + 2*j, w1im + 2*j);
+               cmul(t2r, t2i, w2re + 2*j, w2im + 2*j);
+               cmul(t3r, t3i, w3re + 2*j, w3im + 2*j);
+
+               float u0r = t0r + t2r, u0i = t0i + t2i;
+               float u1r = t0r - t2r, u1i = t0i - t2i;
+               float u2r = t1r + t3r, u2i = t1i + t3i;
+
+               // u3 = (t1 - t3) * -i (forward) or * i (inverse)
+               float dr = t1r - t3r, di = t1i - t3i;
+               float u3r = inverse? -di : di;
+               float u3i = inverse? dr : -dr;
+
+               p0[0] = u0r + u2r; p0[1] = u0i + u2i;
+               p2[0] = u0r - u2r; p2[1] = u0i - u2i;
+               p1[0] = u1r + u3r; p1[1] = u1i + u3i;
+               p3[0] = u1r - u3r; p3[1] = u1i - u3i;
+            }
+         }
+      }
+
+      template <bool inverse>
+      inline void fft(float* data, fft_tables_view const& t)
+      {
+         auto n = t.n;
+         fft_bitrev(data, t);
+         if (fft_first_m(n) == 2)
+            radix2_first(data, n);
+
+         auto tw = t.twiddles;
+         for (auto m = fft_first_m(n); m*4 <= n; m *= 4)
+         {
+            radix4<inverse>(data, n, m, tw);
+            tw += 6 * fft_twiddle_stride(m);
+         }
+         if constexpr (inverse)
+            fft_scale(data, n, 1.0f / n);
+      }
+   }
+
+#if defined(CYCFI_Q_X86_SIMD)
+
+   ////////////////////////////////////////////////////////////////////////////
+   // sse2 (always available on x86-64)
+   ////////////////////////////////////////////////////////////////////////////
+   namespace sse2
+   {
+      // Swap the real and imaginary parts
+      inline __m128 swap(__m128 a)
+      {
+         return _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+      }
+
+      // Multiply by the twiddles (conjugated if inverse)
+      template <bool inverse>
+      inline __m128 cmul(__m128 a, float const* re, float const* im)
+      {
+         auto x = _mm_mul_ps(a, _mm_load_ps(re));
+         auto y = _mm_mul_ps(swap(a), _mm_load_ps(im));
+         return inverse? _mm_sub_ps(x, y) : _mm_add_ps(x, y);
+      }
+
+      // Multiply by -i (forward) or i (inverse)
+      template <bool inverse>
+      inline __m128 rotate(__m128 a)
+      {
+         auto sign = inverse?
+            _mm_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f) :
+            _mm_setr_ps(0.0f, -0.0f, 0.0f, -0.0f);
+         return _mm_xor_ps(swap(a), sign);
+      }
+
+      inline void radix2_first(float* data, std::size_t n)
+      {
+         auto const sign = _mm_setr_ps(0.0f, 0.0f, -0.0f, -0.0f);
+         for (std::size_t i = 0; i != 2*n; i += 4)
+         {
+            auto v = _mm_loadu_ps(data + i);
+            auto lo = _mm_movelh_ps(v, v);
+            auto hi = _mm_movehl_ps(v, v);
+            _mm_storeu_ps(data + i, _mm_add_ps(lo, _mm_xor_ps(hi, sign)));
+         }
+      }
+
+      template <bool inverse>
+      inline void radix4_first(float* data, std::size_t n)
+      {
+         auto const sign = _mm_setr_ps(0.0f, 0.0f, -0.0f, -0.0f);
+         for (std::size_t i = 0; i != 2*n; i += 8)
+         {
+            // v0: t0, t2 and v1: t1, t3 (bit-reversed order)
+            auto v0 = _mm_loadu_ps(data + i);
+            auto v1 = _mm_loadu_ps(data + i + 4);
+
+            // u01: t0 + t2, t0 - t2 and u23: t1 + t3, t1 - t3
+            auto u01 = _mm_add_ps(_mm_movelh_ps(v0, v0), _mm_xor_ps(_mm_movehl_ps(v0, v0), sign));
+            auto u23 = _mm_add_ps(_mm_movelh_ps(v1, v1), _mm_xor_ps(_mm_movehl_ps(v1, v1), sign));
+
+            // w: t1 + t3, (t1 - t3) * -i (forward) or * i (inverse)
+            auto w = _mm_shuffle_ps(u23, rotate<inverse>(u23), _MM_SHUFFLE(3, 2, 1, 0));
+            _mm_storeu_ps(data + i, _mm_add_ps(u01, w));
+            _mm_storeu_ps(data + i + 4, _mm_sub_ps(u01, w));
+         }
+      }
+
+      // Radix-4 stage (m >= 2)
+      template <bool inverse>
+      inline void radix4(float* data, std::size_t n, std::size_t m, float const* tw)
+      {
+         auto stride = fft_twiddle_stride(m);
+         for (std::size_t base = 0; base != n; base += 4*m)
+         {
+            for (std::size_t j = 0; j != m; j += 2)
+            {
+               auto p0 = data + 2*(base + j);
+               auto p1 = p0 + 2*m;
+               auto p2 = p0 + 4*m;
+               auto p3 = p0 + 6*m;
+               auto w = tw + 2*j;
+
+               auto t0 = _mm_loadu_ps(p0);
+               auto t1 = cmul<inverse>(_mm_loadu_ps(p2), w, w + stride);
+               auto t2 = cmul<inverse>(_mm_loadu_ps(p1), w + 2*stride, w + 3*stride);
+               auto t3 = cmul<inverse>(_mm_loadu_ps(p3), w + 4*stride, w + 5*stride);
+
+               auto u0 = _mm_add_ps(t0, t2);
+               auto u1 = _mm_sub_ps(t0, t2);
+               auto u2 = _mm_add_ps(t1, t3);
+               auto u3 = rotate<inverse>(_mm_sub_ps(t1, t3));
+
+               _mm_storeu_ps(p0, _mm_add_ps(u0, u2));
+               _mm_storeu_ps(p2, _mm_sub_ps(u0, u2));
+               _mm_storeu_ps(p1, _mm_add_ps(u1, u3));
+               _mm_storeu_ps(p3, _mm_sub_ps(u1, u3));
+            }
+         }
+      }
+
+      // The bit reversal, the first stage and the stages with m < 4
+      template <bool inverse>
+      inline float const* first_stages(float* data, fft_tables_view const& t)
+      {
+         auto n = t.n;
+         auto tw = t.twiddles;
+         fft_bitrev(data, t);
+         if (fft_first_m(n) == 2)
+         {
+            radix2_first(data, n);
+            if (n >= 8)
+            {
+               radix4<inverse>(data, n, 2, tw);
+               tw += 6 * fft_twiddle_stride(2);
+            }
+         }
+         else if (n >= 4)
+         {
+            radix4_first<inverse>(data, n);
+            tw += 6 * fft_twiddle_stride(1);
+         }
+         return tw;
+      }
+
+      template <bool inverse>
+      inline void fft(float* data, fft_tables_view const& t)
+      {
+         auto n = t.n;
+         auto tw = first_stages<inverse>(data, t);
+         for (std::size_t m = fft_first_m(n) * 4; m*4 <= n; m *= 4)
+         {
+            radix4<inverse>(data, n, m, tw);
+            tw += 6 * fft_twiddle_stride(m);
+         }
+         if constexpr (inverse)
+            fft_scale(data, n, 1.0f / n);
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // avx2
+   ////////////////////////////////////////////////////////////////////////////
+   namespace avx2
+   {
+      // Swap the real and imaginary parts
+      CYCFI_Q_TARGET("avx2")
+      inline __m256 swap(__m256 a)
+      {
+         return _mm256_permute_ps(a, _MM_SHUFFLE(2, 3, 0, 1));
+      }
+
+      // Multiply by the twiddles (conjugated if inverse)
+      template <bool inverse>
+      CYCFI_Q_TARGET("avx2")
+      inline __m256 cmul(__m256 a, float const* re, float const* im)
+      {
+         auto x = _mm256_mul_ps(a, _mm256_load_ps(re));
+         auto y = _mm256_mul_ps(swap(a), _mm256_load_ps(im));
+         return inverse? _mm256_sub_ps(x, y) : _mm256_add_ps(x, y);
+      }
+
+      // Multiply by -i (forward) or i (inverse)
+      template <bool inverse>
+      CYCFI_Q_TARGET("avx2")
+      inline __m256 rotate(__m256 a)
+      {
+         auto sign = inverse?
+            _mm256_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f) :
+            _mm256_setr_ps(0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f);
+         return _mm256_xor_ps(swap(a), sign);
+      }
+
+      // Radix-4 stage (m >= 4)
+      template <bool inverse>
+      CYCFI_Q_TARGET("avx2")
+      inline void radix4(float* data, std::size_t n, std::size_t m, float const* tw)
+      {
+         auto stride = fft_twiddle_stride(m);
+         for (std::size_t base = 0; base != n; base += 4*m)
+         {
+            for (std::size_t j = 0; j != m; j += 4)
+            {
+               auto p0 = data + 2*(base + j);
+               auto p1 = p0 + 2*m;
+               auto p2 = p0 + 4*m;
+               auto p3 = p0 + 6*m;
+               auto w = tw + 2*j;
+
+               auto t0 = _mm256_loadu_ps(p0);
+               auto t1 = cmul<inverse>(_mm256_loadu_ps(p2), w, w + stride);
+               auto t2 = cmul<inverse>(_mm256_loadu_ps(p1), w + 2*stride, w + 3*stride);
+               auto t3 = cmul<inverse>(_mm256_loadu_ps(p3), w + 4*stride, w + 5*stride);
+
+               auto u0 = _mm256_add_ps(t0, t2);
+               auto u1 = _mm256_sub_ps(t0, t2);
+               auto u2 = _mm256_add_ps(t1, t3);
+               auto u3 = rotate<inverse>(_mm256_sub_ps(t1, t3));
+
+               _mm256_storeu_ps(p0, _mm256_add_ps(u0, u2));
+               _mm256_storeu_ps(p2, _mm256_sub_ps(u0, u2));
+               _mm256_storeu_ps(p1, _mm256_add_ps(u1, u3));
+               _mm256_storeu_ps(p3, _mm256_sub_ps(u1, u3));
+            }
+         }
+      }
+
+      template <bool inverse>
+      CYCFI_Q_TARGET("avx2")
+      inline void fft(float* data, fft_tables_view const& t)
+      {
+         auto n = t.n;
+
+         // The first stages (m < 4) are done 2 complex numbers at a time
+         auto tw = sse2::first_stages<inverse>(data, t);
+         for (std::size_t m = fft_first_m(n) * 4; m*4 <= n; m *= 4)
+         {
+            radix4<inverse>(data, n, m, tw);
+            tw += 6 * fft_twiddle_stride(m);
+         }
+         if constexpr (inverse)
+            fft_scale(data, n, 1.0f / n);
+      }
+   }
+
+#endif // CYCFI_Q_X86_SIMD
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Runtime dispatch
+   ////////////////////////////////////////////////////////////////////////////
+   using fft_float_fn = void(*)(float* data, fft_tables_view const& t);
+
+   inline fft_float_fn get_fft_float(simd_level level, bool inverse)
+   {
+      switch (level)
+      {
+#if defined(CYCFI_Q_X86_SIMD)
+         case simd_level::popcnt:
+            return inverse? sse2::fft<true> : sse2::fft<false>;
+         case simd_level::avx2:
+         case simd_level::avx512:
+            return inverse? avx2::fft<true> : avx2::fft<false>;
+#endif
+         default:
+            return inverse? scalar::fft<true> : scalar::fft<false>;
+      }
+   }
+
+   inline void fft_float(float* data, fft_tables_view const& t)
+   {
+      static fft_float_fn const f = get_fft_float(best_simd_level(), false);
+      f(data, t);
+   }
+
+   inline void ifft_float(float* data, fft_tables_view const& t)
+   {
+      static fft_float_fn const f = get_fft_float(best_simd_level(), true);
+      f(data, t);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Real FFT support (see rfft). The twiddles W^k (W = exp(-2*pi*i/n)) for
+   // k = 1 to n/4, n/4 pairs of cosine and sine (n/2 floats).
+   ////////////////////////////////////////////////////////////////////////////
+   inline void init_rfft_twiddles(std::size_t n, float* twiddles)
+   {
+      for (std::size_t k = 1; k <= n/4; ++k)
+      {
+         double angle = -2 * pi * double(k) / n;
+         twiddles[2*(k-1)] = float(std::cos(angle));
+         twiddles[2*(k-1)+1] = float(std::sin(angle));
+      }
+   }
+
+   // Split the FFT of n/2 complex numbers (the even and odd samples) into
+   // the packed Hermitian spectrum of n real samples.
+   inline void rfft_split(float* data, std::size_t n, float const* twiddles)
+   {
+      for (std::size_t k = 1; k <= n/4; ++k)
+      {
+         auto i = 2*k;
+         auto j = n - i;
+         auto wr = twiddles[2*(k-1)];
+         auto wi = twiddles[2*(k-1)+1];
+
+         float er = 0.5f * (data[i] + data[j]);
+         float ei = 0.5f * (data[i+1] - data[j+1]);
+         float or_ = 0.5f * (data[i+1] + data[j+1]);
+         float oi = -0.5f * (data[i] - data[j]);
+         float tr = wr*or_ - wi*oi;
+         float ti = wr*oi + wi*or_;
+
+         data[i] = er + tr;
+         data[i+1] = ei + ti;
+         data[j] = er - tr;
+         data[j+1] = ti - ei;
+      }
+
+      float dc = data[0];
+      data[0] = dc + data[1];
+      data[1] = dc - data[1];
+   }
+
+   // The inverse of rfft_split
+   inline void rfft_merge(float* data, std::size_t n, float const* twiddles)
+   {
+      float dc = data[0];
+      data[0] = 0.5f * (dc + data[1]);
+      data[1] = 0.5f * (dc - data[1]);
+
+      for (std::size_t k = 1; k <= n/4; ++k)
+      {
+         auto i = 2*k;
+         auto j = n - i;
+         auto wr = twiddles[2*(k-1)];
+         auto wi = twiddles[2*(k-1)+1];
+
+         float er = 0.5f * (data[i] + data[j]);
+         float ei = 0.5f * (data[i+1] - data[j+1]);
+         float tr = 0.5f * (data[i] - data[j]);
+         float ti = 0.5f * (data[i+1] + data[j+1]);
+         float or_ = tr*wr + ti*wi;
+         float oi = ti*wr - tr*wi;
+
+         data[i] = er - oi;
+         data[i+1] = ei + or_;
+         data[j] = er + oi;
+         data[j+1] = or_ - ei;
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // The tables of the FFT of N points and of the real FFT of N points,
+   // for the compile-time sized FFTs (see fft.hpp). Use
+   // get_fft_float_tables<N>() and get_rfft_float_tables<N>() to get the
+   // tables, initialized on first use.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t N>
+   struct fft_float_tables
+   {
+      fft_float_tables()
+      {
+         bitrev_size = init_fft_tables(N, twiddles, bitrev);
+      }
+
+      fft_tables_view view() const
+      {
+         return { N, twiddles, bitrev, bitrev_size };
+      }
+
+      alignas(32) float       twiddles[std::max<std::size_t>(fft_twiddles_size(N), 1)];
+      std::uint32_t           bitrev[N];
+      std::size_t             bitrev_size;
+   };
+
+   template <std::size_t N>
+   struct rfft_float_tables
+   {
+      rfft_float_tables()
+      {
+         init_rfft_twiddles(N, twiddles);
+      }
+
+      float                   twiddles[N/2];
+   };
+
+   template <std::size_t N>
+   inline fft_float_tables<N> const& get_fft_float_tables()
+   {
+      static fft_float_tables<N> const tables;
+      return tables;
+   }
+
+   template <std::size_t N>
+   inline rfft_float_tables<N> const& get_rfft_float_tables()
+   {
+      static rfft_float_tables<N> const tables;
+      return tables;
+   }
+}
+
+#endif
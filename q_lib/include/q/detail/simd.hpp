@@ -0,0 +1,114 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_SIMD_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_SIMD_HPP_OCTOBER_17_2020
+
+///////////////////////////////////////////////////////////////////////////////
+// Define CYCFI_Q_NO_SIMD to disable the vectorized kernels and the runtime
+// CPU dispatch. Only the portable scalar code will be used.
+//
+// On x86-64, SSE2 is always available. Code that uses newer instruction
+// sets is compiled for the specific target using CYCFI_Q_TARGET(isa) and
+// must be selected at runtime (see detail::cpu_supports).
+///////////////////////////////////////////////////////////////////////////////
+#if !defined(CYCFI_Q_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+# define CYCFI_Q_X86_SIMD
+#endif
+
+#if defined(CYCFI_Q_X86_SIMD)
+# include <immintrin.h>
+# if defined(_MSC_VER)
+#  include <intrin.h>
+#  define CYCFI_Q_TARGET(isa)
+# else
+#  define CYCFI_Q_TARGET(isa) __attribute__((target(isa)))
+# endif
+#endif
+
+namespace cycfi::q::detail
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // CPU feature detection. cpu_supports(level) returns true if the CPU
+   // supports the instruction sets of the given level. best_simd_level()
+   // returns the best level supported by the CPU.
+   ////////////////////////////////////////////////////////////////////////////
+   enum class simd_level
+   {
+      scalar
+    , popcnt
+    , avx2
+    , avx512
+   };
+
+#if defined(CYCFI_Q_X86_SIMD)
+
+   inline bool cpu_supports(simd_level level)
+   {
+#if defined(_MSC_VER)
+      int info[4];
+      __cpuid(info, 0);
+      int max_leaf = info[0];
+      __cpuid(info, 1);
+      bool popcnt = (info[2] & (1 << 23)) != 0;
+      bool osxsave = (info[2] & (1 << 27)) != 0;
+      auto xcr0 = osxsave? _xgetbv(0) : 0;
+      bool os_avx = (xcr0 & 0x06) == 0x06;
+      bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+      bool avx2 = false, avx512f = false, avx512vpopcntdq = false;
+      if (max_leaf >= 7)
+      {
+         __cpuidex(info, 7, 0);
+         avx2 = (info[1] & (1 << 5)) != 0;
+         avx512f = (info[1] & (1 << 16)) != 0;
+         avx512vpopcntdq = (info[2] & (1 << 14)) != 0;
+      }
+      switch (level)
+      {
+         case simd_level::scalar: return true;
+         case simd_level::popcnt: return popcnt;
+         case simd_level::avx2:   return popcnt && os_avx && avx2;
+         case simd_level::avx512: return os_avx512 && avx512f && avx512vpopcntdq;
+      }
+#else
+      __builtin_cpu_init();
+      switch (level)
+      {
+         case simd_level::scalar: return true;
+         case simd_level::popcnt: return __builtin_cpu_supports("popcnt");
+         case simd_level::avx2:
+            return __builtin_cpu_supports("popcnt")
+               && __builtin_cpu_supports("avx2");
+         case simd_level::avx512:
+            return __builtin_cpu_supports("avx512f")
+               && __builtin_cpu_supports("avx512vpopcntdq");
+      }
+#endif
+      return false;
+   }
+
+#else // !CYCFI_Q_X86_SIMD
+
+   inline bool cpu_supports(simd_level level)
+   {
+      return level == simd_level::scalar;
+   }
+
+#endif // CYCFI_Q_X86_SIMD
+
+   inline simd_level best_simd_level()
+   {
+      static simd_level const level = []
+      {
+         for (auto l : { simd_level::avx512, simd_level::avx2, simd_level::popcnt })
+            if (cpu_supports(l))
+               return l;
+         return simd_level::scalar;
+      }();
+      return level;
+   }
+}
+
+#endif
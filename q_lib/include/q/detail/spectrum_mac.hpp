@@ -0,0 +1,103 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_SPECTRUM_MAC_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_SPECTRUM_MAC_HPP_OCTOBER_17_2020
+
+#include <cstddef>
+#include <q/detail/simd.hpp>
+
+namespace cycfi::q::detail
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // spectrum_mac multiplies two spectra and adds the product to an
+   // accumulator. The spectra are in split form: n real parts followed by
+   // n imaginary parts, where n is a multiple of 8 and all the arrays are
+   // 32-byte aligned:
+   //
+   //    acc.re += x.re * h.re - x.im * h.im
+   //    acc.im += x.re * h.im + x.im * h.re
+   //
+   // This is the inner loop of the partitioned convolution (see
+   // convolver.hpp). The kernel for the best simd_level is selected at
+   // runtime: SSE2 (4 bins at a time) or AVX2 (8 bins at a time).
+   ////////////////////////////////////////////////////////////////////////////
+   inline void spectrum_mac_scalar(
+      float* acc, float const* x, float const* h, std::size_t n)
+   {
+      auto acc_im = acc + n;
+      auto x_im = x + n;
+      auto h_im = h + n;
+      for (std::size_t i = 0; i != n; ++i)
+      {
+         acc[i] += x[i] * h[i] - x_im[i] * h_im[i];
+         acc_im[i] += x[i] * h_im[i] + x_im[i] * h[i];
+      }
+   }
+
+#if defined(CYCFI_Q_X86_SIMD)
+
+   inline void spectrum_mac_sse2(
+      float* acc, float const* x, float const* h, std::size_t n)
+   {
+      auto acc_im = acc + n;
+      auto x_im = x + n;
+      auto h_im = h + n;
+      for (std::size_t i = 0; i != n; i += 4)
+      {
+         auto xr = _mm_load_ps(x + i);
+         auto xi = _mm_load_ps(x_im + i);
+         auto hr = _mm_load_ps(h + i);
+         auto hi = _mm_load_ps(h_im + i);
+         auto re = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+         auto im = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+         _mm_store_ps(acc + i, _mm_add_ps(_mm_load_ps(acc + i), re));
+         _mm_store_ps(acc_im + i, _mm_add_ps(_mm_load_ps(acc_im + i), im));
+      }
+   }
+
+   CYCFI_Q_TARGET("avx2")
+   inline void spectrum_mac_avx2(
+      float* acc, float const* x, float const* h, std::size_t n)
+   {
+      auto acc_im = acc + n;
+      auto x_im = x + n;
+      auto h_im = h + n;
+      for (std::size_t i = 0; i != n; i += 8)
+      {
+         auto xr = _mm256_load_ps(x + i);
+         auto xi = _mm256_load_ps(x_im + i);
+         auto hr = _mm256_load_ps(h + i);
+         auto hi = _mm256_load_ps(h_im + i);
+         auto re = _mm256_sub_ps(_mm256_mul_ps(xr, hr), _mm256_mul_ps(xi, hi));
+         auto im = _mm256_add_ps(_mm256_mul_ps(xr, hi), _mm256_mul_ps(xi, hr));
+         _mm256_store_ps(acc + i, _mm256_add_ps(_mm256_load_ps(acc + i), re));
+         _mm256_store_ps(acc_im + i, _mm256_add_ps(_mm256_load_ps(acc_im + i), im));
+      }
+   }
+
+#endif // CYCFI_Q_X86_SIMD
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Runtime dispatch
+   ////////////////////////////////////////////////////////////////////////////
+   using spectrum_mac_fn = void(*)(
+      float* acc, float const* x, float const* h, std::size_t n);
+
+   inline spectrum_mac_fn get_spectrum_mac(simd_level level)
+   {
+      switch (level)
+      {
+#if defined(CYCFI_Q_X86_SIMD)
+         case simd_level::popcnt: return spectrum_mac_sse2;
+         case simd_level::avx2:
+         case simd_level::avx512: return spectrum_mac_avx2;
+#endif
+         default:                 return spectrum_mac_scalar;
+      }
+   }
+}
+
+#endif
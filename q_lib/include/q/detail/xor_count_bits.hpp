@@ -0,0 +1,507 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_XOR_COUNT_BITS_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_XOR_COUNT_BITS_HPP_OCTOBER_17_2020
+
+#include <cstddef>
+#include <cstdint>
+#include <climits>
+#include <algorithm>
+#include <type_traits>
+#include <q/detail/count_bits.hpp>
+#include <q/detail/simd.hpp>
+
+namespace cycfi::q::detail
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // xor_count_bits counts the mismatched bits between n integers starting
+   // at p1 and n integers starting at p2 shifted right by shift bits, where
+   // shift < the integer size in bits. This is the inner loop of the
+   // bitstream autocorrelation (see bitstream_acf.hpp).
+   //
+   // For 64-bit unsigned integers on x86-64, of any type (e.g. unsigned long
+   // or unsigned long long, see is_uint64), the best kernel supported by
+   // the CPU is selected at runtime:
+   //
+   //    1. avx512:  AVX-512 VPOPCNTDQ (8 integers per iteration)
+   //    2. avx2:    AVX2 Harley-Seal carry-save adder with nibble lookup
+   //    3. popcnt:  Scalar loop using the SSE4.2 era POPCNT instruction
+   //    4. scalar:  Portable fallback
+   //
+   // All kernels give bit-identical results.
+   //
+   // xor_count_bits_block does the same for all shifts in a block, i.e.
+   // out[shift] receives the count for each shift in [0, integer size in
+   // bits). Each pair of integers from p2 is loaded once and shifted for
+   // all the shifts in the block. Take note that p2[n] is always read.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename T>
+   constexpr bool is_uint64 =
+      std::is_integral_v<T> && std::is_unsigned_v<T> && sizeof(T) == 8;
+
+   template <typename T>
+   inline std::size_t xor_count_bits_scalar(
+      T const* p1, T const* p2, std::size_t n, std::size_t shift)
+   {
+      constexpr auto value_size = CHAR_BIT * sizeof(T);
+      std::size_t count = 0;
+      if (shift == 0)
+      {
+         for (std::size_t i = 0; i != n; ++i)
+            count += count_bits(*p1++ ^ *p2++);
+      }
+      else
+      {
+         auto shift2 = value_size - shift;
+         for (std::size_t i = 0; i != n; ++i)
+         {
+            auto v = *p2++ >> shift;
+            v |= *p2 << shift2;
+            count += count_bits(*p1++ ^ v);
+         }
+      }
+      return count;
+   }
+
+   template <typename T>
+   inline void xor_count_bits_block_scalar(
+      T const* p1, T const* p2, std::size_t n, std::size_t* out)
+   {
+      constexpr auto value_size = CHAR_BIT * sizeof(T);
+      std::fill(out, out + value_size, 0);
+      for (std::size_t i = 0; i != n; ++i)
+      {
+         auto a = p1[i];
+         auto b = p2[i];
+         auto b2 = p2[i+1];
+         out[0] += count_bits(a ^ b);
+         for (std::size_t shift = 1; shift != value_size; ++shift)
+            out[shift] += count_bits(a ^ ((b >> shift) | (b2 << (value_size - shift))));
+      }
+   }
+
+#if defined(CYCFI_Q_X86_SIMD)
+
+   ////////////////////////////////////////////////////////////////////////////
+   // popcnt
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename T>
+   CYCFI_Q_TARGET("popcnt")
+   inline std::size_t xor_count_bits_popcnt(
+      T const* p1, T const* p2
+    , std::size_t n, std::size_t shift)
+   {
+      std::size_t count = 0;
+      if (shift == 0)
+      {
+         for (std::size_t i = 0; i != n; ++i)
+            count += _mm_popcnt_u64(p1[i] ^ p2[i]);
+      }
+      else
+      {
+         auto shift2 = 64 - shift;
+         for (std::size_t i = 0; i != n; ++i)
+         {
+            auto v = (p2[i] >> shift) | (p2[i+1] << shift2);
+            count += _mm_popcnt_u64(p1[i] ^ v);
+         }
+      }
+      return count;
+   }
+
+   template <typename T>
+   CYCFI_Q_TARGET("popcnt")
+   inline void xor_count_bits_block_popcnt(
+      T const* p1, T const* p2
+    , std::size_t n, std::size_t* out)
+   {
+      std::fill(out, out + 64, 0);
+      for (std::size_t i = 0; i != n; ++i)
+      {
+         auto a = p1[i];
+         auto b = p2[i];
+         auto b2 = p2[i+1];
+         out[0] += _mm_popcnt_u64(a ^ b);
+         for (std::size_t shift = 1; shift != 64; ++shift)
+            out[shift] += _mm_popcnt_u64(a ^ ((b >> shift) | (b2 << (64 - shift))));
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // avx2
+   ////////////////////////////////////////////////////////////////////////////
+   namespace avx2
+   {
+      // Per 64-bit lane population count (Wojciech Mula's nibble lookup)
+      CYCFI_Q_TARGET("avx2")
+      inline __m256i popcount(__m256i v)
+      {
+         __m256i const lookup = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+          , 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4
+         );
+         __m256i const low_mask = _mm256_set1_epi8(0x0f);
+         __m256i lo = _mm256_and_si256(v, low_mask);
+         __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+         __m256i cnt = _mm256_add_epi8(
+            _mm256_shuffle_epi8(lookup, lo)
+          , _mm256_shuffle_epi8(lookup, hi)
+         );
+         return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+      }
+
+      // Harley-Seal carry-save adder
+      CYCFI_Q_TARGET("avx2")
+      inline void csa(__m256i& h, __m256i& l, __m256i a, __m256i b, __m256i c)
+      {
+         __m256i u = _mm256_xor_si256(a, b);
+         h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+         l = _mm256_xor_si256(u, c);
+      }
+
+      // Load 4 integers from p1 and p2 (shifted) and XOR them
+      template <bool shifted, typename T>
+      CYCFI_Q_TARGET("avx2")
+      inline __m256i load_xor(
+         T const* p1, T const* p2
+       , __m128i shift, __m128i shift2)
+      {
+         auto a = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p1));
+         auto b = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p2));
+         if constexpr (shifted)
+         {
+            auto b2 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(p2+1));
+            b = _mm256_or_si256(
+               _mm256_srl_epi64(b, shift)
+             , _mm256_sll_epi64(b2, shift2)
+            );
+         }
+         return _mm256_xor_si256(a, b);
+      }
+
+      CYCFI_Q_TARGET("avx2")
+      inline std::uint64_t sum(__m256i v)
+      {
+         return std::uint64_t(_mm256_extract_epi64(v, 0))
+            + std::uint64_t(_mm256_extract_epi64(v, 1))
+            + std::uint64_t(_mm256_extract_epi64(v, 2))
+            + std::uint64_t(_mm256_extract_epi64(v, 3))
+            ;
+      }
+
+      template <bool shifted, typename T>
+      CYCFI_Q_TARGET("avx2,popcnt")
+      inline std::size_t xor_count_bits(
+         T const* p1, T const* p2
+       , std::size_t n, std::size_t shift_)
+      {
+         // Not worth it for very short streams
+         if (n < 8)
+            return xor_count_bits_popcnt(p1, p2, n, shift_);
+
+         auto shift = _mm_cvtsi32_si128(int(shift_));
+         auto shift2 = _mm_cvtsi32_si128(int(64 - shift_));
+         auto total = _mm256_setzero_si256();
+         auto ones = _mm256_setzero_si256();
+         auto twos = _mm256_setzero_si256();
+         auto fours = _mm256_setzero_si256();
+         std::size_t i = 0;
+
+         // Harley-Seal: 8 vectors (32 integers) at a time
+         for (; i + 32 <= n; i += 32)
+         {
+            __m256i v[8];
+            for (std::size_t k = 0; k != 8; ++k)
+               v[k] = load_xor<shifted>(p1+i+k*4, p2+i+k*4, shift, shift2);
+
+            __m256i twos_a, twos_b, fours_a, fours_b, eights;
+            csa(twos_a, ones, ones, v[0], v[1]);
+            csa(twos_b, ones, ones, v[2], v[3]);
+            csa(fours_a, twos, twos, twos_a, twos_b);
+            csa(twos_a, ones, ones, v[4], v[5]);
+            csa(twos_b, ones, ones, v[6], v[7]);
+            csa(fours_b, twos, twos, twos_a, twos_b);
+            csa(eights, fours, fours, fours_a, fours_b);
+            total = _mm256_add_epi64(total, popcount(eights));
+         }
+
+         total = _mm256_slli_epi64(total, 3);
+         total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount(fours), 2));
+         total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount(twos), 1));
+         total = _mm256_add_epi64(total, popcount(ones));
+
+         // One vector (4 integers) at a time
+         for (; i + 4 <= n; i += 4)
+         {
+            auto v = load_xor<shifted>(p1+i, p2+i, shift, shift2);
+            total = _mm256_add_epi64(total, popcount(v));
+         }
+
+         std::size_t count = sum(total);
+
+         // The remaining integers
+         for (; i != n; ++i)
+         {
+            auto v = p2[i];
+            if constexpr (shifted)
+               v = (v >> shift_) | (p2[i+1] << (64 - shift_));
+            count += _mm_popcnt_u64(p1[i] ^ v);
+         }
+         return count;
+      }
+
+      // All 64 shifts, 4 at a time, of the integer pair b, b2
+      CYCFI_Q_TARGET("avx2")
+      inline void xor_count_bits_block(
+         std::uint64_t a_, std::uint64_t b_, std::uint64_t b2_, __m256i* acc)
+      {
+         auto a = _mm256_set1_epi64x(a_);
+         auto b = _mm256_set1_epi64x(b_);
+         auto b2 = _mm256_set1_epi64x(b2_);
+         auto shift = _mm256_setr_epi64x(0, 1, 2, 3);
+         auto const four = _mm256_set1_epi64x(4);
+         auto const sixty_four = _mm256_set1_epi64x(64);
+         for (std::size_t g = 0; g != 16; ++g)
+         {
+            // Note: shifting left by 64 gives zero
+            auto v = _mm256_or_si256(
+               _mm256_srlv_epi64(b, shift)
+             , _mm256_sllv_epi64(b2, _mm256_sub_epi64(sixty_four, shift))
+            );
+            acc[g] = _mm256_add_epi64(acc[g], popcount(_mm256_xor_si256(a, v)));
+            shift = _mm256_add_epi64(shift, four);
+         }
+      }
+   }
+
+   template <typename T>
+   CYCFI_Q_TARGET("avx2")
+   inline void xor_count_bits_block_avx2(
+      T const* p1, T const* p2
+    , std::size_t n, std::size_t* out)
+   {
+      __m256i acc[16];
+      for (auto& e : acc)
+         e = _mm256_setzero_si256();
+      for (std::size_t i = 0; i != n; ++i)
+         avx2::xor_count_bits_block(p1[i], p2[i], p2[i+1], acc);
+      for (std::size_t g = 0; g != 16; ++g)
+         _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + g*4), acc[g]);
+   }
+
+   template <typename T>
+   inline std::size_t xor_count_bits_avx2(
+      T const* p1, T const* p2
+    , std::size_t n, std::size_t shift)
+   {
+      return (shift == 0)?
+         avx2::xor_count_bits<false>(p1, p2, n, shift) :
+         avx2::xor_count_bits<true>(p1, p2, n, shift);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // avx512
+   ////////////////////////////////////////////////////////////////////////////
+   namespace avx512
+   {
+      // GCC implements the unmasked forms of some AVX-512 intrinsics (e.g.
+      // _mm512_srl_epi64 or _mm512_reduce_add_epi64) on top of an undefined
+      // vector, and warns that it may be used uninitialized. We use the
+      // zero-masking forms, with all the lanes selected, instead.
+      constexpr __mmask8 all_lanes = 0xff;
+
+      // XOR a with b (shifted, spilling over from b2)
+      template <bool shifted>
+      CYCFI_Q_TARGET("avx512f")
+      inline __m512i xor_(
+         __m512i a, __m512i b, __m512i b2, __m128i shift, __m128i shift2)
+      {
+         if constexpr (shifted)
+         {
+            b = _mm512_or_si512(
+               _mm512_maskz_srl_epi64(all_lanes, b, shift)
+             , _mm512_maskz_sll_epi64(all_lanes, b2, shift2)
+            );
+         }
+         return _mm512_xor_si512(a, b);
+      }
+
+      CYCFI_Q_TARGET("avx512f")
+      inline std::uint64_t sum(__m512i v)
+      {
+         alignas(64) std::uint64_t lanes[8];
+         _mm512_store_si512(lanes, v);
+         std::uint64_t r = 0;
+         for (auto x : lanes)
+            r += x;
+         return r;
+      }
+
+      template <bool shifted, typename T>
+      CYCFI_Q_TARGET("avx512f,avx512vpopcntdq")
+      inline std::size_t xor_count_bits(
+         T const* p1, T const* p2
+       , std::size_t n, std::size_t shift_)
+      {
+         auto shift = _mm_cvtsi32_si128(int(shift_));
+         auto shift2 = _mm_cvtsi32_si128(int(64 - shift_));
+         auto total = _mm512_setzero_si512();
+
+         std::size_t i = 0;
+         for (; i + 8 <= n; i += 8)
+         {
+            auto a = _mm512_loadu_si512(p1+i);
+            auto b = _mm512_loadu_si512(p2+i);
+            auto b2 = b;
+            if constexpr (shifted)
+               b2 = _mm512_loadu_si512(p2+i+1);
+            auto v = xor_<shifted>(a, b, b2, shift, shift2);
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(v));
+         }
+
+         // The remaining integers
+         if (i != n)
+         {
+            __mmask8 mask = (1u << (n - i)) - 1;
+            auto a = _mm512_maskz_loadu_epi64(mask, p1+i);
+            auto b = _mm512_maskz_loadu_epi64(mask, p2+i);
+            auto b2 = b;
+            if constexpr (shifted)
+               b2 = _mm512_maskz_loadu_epi64(mask, p2+i+1);
+            auto v = xor_<shifted>(a, b, b2, shift, shift2);
+            total = _mm512_add_epi64(total, _mm512_popcnt_epi64(v));
+         }
+         return sum(total);
+      }
+   }
+
+   template <typename T>
+   CYCFI_Q_TARGET("avx512f,avx512vpopcntdq")
+   inline void xor_count_bits_block_avx512(
+      T const* p1, T const* p2
+    , std::size_t n, std::size_t* out)
+   {
+      using avx512::all_lanes;
+      __m512i acc[8];
+      for (auto& e : acc)
+         e = _mm512_setzero_si512();
+
+      auto const eight = _mm512_set1_epi64(8);
+      auto const sixty_four = _mm512_set1_epi64(64);
+      for (std::size_t i = 0; i != n; ++i)
+      {
+         // All 64 shifts, 8 at a time, of the integer pair p2[i], p2[i+1]
+         auto a = _mm512_set1_epi64(p1[i]);
+         auto b = _mm512_set1_epi64(p2[i]);
+         auto b2 = _mm512_set1_epi64(p2[i+1]);
+         auto shift = _mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7);
+         for (std::size_t g = 0; g != 8; ++g)
+         {
+            // Note: shifting left by 64 gives zero
+            auto v = _mm512_or_si512(
+               _mm512_maskz_srlv_epi64(all_lanes, b, shift)
+             , _mm512_maskz_sllv_epi64(
+                  all_lanes, b2, _mm512_sub_epi64(sixty_four, shift))
+            );
+            v = _mm512_popcnt_epi64(_mm512_xor_si512(a, v));
+            acc[g] = _mm512_add_epi64(acc[g], v);
+            shift = _mm512_add_epi64(shift, eight);
+         }
+      }
+      for (std::size_t g = 0; g != 8; ++g)
+         _mm512_storeu_si512(out + g*8, acc[g]);
+   }
+
+   template <typename T>
+   inline std::size_t xor_count_bits_avx512(
+      T const* p1, T const* p2
+    , std::size_t n, std::size_t shift)
+   {
+      return (shift == 0)?
+         avx512::xor_count_bits<false>(p1, p2, n, shift) :
+         avx512::xor_count_bits<true>(p1, p2, n, shift);
+   }
+
+#endif // CYCFI_Q_X86_SIMD
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Runtime dispatch. The kernels are available for the 64-bit unsigned
+   // integer types only (see is_uint64). xor_count_bits and
+   // xor_count_bits_block select the kernel on the first call for these,
+   // and use the scalar code for the other types.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename T = std::uint64_t>
+   using xor_count_bits_fn = std::size_t(*)(
+      T const* p1, T const* p2, std::size_t n, std::size_t shift);
+
+   template <typename T = std::uint64_t>
+   inline xor_count_bits_fn<T> get_xor_count_bits(simd_level level)
+   {
+      static_assert(is_uint64<T>, "Error: T must be a 64-bit unsigned integer.");
+      switch (level)
+      {
+#if defined(CYCFI_Q_X86_SIMD)
+         case simd_level::popcnt: return xor_count_bits_popcnt<T>;
+         case simd_level::avx2:   return xor_count_bits_avx2<T>;
+         case simd_level::avx512: return xor_count_bits_avx512<T>;
+#endif
+         default:                 return xor_count_bits_scalar<T>;
+      }
+   }
+
+   template <typename T = std::uint64_t>
+   using xor_count_bits_block_fn = void(*)(
+      T const* p1, T const* p2, std::size_t n, std::size_t* out);
+
+   template <typename T = std::uint64_t>
+   inline xor_count_bits_block_fn<T> get_xor_count_bits_block(simd_level level)
+   {
+      static_assert(is_uint64<T>, "Error: T must be a 64-bit unsigned integer.");
+      switch (level)
+      {
+#if defined(CYCFI_Q_X86_SIMD)
+         case simd_level::popcnt: return xor_count_bits_block_popcnt<T>;
+         case simd_level::avx2:   return xor_count_bits_block_avx2<T>;
+         case simd_level::avx512: return xor_count_bits_block_avx512<T>;
+#endif
+         default:                 return xor_count_bits_block_scalar<T>;
+      }
+   }
+
+   template <typename T>
+   inline std::size_t xor_count_bits(
+      T const* p1, T const* p2, std::size_t n, std::size_t shift)
+   {
+      if constexpr (is_uint64<T>)
+      {
+         static xor_count_bits_fn<T> const f =
+            get_xor_count_bits<T>(best_simd_level());
+         return f(p1, p2, n, shift);
+      }
+      else
+      {
+         return xor_count_bits_scalar(p1, p2, n, shift);
+      }
+   }
+
+   template <typename T>
+   inline void xor_count_bits_block(
+      T const* p1, T const* p2, std::size_t n, std::size_t* out)
+   {
+      if constexpr (is_uint64<T>)
+      {
+         static xor_count_bits_block_fn<T> const f =
+            get_xor_count_bits_block<T>(best_simd_level());
+         f(p1, p2, n, out);
+      }
+      else
+      {
+         xor_count_bits_block_scalar(p1, p2, n, out);
+      }
+   }
+}
+
+#endif
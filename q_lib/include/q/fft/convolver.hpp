@@ -0,0 +1,519 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_CONVOLVER_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_CONVOLVER_HPP_OCTOBER_17_2020
+
+#include <q/fft/fft_plan.hpp>
+#include <q/detail/spectrum_mac.hpp>
+#include <q/support/audio_stream.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // read_channel reads one channel of an audio file, e.g. a wav_reader,
+   // from the current position to the end. Use it to load impulse responses
+   // for convolution_ir.
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename Reader>
+   std::vector<float> read_channel(Reader& reader, std::size_t channel);
+
+   namespace detail
+   {
+      // The spectra of one partition size: the IR, cut into partitions of
+      // block_size samples, each zero padded to 2 * block_size and
+      // transformed. The spectra are in split form (see spectrum_mac), with
+      // stride bins: DC to Nyquist (block_size+1 bins), padded with zeros
+      // to a multiple of 8.
+      class ir_partitions
+      {
+      public:
+
+         ir_partitions(float const* ir, std::size_t length, std::size_t block_size);
+
+         std::size_t          block_size() const   { return _block_size; }
+         std::size_t          stride() const       { return _stride; }
+         std::size_t          size() const         { return _size; }
+         rfft_plan const&     plan() const         { return _plan; }
+         float const*         operator[](std::size_t i) const;
+
+      private:
+
+         struct alignas(32) block
+         {
+            float             data[8];
+         };
+
+         std::size_t          _block_size;
+         std::size_t          _stride;
+         std::size_t          _size;
+         rfft_plan            _plan;
+         std::vector<block>   _spectra;
+      };
+
+      // Uniformly partitioned overlap-save convolution with one partition
+      // size. See convolver.
+      class convolver_stage
+      {
+      public:
+
+         explicit             convolver_stage(ir_partitions const& ir);
+
+         void                 process(float const* in, float* out, std::size_t n, bool add);
+         void                 reset();
+
+      private:
+
+         struct alignas(32) block
+         {
+            float             data[8];
+         };
+
+         void                 process_block();
+         float*               fdl(std::size_t i);
+         float*               acc();
+
+         ir_partitions const& _ir;
+         std::size_t          _block_size;
+         std::size_t          _pos = 0;
+         std::size_t          _count = 0;
+         std::vector<float>   _input;
+         std::vector<float>   _output;
+         std::vector<float>   _frame;
+         std::vector<block>   _fdl;
+         std::vector<block>   _acc;
+         spectrum_mac_fn      _mac;
+      };
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // convolution_ir is an impulse response (IR), prepared for the
+   // convolver: cut into partitions of block_size samples and transformed
+   // to the frequency domain. All the work is done by the constructor,
+   // which allocates and may take a while for long IRs: construct it off
+   // the audio thread, e.g. with std::async, then hand it over to the
+   // convolver(s).
+   //
+   // With the default tail_block_size = 0, all the partitions have the
+   // same size: the cost per sample grows with the IR length over the block
+   // size. Given a tail_block_size (a power of 2 > block_size), the IR is
+   // cut in two: a head of tail_block_size - block_size samples in small
+   // partitions, keeping the latency of the small block size, and the rest
+   // in large partitions, which are much cheaper per sample. The large
+   // partitions are computed once every tail_block_size samples, so the
+   // cost is not spread evenly over the blocks.
+   //
+   // The convolution_ir is not modified after construction. It can be
+   // shared by many convolvers, e.g. one per channel, and threads.
+   ////////////////////////////////////////////////////////////////////////////
+   class convolution_ir
+   {
+   public:
+
+                              convolution_ir(
+                                 float const* ir, std::size_t length
+                               , std::size_t block_size
+                               , std::size_t tail_block_size = 0
+                              );
+
+                              convolution_ir(
+                                 std::vector<float> const& ir
+                               , std::size_t block_size
+                               , std::size_t tail_block_size = 0
+                              );
+
+      std::size_t             length() const          { return _length; }
+      std::size_t             block_size() const      { return _head.block_size(); }
+      std::size_t             tail_block_size() const;
+
+   private:
+
+      friend class convolver;
+
+      std::size_t             _length;
+      detail::ir_partitions   _head;
+      std::optional<detail::ir_partitions> _tail;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // convolver is a partitioned FFT convolution engine for long impulse
+   // responses (e.g. cabinets and rooms, up to several seconds), far too
+   // long for a time-domain FIR.
+   //
+   // The input is processed in blocks of block_size samples. Each block,
+   // with the previous one, is transformed (2 * block_size rfft) and stored
+   // in a frequency-domain delay line (FDL) of one spectrum per IR
+   // partition. The output spectrum is the sum of the products of the
+   // delayed input spectra and the IR partitions (see spectrum_mac,
+   // vectorized). Its inverse transform gives the next block_size output
+   // samples (uniformly partitioned overlap-save).
+   //
+   // process(in, out, n) processes a block of n samples of any size. in and
+   // out may be the same buffer. The output is delayed by latency() =
+   // block_size samples. The convolver allocates at construction time only:
+   // process does not allocate or lock.
+   ////////////////////////////////////////////////////////////////////////////
+   class convolver
+   {
+   public:
+
+      using ir_ptr = std::shared_ptr<convolution_ir const>;
+
+      explicit                convolver(ir_ptr ir);
+
+      void                    process(float const* in, float* out, std::size_t n);
+      std::size_t             latency() const      { return _ir->block_size(); }
+      ir_ptr const&           ir() const           { return _ir; }
+      void                    reset();
+
+   private:
+
+      ir_ptr                  _ir;
+      detail::convolver_stage _head;
+      std::optional<detail::convolver_stage> _tail;
+      std::vector<float>      _scratch;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // convolver_bank is a bank of convolvers, one per channel, processing
+   // audio_channels, e.g. in an audio_stream. Give it one IR for all the
+   // channels, or one IR per channel. All the IRs must have the same block
+   // size, hence the same latency. process handles the channels and the
+   // frames present in both in and out.
+   ////////////////////////////////////////////////////////////////////////////
+   class convolver_bank
+   {
+   public:
+
+      using ir_ptr = convolver::ir_ptr;
+
+                              convolver_bank(ir_ptr ir, std::size_t channels);
+      explicit                convolver_bank(std::vector<ir_ptr> const& irs);
+
+      void                    process(
+                                 audio_channels<float const> const& in
+                               , audio_channels<float> const& out
+                              );
+
+      std::size_t             size() const         { return _channels.size(); }
+      std::size_t             latency() const      { return _channels.front().latency(); }
+      convolver&              operator[](std::size_t channel)  { return _channels[channel]; }
+      void                    reset();
+
+   private:
+
+      std::vector<convolver>  _channels;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Implementation
+   ////////////////////////////////////////////////////////////////////////////
+   template <typename Reader>
+   inline std::vector<float> read_channel(Reader& reader, std::size_t channel)
+   {
+      if (!reader)
+         throw std::runtime_error("Error: Invalid audio file.");
+      std::size_t channels = reader.num_channels();
+      if (channel >= channels)
+         throw std::runtime_error("Error: Invalid audio channel.");
+
+      std::vector<float> r;
+      r.reserve(reader.length() / channels);
+      std::vector<float> buff(1024 * channels);
+      while (auto n = reader.read(buff.data(), std::uint32_t(buff.size())))
+      {
+         for (std::size_t i = channel; i < n; i += channels)
+            r.push_back(buff[i]);
+      }
+      return r;
+   }
+
+   namespace detail
+   {
+      inline std::size_t check_block_size(std::size_t n)
+      {
+         if (n < 2 || (n & (n-1)))
+            throw std::runtime_error(
+               "Error: Block size must be a power of 2 >= 2."
+            );
+         return n;
+      }
+
+      // Packed Hermitian spectrum (see rfft) of n floats to split form
+      inline void spectrum_to_split(float const* packed, float* split, std::size_t n, std::size_t stride)
+      {
+         auto half = n/2;
+         auto re = split;
+         auto im = split + stride;
+         re[0] = packed[0];
+         im[0] = 0.0f;
+         re[half] = packed[1];
+         im[half] = 0.0f;
+         for (std::size_t k = 1; k != half; ++k)
+         {
+            re[k] = packed[2*k];
+            im[k] = packed[2*k+1];
+         }
+      }
+
+      // Split form to packed Hermitian spectrum (see rfft) of n floats
+      inline void split_to_spectrum(float const* split, float* packed, std::size_t n, std::size_t stride)
+      {
+         auto half = n/2;
+         auto re = split;
+         auto im = split + stride;
+         packed[0] = re[0];
+         packed[1] = re[half];
+         for (std::size_t k = 1; k != half; ++k)
+         {
+            packed[2*k] = re[k];
+            packed[2*k+1] = im[k];
+         }
+      }
+
+      inline ir_partitions::ir_partitions(
+         float const* ir, std::size_t length, std::size_t block_size)
+       : _block_size(check_block_size(block_size))
+       , _stride((block_size + 1 + 7) & ~std::size_t(7))
+       , _size((length + block_size - 1) / block_size)
+       , _plan(2 * block_size)
+       , _spectra(_size * 2 * _stride / 8)
+      {
+         std::vector<float> frame(2 * block_size);
+         for (std::size_t i = 0; i != _size; ++i)
+         {
+            auto first = ir + i * block_size;
+            auto last = ir + std::min(length, (i+1) * block_size);
+            std::fill(std::copy(first, last, frame.begin()), frame.end(), 0.0f);
+            _plan.forward(frame.data());
+            auto spectrum = reinterpret_cast<float*>(_spectra.data()) + i * 2 * _stride;
+            spectrum_to_split(frame.data(), spectrum, frame.size(), _stride);
+         }
+      }
+
+      inline float const* ir_partitions::operator[](std::size_t i) const
+      {
+         return reinterpret_cast<float const*>(_spectra.data()) + i * 2 * _stride;
+      }
+
+      inline convolver_stage::convolver_stage(ir_partitions const& ir)
+       : _ir(ir)
+       , _block_size(ir.block_size())
+       , _input(2 * _block_size)
+       , _output(_block_size)
+       , _frame(2 * _block_size)
+       , _fdl(ir.size() * 2 * ir.stride() / 8)
+       , _acc(2 * ir.stride() / 8)
+       , _mac(get_spectrum_mac(best_simd_level()))
+      {
+      }
+
+      inline float* convolver_stage::fdl(std::size_t i)
+      {
+         return reinterpret_cast<float*>(_fdl.data()) + i * 2 * _ir.stride();
+      }
+
+      inline float* convolver_stage::acc()
+      {
+         return reinterpret_cast<float*>(_acc.data());
+      }
+
+      inline void convolver_stage::reset()
+      {
+         _pos = 0;
+         _count = 0;
+         std::fill(_input.begin(), _input.end(), 0.0f);
+         std::fill(_output.begin(), _output.end(), 0.0f);
+         std::fill(_fdl.begin(), _fdl.end(), block{});
+      }
+
+      inline void convolver_stage::process(
+         float const* in, float* out, std::size_t n, bool add)
+      {
+         while (n != 0)
+         {
+            auto k = std::min(n, _block_size - _count);
+
+            // Read the input first: in and out may be the same buffer
+            std::copy(in, in + k, _input.begin() + _block_size + _count);
+            auto src = _output.begin() + _count;
+            if (add)
+               std::transform(out, out + k, src, out, std::plus<float>{});
+            else
+               std::copy(src, src + k, out);
+
+            _count += k;
+            if (_count == _block_size)
+            {
+               _count = 0;
+               process_block();
+            }
+            in += k;
+            out += k;
+            n -= k;
+         }
+      }
+
+      inline void convolver_stage::process_block()
+      {
+         auto size = _ir.size();
+         auto stride = _ir.stride();
+
+         // Transform the last two blocks into the FDL. The previous input
+         // spectra move one partition down the line.
+         std::copy(_input.begin(), _input.end(), _frame.begin());
+         std::copy(_input.begin() + _block_size, _input.end(), _input.begin());
+         _ir.plan().forward(_frame.data());
+         _pos = (_pos == 0)? size - 1 : _pos - 1;
+         spectrum_to_split(_frame.data(), fdl(_pos), _frame.size(), stride);
+
+         // Multiply-accumulate: input spectrum i blocks ago times partition i
+         std::fill(_acc.begin(), _acc.end(), block{});
+         for (std::size_t i = 0; i != size; ++i)
+         {
+            auto j = _pos + i;
+            if (j >= size)
+               j -= size;
+            _mac(acc(), fdl(j), _ir[i], stride);
+         }
+
+         // Overlap-save: the second half is the linear convolution
+         split_to_spectrum(acc(), _frame.data(), _frame.size(), stride);
+         _ir.plan().inverse(_frame.data());
+         std::copy(_frame.begin() + _block_size, _frame.end(), _output.begin());
+      }
+   }
+
+   inline convolution_ir::convolution_ir(
+      float const* ir, std::size_t length
+    , std::size_t block_size
+    , std::size_t tail_block_size
+   )
+    : _length(length)
+      // With a tail, the head is the first tail_block_size - block_size
+      // samples: the tail's extra latency is made up for by starting the
+      // tail that much earlier.
+    , _head(
+         ir
+       , (tail_block_size > block_size)?
+            std::min(length, tail_block_size - block_size) : length
+       , block_size
+      )
+   {
+      if (length == 0)
+         throw std::runtime_error("Error: Empty impulse response.");
+      if (tail_block_size != 0)
+      {
+         if (tail_block_size <= block_size || (tail_block_size & (tail_block_size-1)))
+            throw std::runtime_error(
+               "Error: Tail block size must be a power of 2 > block size."
+            );
+         auto head_length = tail_block_size - block_size;
+         if (length > head_length)
+            _tail.emplace(ir + head_length, length - head_length, tail_block_size);
+      }
+   }
+
+   inline convolution_ir::convolution_ir(
+      std::vector<float> const& ir
+    , std::size_t block_size
+    , std::size_t tail_block_size
+   )
+    : convolution_ir(ir.data(), ir.size(), block_size, tail_block_size)
+   {
+   }
+
+   inline std::size_t convolution_ir::tail_block_size() const
+   {
+      return _tail? _tail->block_size() : 0;
+   }
+
+   inline convolver::convolver(ir_ptr ir)
+    : _ir(std::move(ir))
+    , _head(_ir->_head)
+   {
+      if (_ir->_tail)
+      {
+         _tail.emplace(*_ir->_tail);
+         _scratch.resize(_ir->block_size());
+      }
+      reset();
+   }
+
+   inline void convolver::reset()
+   {
+      _head.reset();
+      if (_tail)
+         _tail->reset();
+   }
+
+   inline void convolver::process(float const* in, float* out, std::size_t n)
+   {
+      if (!_tail)
+         return _head.process(in, out, n, false);
+
+      // Both stages read the input: keep a copy, since in and out may be
+      // the same buffer
+      while (n != 0)
+      {
+         auto k = std::min(n, _scratch.size());
+         std::copy(in, in + k, _scratch.begin());
+         _head.process(_scratch.data(), out, k, false);
+         _tail->process(_scratch.data(), out, k, true);
+         in += k;
+         out += k;
+         n -= k;
+      }
+   }
+
+   inline convolver_bank::convolver_bank(ir_ptr ir, std::size_t channels)
+    : convolver_bank(std::vector<ir_ptr>(channels, ir))
+   {
+   }
+
+   inline convolver_bank::convolver_bank(std::vector<ir_ptr> const& irs)
+   {
+      if (irs.empty())
+         throw std::runtime_error("Error: No impulse response.");
+      _channels.reserve(irs.size());
+      for (auto const& ir : irs)
+      {
+         if (ir->block_size() != irs.front()->block_size())
+            throw std::runtime_error(
+               "Error: Impulse responses must have the same block size."
+            );
+         _channels.emplace_back(ir);
+      }
+   }
+
+   inline void convolver_bank::process(
+      audio_channels<float const> const& in
+    , audio_channels<float> const& out
+   )
+   {
+      auto channels = std::min({ size(), in.size(), out.size() });
+      for (std::size_t ch = 0; ch != channels; ++ch)
+      {
+         auto frames = std::min(in[ch].size(), out[ch].size());
+         _channels[ch].process(in[ch].begin(), out[ch].begin(), frames);
+      }
+   }
+
+   inline void convolver_bank::reset()
+   {
+      for (auto& c : _channels)
+         c.reset();
+   }
+}
+
+#endif
@@ -21,6 +21,7 @@
 #define CYCFI_Q_FFT_DECEMBER_25_2018
 
 #include <q/support/literals.hpp>
+#include <q/detail/fft_float.hpp>
 #include <utility>
 
 namespace cycfi::q
@@ -147,6 +148,14 @@ namespace cycfi::q
       }
    }
 
+   ////////////////////////////////////////////////////////////////////////////
+   // fft<N> computes the forward FFT of N complex numbers, in place. data
+   // holds 2N doubles: the interleaved real and imaginary parts. The
+   // transform is not normalized (the DC bin is the sum of the inputs).
+   //
+   // ifft<N> computes the inverse FFT, normalized by 1/N, such that
+   // ifft<N> undoes fft<N>.
+   ////////////////////////////////////////////////////////////////////////////
    template <std::size_t N>
    inline void fft(double* data)
    {
@@ -154,6 +163,170 @@ namespace cycfi::q
       detail::scramble<N>(data);
       recursion.apply(data);
    }
+
+   template <std::size_t N>
+   inline void ifft(double* data)
+   {
+      // The inverse FFT is the forward FFT of the conjugate, conjugated
+      for (std::size_t i = 1; i < 2*N; i += 2)
+         data[i] = -data[i];
+      fft<N>(data);
+      constexpr double scale = 1.0 / N;
+      for (std::size_t i = 0; i < 2*N; i += 2)
+      {
+         data[i] *= scale;
+         data[i+1] *= -scale;
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // rfft<N> computes the forward FFT of N real numbers, in place, using a
+   // complex FFT of N/2 points: the even and odd samples are taken as the
+   // real and imaginary parts, and the two interleaved spectra are then
+   // separated. This is about half the work of fft<N> with the imaginary
+   // parts zeroed.
+   //
+   // The result is the packed Hermitian spectrum: the bins N/2+1 to N-1
+   // are the complex conjugates of the bins N/2-1 to 1, and are not
+   // stored. The DC and Nyquist bins are real, so the N doubles in data
+   // are:
+   //
+   //    data[0]:             DC (bin 0)
+   //    data[1]:             Nyquist (bin N/2)
+   //    data[2k], data[2k+1]: The real and imaginary parts of bin k,
+   //                         for k = 1 to N/2-1
+   //
+   // irfft<N> computes the inverse, from the packed Hermitian spectrum back
+   // to N real numbers, normalized by 1/N, such that irfft<N> undoes
+   // rfft<N>.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t N>
+   inline void rfft(double* data)
+   {
+      static_assert(N >= 4 && (N & (N-1)) == 0, "N must be a power of 2 >= 4");
+
+      fft<N/2>(data);
+
+      // Split the two spectra: given Z, the FFT of the even (E) and odd (O)
+      // samples, X[k] = E[k] + W^k O[k] and X[N/2-k] = conj(E[k] - W^k O[k])
+      // where W = exp(-2*pi*i/N).
+      constexpr auto sina = -detail::sin(N, 1);
+      constexpr auto sinb = -detail::sin(N, 2);
+
+      double wpr = -2.0*sina*sina;
+      double wpi = sinb;
+      double wr = 1.0 + wpr;
+      double wi = wpi;
+
+      for (std::size_t k = 1; k <= N/4; ++k)
+      {
+         auto i = 2*k;
+         auto j = N - i;
+
+         double er = 0.5 * (data[i] + data[j]);
+         double ei = 0.5 * (data[i+1] - data[j+1]);
+         double or_ = 0.5 * (data[i+1] + data[j+1]);
+         double oi = -0.5 * (data[i] - data[j]);
+         double tr = wr*or_ - wi*oi;
+         double ti = wr*oi + wi*or_;
+
+         data[i] = er + tr;
+         data[i+1] = ei + ti;
+         data[j] = er - tr;
+         data[j+1] = ti - ei;
+
+         double wtemp = wr;
+         wr += wr*wpr - wi*wpi;
+         wi += wi*wpr + wtemp*wpi;
+      }
+
+      double dc = data[0];
+      data[0] = dc + data[1];
+      data[1] = dc - data[1];
+   }
+
+   template <std::size_t N>
+   inline void irfft(double* data)
+   {
+      static_assert(N >= 4 && (N & (N-1)) == 0, "N must be a power of 2 >= 4");
+
+      // Merge the two spectra back: E[k] = (X[k] + conj(X[N/2-k])) / 2,
+      // O[k] = (X[k] - conj(X[N/2-k])) / (2 W^k) and Z[k] = E[k] + i O[k].
+      double dc = data[0];
+      data[0] = 0.5 * (dc + data[1]);
+      data[1] = 0.5 * (dc - data[1]);
+
+      constexpr auto sina = -detail::sin(N, 1);
+      constexpr auto sinb = -detail::sin(N, 2);
+
+      double wpr = -2.0*sina*sina;
+      double wpi = sinb;
+      double wr = 1.0 + wpr;
+      double wi = wpi;
+
+      for (std::size_t k = 1; k <= N/4; ++k)
+      {
+         auto i = 2*k;
+         auto j = N - i;
+
+         double er = 0.5 * (data[i] + data[j]);
+         double ei = 0.5 * (data[i+1] - data[j+1]);
+         double tr = 0.5 * (data[i] - data[j]);
+         double ti = 0.5 * (data[i+1] + data[j+1]);
+
+         // O = t * conj(W^k)
+         double or_ = tr*wr + ti*wi;
+         double oi = ti*wr - tr*wi;
+
+         data[i] = er - oi;
+         data[i+1] = ei + or_;
+         data[j] = er + oi;
+         data[j+1] = or_ - ei;
+
+         double wtemp = wr;
+         wr += wr*wpr - wi*wpi;
+         wi += wi*wpr + wtemp*wpi;
+      }
+
+      ifft<N/2>(data);
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Single precision fft, ifft, rfft and irfft. Same as above, with the
+   // same data layout, but for float data. These use precomputed twiddle
+   // tables and radix-4 butterflies, vectorized with SSE2 or AVX2 if
+   // available (see detail/fft_float.hpp). The tables for each N are
+   // computed on first use.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t N>
+   inline void fft(float* data)
+   {
+      static_assert(N >= 2 && (N & (N-1)) == 0, "N must be a power of 2 >= 2");
+      detail::fft_float(data, detail::get_fft_float_tables<N>().view());
+   }
+
+   template <std::size_t N>
+   inline void ifft(float* data)
+   {
+      static_assert(N >= 2 && (N & (N-1)) == 0, "N must be a power of 2 >= 2");
+      detail::ifft_float(data, detail::get_fft_float_tables<N>().view());
+   }
+
+   template <std::size_t N>
+   inline void rfft(float* data)
+   {
+      static_assert(N >= 4 && (N & (N-1)) == 0, "N must be a power of 2 >= 4");
+      fft<N/2>(data);
+      detail::rfft_split(data, N, detail::get_rfft_float_tables<N>().twiddles);
+   }
+
+   template <std::size_t N>
+   inline void irfft(float* data)
+   {
+      static_assert(N >= 4 && (N & (N-1)) == 0, "N must be a power of 2 >= 4");
+      detail::rfft_merge(data, N, detail::get_rfft_float_tables<N>().twiddles);
+      ifft<N/2>(data);
+   }
 }
 
 #endif
@@ -0,0 +1,147 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_FFT_PLAN_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_FFT_PLAN_HPP_OCTOBER_17_2020
+
+#include <q/detail/fft_float.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // fft_plan is a single precision FFT with a size given at runtime, e.g.
+   // from a configuration or the sample rate. The size n must be a power of
+   // 2 >= 2. The bit reversal permutation and the twiddles are computed once,
+   // at construction time, and the best kernel for the CPU is selected (see
+   // detail/fft_float.hpp).
+   //
+   // forward(data) and inverse(data) are the same as fft<N>(data) and
+   // ifft<N>(data) with N = size(): in place, on the caller's buffer of n
+   // complex numbers (2n floats, the interleaved real and imaginary parts).
+   // The inverse is normalized by 1/n. These do not allocate.
+   //
+   // The plan is not modified after construction, so a single plan can be
+   // shared and used by many threads at the same time.
+   ////////////////////////////////////////////////////////////////////////////
+   class fft_plan
+   {
+   public:
+
+      explicit                fft_plan(std::size_t n);
+
+      std::size_t             size() const      { return _n; }
+      void                    forward(float* data) const;
+      void                    inverse(float* data) const;
+
+   private:
+
+      // The twiddle arrays are multiples of 8 floats, aligned for AVX
+      struct alignas(32) block
+      {
+         float                data[8];
+      };
+
+      float*                  twiddles()        { return reinterpret_cast<float*>(_twiddles.data()); }
+      float const*            twiddles() const  { return reinterpret_cast<float const*>(_twiddles.data()); }
+      detail::fft_tables_view view() const;
+
+      std::size_t             _n;
+      std::vector<block>      _twiddles;
+      std::vector<std::uint32_t> _bitrev;
+      std::size_t             _bitrev_size;
+      detail::fft_float_fn    _forward;
+      detail::fft_float_fn    _inverse;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // rfft_plan is the real FFT counterpart of fft_plan: forward(data) and
+   // inverse(data) are the same as rfft<N>(data) and irfft<N>(data) with
+   // N = size(), from n real numbers to the packed Hermitian spectrum (see
+   // rfft) and back. The size n must be a power of 2 >= 4.
+   ////////////////////////////////////////////////////////////////////////////
+   class rfft_plan
+   {
+   public:
+
+      explicit                rfft_plan(std::size_t n);
+
+      std::size_t             size() const      { return _n; }
+      void                    forward(float* data) const;
+      void                    inverse(float* data) const;
+
+   private:
+
+      std::size_t             _n;
+      fft_plan                _fft;
+      std::vector<float>      _twiddles;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Implementation
+   ////////////////////////////////////////////////////////////////////////////
+   namespace detail
+   {
+      inline std::size_t check_fft_size(std::size_t n, std::size_t min_size)
+      {
+         if (n < min_size || (n & (n-1)))
+            throw std::runtime_error(
+               "Error: FFT size must be a power of 2 >= " + std::to_string(min_size) + "."
+            );
+         return n;
+      }
+   }
+
+   inline fft_plan::fft_plan(std::size_t n)
+    : _n(detail::check_fft_size(n, 2))
+    , _twiddles(detail::fft_twiddles_size(n) / 8)
+    , _bitrev(n)
+    , _forward(detail::get_fft_float(detail::best_simd_level(), false))
+    , _inverse(detail::get_fft_float(detail::best_simd_level(), true))
+   {
+      _bitrev_size = detail::init_fft_tables(n, twiddles(), _bitrev.data());
+   }
+
+   inline detail::fft_tables_view fft_plan::view() const
+   {
+      return { _n, twiddles(), _bitrev.data(), _bitrev_size };
+   }
+
+   inline void fft_plan::forward(float* data) const
+   {
+      _forward(data, view());
+   }
+
+   inline void fft_plan::inverse(float* data) const
+   {
+      _inverse(data, view());
+   }
+
+   inline rfft_plan::rfft_plan(std::size_t n)
+    : _n(detail::check_fft_size(n, 4))
+    , _fft(n/2)
+    , _twiddles(n/2)
+   {
+      detail::init_rfft_twiddles(n, _twiddles.data());
+   }
+
+   inline void rfft_plan::forward(float* data) const
+   {
+      _fft.forward(data);
+      detail::rfft_split(data, _n, _twiddles.data());
+   }
+
+   inline void rfft_plan::inverse(float* data) const
+   {
+      detail::rfft_merge(data, _n, _twiddles.data());
+      _fft.inverse(data);
+   }
+}
+
+#endif
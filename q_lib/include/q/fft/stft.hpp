@@ -0,0 +1,158 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_STFT_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_STFT_HPP_OCTOBER_17_2020
+
+#include <q/fft/fft.hpp>
+#include <q/fft/window.hpp>
+#include <q/utility/ring_buffer.hpp>
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // stft is a streaming short-time Fourier transform (STFT) and inverse
+   // (ISTFT) for frame-based spectral processing. The input goes to a ring
+   // buffer of N samples. Every hop samples, the latest N samples are
+   // multiplied by the window W (see window_table) and transformed (see
+   // rfft). The spectral callback f(spectrum) is then called with the
+   // packed Hermitian spectrum of N floats, which it may modify in place.
+   // The spectrum is transformed back (see irfft), multiplied by the
+   // synthesis window and overlap-added to the output.
+   //
+   // The synthesis window is the analysis window, normalized by the sum of
+   // the squared windows that overlap at each position (weighted overlap-
+   // add). Without spectral modifications, the output is the input delayed
+   // by latency() = N-1 samples, for any window and any hop that divides N,
+   // e.g. N/4 for 75% overlap, as long as the overlapping windows do not
+   // all vanish at some position. For windows that are zero at the ends
+   // (e.g. hann and blackman), the hop must be less than N: the
+   // constructor throws otherwise.
+   //
+   // process(in, out, n, f) processes a block of n samples of any size.
+   // The hops need not coincide with the blocks. in and out may be the same
+   // buffer. Given the compile-time N, all the buffers are fixed size: the
+   // stft does not allocate.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t N, window_type W = window_type::hann>
+   class stft
+   {
+   public:
+
+      static constexpr std::size_t fft_size = N;
+      static constexpr auto const& window = window_table<W, N>;
+
+      explicit                stft(std::size_t hop);
+
+                              template <typename F>
+      void                    process(float const* in, float* out, std::size_t n, F&& f);
+
+      std::size_t             hop() const       { return _hop; }
+      constexpr std::size_t   latency() const   { return N-1; }
+      void                    reset();
+
+   private:
+
+                              template <typename F>
+      void                    process_frame(F& f);
+
+      using input_buffer = ring_buffer<float, std::array<float, N>>;
+
+      std::size_t const       _hop;
+      std::size_t             _count = 0;
+      input_buffer            _in;
+      std::array<float, N>    _frame;
+      std::array<float, N>    _synthesis;
+      std::array<float, N>    _sum;
+      std::array<float, N>    _out;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Implementation
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t N, window_type W>
+   inline stft<N, W>::stft(std::size_t hop)
+    : _hop(hop)
+   {
+      static_assert(N >= 4 && (N & (N-1)) == 0, "N must be a power of 2 >= 4");
+      if (hop == 0 || hop > N || (N % hop) != 0)
+         throw std::runtime_error(
+            "Error: hop must divide the FFT size."
+         );
+
+      // The sum of the squared windows overlapping at each position
+      std::array<double, N> sum = {};
+      double max_sum = 0;
+      for (std::size_t i = 0; i != N; ++i)
+      {
+         for (std::size_t j = i % hop; j < N; j += hop)
+            sum[i] += double(window[j]) * window[j];
+         max_sum = std::max(max_sum, sum[i]);
+      }
+
+      // The synthesis window: the analysis window normalized by the sum.
+      // The input can't be reconstructed where the sum vanishes.
+      for (std::size_t i = 0; i != N; ++i)
+      {
+         if (sum[i] <= max_sum * 1e-6)
+            throw std::runtime_error(
+               "Error: the hop is too large for the window."
+            );
+         _synthesis[i] = float(window[i] / sum[i]);
+      }
+      reset();
+   }
+
+   template <std::size_t N, window_type W>
+   inline void stft<N, W>::reset()
+   {
+      _count = 0;
+      _in.clear();
+      _sum.fill(0.0f);
+      _out.fill(0.0f);
+   }
+
+   template <std::size_t N, window_type W>
+   template <typename F>
+   inline void stft<N, W>::process(
+      float const* in, float* out, std::size_t n, F&& f)
+   {
+      for (std::size_t i = 0; i != n; ++i)
+      {
+         _in.push(in[i]);
+         if (++_count == _hop)
+         {
+            _count = 0;
+            process_frame(f);
+         }
+         out[i] = _out[_count];
+      }
+   }
+
+   template <std::size_t N, window_type W>
+   template <typename F>
+   inline void stft<N, W>::process_frame(F& f)
+   {
+      // The latest N samples, oldest first
+      for (std::size_t i = 0; i != N; ++i)
+         _frame[i] = _in[N-1-i] * window[i];
+
+      rfft<N>(_frame.data());
+      f(_frame.data());
+      irfft<N>(_frame.data());
+
+      // Overlap-add. The first hop samples are complete.
+      for (std::size_t i = 0; i != N; ++i)
+         _sum[i] += _frame[i] * _synthesis[i];
+      std::copy(_sum.begin(), _sum.begin() + _hop, _out.begin());
+      std::copy(_sum.begin() + _hop, _sum.end(), _sum.begin());
+      std::fill(_sum.end() - _hop, _sum.end(), 0.0f);
+   }
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_WINDOW_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_WINDOW_HPP_OCTOBER_17_2020
+
+#include <q/fft/fft.hpp>
+#include <array>
+#include <cstddef>
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // FFT windows. window_table<W, N> is a constexpr table of the window W of
+   // N points, computed at compile time. The windows are the periodic
+   // (DFT-even) form, suitable for spectral analysis and overlap-add: the
+   // generalized cosine windows
+   //
+   //    w[n] = a0 - a1 cos(2 pi n/N) + a2 cos(4 pi n/N) - a3 cos(6 pi n/N)
+   //
+   // with the coefficients:
+   //
+   //    rectangular:      1
+   //    hann:             0.5, 0.5
+   //    hamming:          0.54, 0.46
+   //    blackman:         0.42, 0.5, 0.08
+   //    blackman_harris:  0.35875, 0.48829, 0.14128, 0.01168 (4-term)
+   ////////////////////////////////////////////////////////////////////////////
+   enum class window_type
+   {
+      rectangular
+    , hann
+    , hamming
+    , blackman
+    , blackman_harris
+   };
+
+   namespace detail
+   {
+      // cos(2 pi k n / N)
+      constexpr double window_cos(std::size_t k, std::size_t n, std::size_t N)
+      {
+         // cos(a pi / N) with a in [0, N] for accuracy: cos(2pi - x) = cos(x)
+         auto a = (2 * k * n) % (2 * N);
+         if (a > N)
+            a = 2*N - a;
+         return cos(unsigned(N), unsigned(a));
+      }
+
+      template <std::size_t N>
+      constexpr std::array<float, N> make_window(
+         double a0, double a1, double a2, double a3)
+      {
+         std::array<float, N> w = {};
+         for (std::size_t n = 0; n != N; ++n)
+         {
+            w[n] = float(
+               a0
+             - a1 * window_cos(1, n, N)
+             + a2 * window_cos(2, n, N)
+             - a3 * window_cos(3, n, N)
+            );
+         }
+         return w;
+      }
+
+      template <window_type W, std::size_t N>
+      constexpr std::array<float, N> make_window()
+      {
+         switch (W)
+         {
+            case window_type::hann:
+               return make_window<N>(0.5, 0.5, 0, 0);
+            case window_type::hamming:
+               return make_window<N>(0.54, 0.46, 0, 0);
+            case window_type::blackman:
+               return make_window<N>(0.42, 0.5, 0.08, 0);
+            case window_type::blackman_harris:
+               return make_window<N>(0.35875, 0.48829, 0.14128, 0.01168);
+            default:
+               return make_window<N>(1, 0, 0, 0);
+         }
+      }
+   }
+
+   template <window_type W, std::size_t N>
+   inline constexpr std::array<float, N> window_table = detail::make_window<W, N>();
+}
+
+#endif
@@ -144,6 +144,12 @@ namespace cycfi::q
          return _latest;
       }
 
+      void reset()
+      {
+         _y1 = _y2 = _latest = 0;
+         _tick = _i = 0;
+      }
+
       float _y1 = 0, _y2 = 0, _latest = 0;
       std::uint16_t _tick = 0, _i = 0;
       std::uint16_t const _reset;
@@ -0,0 +1,114 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_FX_ONSET_DETECTOR_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_FX_ONSET_DETECTOR_HPP_OCTOBER_17_2020
+
+#include <q/support/literals.hpp>
+#include <q/support/decibel.hpp>
+#include <q/fx/envelope.hpp>
+#include <q/fx/special.hpp>
+#include <cmath>
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // onset_detector detects note onsets: abrupt rises in the signal
+   // amplitude. The amplitude is tracked by a fast_envelope_follower (the
+   // fast envelope) which follows the attack of the note closely. The note
+   // itself is tracked by a peak_envelope_follower (the peak envelope, see
+   // peak_env) with a slow release. The base is the peak envelope before
+   // the fast envelope started rising. There is an onset when the fast
+   // envelope rises above the threshold and above the base by the rise
+   // factor. That is, the signal has to rise above the decay of the
+   // previous note. The onset is a single pulse (see
+   // rising_edge). After an onset, no other onset is detected for
+   // min_interval (see monostable), to avoid multiple onsets in the
+   // attack of a note.
+   //
+   //    threshold:  The minimum level of an onset
+   //
+   // The function operator returns true on the sample where an onset is
+   // detected. process(in, n, onsets, max_onsets) processes a block of n
+   // samples, writing the block offsets of the onsets to the onsets buffer,
+   // up to max_onsets. The number of onsets written is returned. The
+   // results are the same as calling the function operator for each sample.
+   //
+   // This is cheap enough (no divisions, no transcendental functions per
+   // sample) to run for every string of a polyphonic (hexaphonic) pickup.
+   ////////////////////////////////////////////////////////////////////////////
+   struct onset_detector
+   {
+      static constexpr auto hold = 10_ms;
+      static constexpr auto release = 100_ms;
+      static constexpr auto min_interval = 30_ms;
+      static constexpr auto rise = 1.5f;           // approx 3.5dB
+
+      onset_detector(decibel threshold, std::uint32_t sps)
+       : _threshold(float(threshold))
+       , _fast_env(hold, sps)
+       , _peak_env(release, sps)
+       , _interval(min_interval, sps)
+      {}
+
+      bool operator()(float s)
+      {
+         auto prev = _fast_env();
+         auto env = _fast_env(std::abs(s));
+         if (env < prev)
+            _base = _peak_env();
+         _peak_env(env);
+
+         bool rising = env > _threshold && env > _base * rise;
+         bool onset = _edge(rising) && !_interval();
+         _interval(onset);
+         _onset = onset;
+         return onset;
+      }
+
+      bool operator()() const
+      {
+         return _onset;
+      }
+
+      std::size_t process(
+         float const* in, std::size_t n
+       , std::size_t* onsets, std::size_t max_onsets)
+      {
+         std::size_t count = 0;
+         for (std::size_t i = 0; i != n; ++i)
+         {
+            if ((*this)(in[i]) && count != max_onsets)
+               onsets[count++] = i;
+         }
+         return count;
+      }
+
+      float peak_env() const
+      {
+         return _peak_env();
+      }
+
+      void reset()
+      {
+         _fast_env.reset();
+         _peak_env = 0.0f;
+         _base = 0.0f;
+         _interval.reset();
+         _edge = rising_edge{};
+         _onset = false;
+      }
+
+      float const             _threshold;
+      fast_envelope_follower  _fast_env;
+      peak_envelope_follower  _peak_env;
+      rising_edge             _edge;
+      monostable              _interval;
+      float                   _base = 0.0f;
+      bool                    _onset = false;
+   };
+}
+
+#endif
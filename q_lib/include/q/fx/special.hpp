@@ -65,6 +65,28 @@ namespace cycfi::q
       T x = 0.0f;
    };
 
+   ////////////////////////////////////////////////////////////////////////////
+   // Downsampling by a factor of two, with a polyphase IIR halfband lowpass
+   // filter for antialiasing (See http://yehar.com/blog/?p=368). The odd and
+   // even source samples are filtered by two chains of one_pole_allpass
+   // running at the downsampled rate, and averaged.
+   //
+   // The passband is flat up to 0.2 of the source sample rate, and the
+   // stopband from 0.3 of the source sample rate is attenuated by 70dB.
+   ////////////////////////////////////////////////////////////////////////////
+   struct halfband_downsample
+   {
+      float operator()(float s1, float s2)
+      {
+         return 0.5f * (_a2(_a1(s2)) + _b2(_b1(s1)));
+      }
+
+      one_pole_allpass _a1{ 0.0798664262363575 };
+      one_pole_allpass _a2{ 0.545323651071132 };
+      one_pole_allpass _b1{ 0.28382934487411 };
+      one_pole_allpass _b2{ 0.834411891480738 };
+   };
+
    ////////////////////////////////////////////////////////////////////////////
    // DC blocker based on Julius O. Smith's document
    //
@@ -0,0 +1,401 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_DECIMATING_PITCH_DETECTOR_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_DECIMATING_PITCH_DETECTOR_HPP_OCTOBER_17_2020
+
+#include <q/pitch/pitch_detector.hpp>
+#include <q/fx/special.hpp>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // The decimating_pitch_detector tracks low register instruments (e.g.
+   // bass), where the highest frequency of interest is much lower than the
+   // sample rate. The input is downsampled by a factor of 2, 4 or 8, and the
+   // pitch_detector runs at the reduced rate. This cuts the cost of the
+   // zero crossing and bitstream processing roughly by the factor.
+   //
+   // Each downsampling stage halves the rate. The last stage uses the
+   // halfband_downsample filter, for a sharp cutoff. The aliases that fall
+   // into the final band come from the edges of the band of the earlier
+   // stages, where the cheaper fast_downsample is enough.
+   //
+   // The period found at the reduced rate is refined at the full rate. The
+   // latest input frames (one analysis window) are kept. Starting from the
+   // latest rising zero crossing, the crossings nearest to each multiple of
+   // the period are followed back in time, for as long as they are within
+   // tolerance. The crossings are linearly interpolated. The refined period
+   // is the average over all the cycles found. The frequency is given for
+   // the full rate, sps.
+   //
+   // The factor is reduced if the highest frequency does not have at least
+   // min_period_frames per period at the reduced rate.
+   //
+   // process is much cheaper than the function operator. It downsamples
+   // whole chunks of frames, keeping the filter states in registers, and
+   // uses the block processing of the pitch_detector.
+   //
+   // reset clears the downsampler stages and the history as well. After a
+   // reset, the detector starts the same as a new one.
+   //
+   // Given a non-zero max_window, the decimating_pitch_detector does not
+   // allocate (see basic_pitch_detector). max_window is the window size at
+   // the reduced rate.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t max_window = 0>
+   class basic_decimating_pitch_detector
+   {
+   public:
+
+      using pitch_detector_type = basic_pitch_detector<max_window>;
+      using period_detector_type = typename pitch_detector_type::period_detector_type;
+
+      static constexpr std::size_t max_factor = 8;
+      static constexpr std::size_t chunk_size = 64;
+      static constexpr float min_period_frames = 8;
+      static constexpr float refine_tolerance = 0.03f;
+
+                              basic_decimating_pitch_detector(
+                                 frequency lowest_freq
+                               , frequency highest_freq
+                               , std::uint32_t sps
+                               , decibel hysteresis
+                               , std::size_t factor
+                              );
+
+      bool                    operator()(float s);
+      bool                    process(float const* in, std::size_t n);
+                              template <typename F>
+      bool                    process(float const* in, std::size_t n, F&& on_ready);
+      float                   get_frequency() const         { return _frequency; }
+      float                   periodicity() const           { return _pd.periodicity(); }
+      bool                    is_note_shift() const         { return _pd.is_note_shift(); }
+      void                    reset();
+
+      std::size_t             factor() const                { return _factor; }
+      pitch_detector_type const& get_pitch_detector() const { return _pd; }
+
+   private:
+
+      static std::size_t      adjust_factor(
+                                 frequency highest_freq
+                               , std::uint32_t sps
+                               , std::size_t factor);
+
+      float                   downsample();
+      void                    downsample(float const* in, std::size_t n, float* out);
+      void                    update(std::size_t skip);
+      float                   history(std::size_t i) const;
+      float                   crossing(std::size_t i) const;
+      float                   latest_crossing() const;
+      float                   nearest_crossing(float pos, float tolerance) const;
+      float                   refine(float period, std::size_t skip) const;
+
+      using history_type = std::conditional_t<
+         max_window == 0
+       , std::vector<float>
+       , std::array<float, (period_detector_type::max_window_size + chunk_size) * max_factor>
+      >;
+
+      std::size_t const       _factor;
+      std::uint32_t const     _sps;
+      std::uint32_t const     _decimated_sps;
+      float const             _hysteresis;
+      pitch_detector_type     _pd;
+      float                   _frequency = 0.0f;
+
+      // Downsampler stages
+      std::array<fast_downsample<float>, 2> _stages;
+      halfband_downsample     _last_stage;
+
+      // The latest input frames, the latest at _pos - 1 (modulo size). The
+      // span is the number of frames used for the refinement, skipping the
+      // latest _skip frames.
+      history_type            _history = {};
+      std::size_t             _history_size;
+      std::size_t const       _span;
+      std::size_t             _pos = 0;
+      mutable std::size_t     _skip = 0;
+   };
+
+   using decimating_pitch_detector = basic_decimating_pitch_detector<>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Implementation
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t max_window>
+   inline std::size_t basic_decimating_pitch_detector<max_window>::adjust_factor(
+      frequency highest_freq
+    , std::uint32_t sps
+    , std::size_t factor)
+   {
+      if (factor == 0 || factor > max_factor || (factor & (factor-1)))
+         throw std::runtime_error(
+            "Error: decimation factor must be 1, 2, 4 or 8."
+         );
+
+      auto const period = float(highest_freq.period()) * sps;
+      while (factor > 1 && period / factor < min_period_frames)
+         factor /= 2;
+      return factor;
+   }
+
+   template <std::size_t max_window>
+   inline basic_decimating_pitch_detector<max_window>::basic_decimating_pitch_detector(
+      frequency lowest_freq
+    , frequency highest_freq
+    , std::uint32_t sps
+    , decibel hysteresis
+    , std::size_t factor
+   )
+    : _factor(adjust_factor(highest_freq, sps, factor))
+    , _sps(sps)
+    , _decimated_sps(sps / _factor)
+    , _hysteresis(float(hysteresis))
+    , _pd{ lowest_freq, highest_freq, _decimated_sps, hysteresis }
+    , _history_size((_pd.edges().window_size() + chunk_size) * _factor)
+    , _span(_pd.edges().window_size() * _factor)
+   {
+      if constexpr (max_window == 0)
+         _history.resize(_history_size, 0.0f);
+      else
+         CYCFI_ASSERT(_history_size <= _history.size(), "Window too large.");
+   }
+
+   template <std::size_t max_window>
+   inline void basic_decimating_pitch_detector<max_window>::reset()
+   {
+      _pd.reset();
+      _frequency = 0.0f;
+      _stages = {};
+      _last_stage = {};
+      std::fill(_history.begin(), _history.end(), 0.0f);
+      _pos = 0;
+      _skip = 0;
+   }
+
+   // The frame i frames before the latest (not skipped)
+   template <std::size_t max_window>
+   inline float basic_decimating_pitch_detector<max_window>::history(std::size_t i) const
+   {
+      auto const pos = _pos + _history_size - 1 - _skip - i;
+      return _history[pos < _history_size? pos : pos - _history_size];
+   }
+
+   // The rising zero crossing between the frames i and i+1 frames before
+   // the latest, in frames before the latest, or -1 if there is none.
+   template <std::size_t max_window>
+   inline float basic_decimating_pitch_detector<max_window>::crossing(std::size_t i) const
+   {
+      auto curr = history(i);
+      auto prev = history(i+1);
+      if (prev < 0.0f && curr >= 0.0f)
+         return i + curr / (curr - prev);
+      return -1.0f;
+   }
+
+   // The latest rising zero crossing, preceded by a dip below the
+   // hysteresis, or -1 if there is none.
+   template <std::size_t max_window>
+   inline float basic_decimating_pitch_detector<max_window>::latest_crossing() const
+   {
+      auto latest = -1.0f;
+      for (std::size_t i = 0; i != _span; ++i)
+      {
+         if (latest < 0.0f)
+            latest = crossing(i);
+         else if (history(i) < -_hysteresis)
+            return latest;
+      }
+      return -1.0f;
+   }
+
+   // The rising zero crossing nearest to pos (in frames before the latest),
+   // within tolerance, or -1 if there is none.
+   template <std::size_t max_window>
+   inline float basic_decimating_pitch_detector<max_window>::nearest_crossing(
+      float pos, float tolerance) const
+   {
+      auto const end = _span;
+      auto const center = std::size_t(pos);
+      for (std::size_t d = 0; d <= tolerance + 1; ++d)
+      {
+         if (center + d < end)
+         {
+            if (auto x = crossing(center + d); x >= 0.0f)
+               return x;
+         }
+         if (d && d <= center && center - d < end)
+         {
+            if (auto x = crossing(center - d); x >= 0.0f)
+               return x;
+         }
+      }
+      return -1.0f;
+   }
+
+   template <std::size_t max_window>
+   inline float basic_decimating_pitch_detector<max_window>::refine(
+      float period, std::size_t skip) const
+   {
+      _skip = skip;
+      auto const latest = latest_crossing();
+      if (latest < 0.0f)
+         return period;
+
+      auto const tolerance = std::max<float>(_factor, period * refine_tolerance);
+      auto result = period;
+      for (std::size_t cycles = 1; ; ++cycles)
+      {
+         auto pos = nearest_crossing(latest + cycles * result, tolerance);
+         if (pos < 0.0f || std::abs(pos - (latest + cycles * result)) > tolerance)
+            break;
+         result = (pos - latest) / cycles;
+      }
+      return result;
+   }
+
+   // Update the frequency after the pitch detector is ready, skipping the
+   // latest skip frames in the history.
+   template <std::size_t max_window>
+   inline void basic_decimating_pitch_detector<max_window>::update(std::size_t skip)
+   {
+      if (auto f = _pd.get_frequency(); f > 0.0f)
+      {
+         // The period at the full rate
+         auto period = (float(_decimated_sps) / f) * _factor;
+         _frequency = _sps / refine(period, skip);
+      }
+      else
+      {
+         _frequency = 0.0f;
+      }
+   }
+
+   // Downsample the latest factor frames to one frame
+   template <std::size_t max_window>
+   inline float basic_decimating_pitch_detector<max_window>::downsample()
+   {
+      std::array<float, max_factor> frames;
+      downsample(&_history[_pos - _factor], _factor, frames.data());
+      return frames[0];
+   }
+
+   // Downsample n frames (a multiple of the factor) from in to out. out
+   // may be the same as in.
+   template <std::size_t max_window>
+   inline void basic_decimating_pitch_detector<max_window>::downsample(
+      float const* in, std::size_t n, float* out)
+   {
+      // The stages are copied to locals, keeping their state in registers
+      auto stages = _stages;
+      auto last_stage = _last_stage;
+      std::size_t i = 0;
+      for (auto f = _factor; f > 2; ++i, f /= 2)
+      {
+         for (std::size_t j = 0; j != n/2; ++j)
+            out[j] = stages[i](in[j*2], in[j*2 + 1]);
+         in = out;
+         n /= 2;
+      }
+      if (_factor > 1)
+      {
+         for (std::size_t j = 0; j != n/2; ++j)
+            out[j] = last_stage(in[j*2], in[j*2 + 1]);
+      }
+      else
+      {
+         std::copy(in, in + n, out);
+      }
+      _stages = stages;
+      _last_stage = last_stage;
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_decimating_pitch_detector<max_window>::operator()(float s)
+   {
+      _history[_pos++] = s;
+
+      // The history size is a multiple of the factor (a power of 2)
+      if (_pos & (_factor - 1))
+         return false;
+      auto decimated = downsample();
+      if (_pos == _history_size)
+         _pos = 0;
+      if (!_pd(decimated))
+         return false;
+      update(0);
+      return true;
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_decimating_pitch_detector<max_window>::process(
+      float const* in, std::size_t n)
+   {
+      return process(in, n, [](std::size_t) {});
+   }
+
+   // Process a block of n frames. This gives the same results as calling
+   // the function operator for each frame. on_ready(i) is called right
+   // after the frame at block offset i completed an analysis. Returns true
+   // if at least one analysis was completed.
+   template <std::size_t max_window>
+   template <typename F>
+   inline bool basic_decimating_pitch_detector<max_window>::process(
+      float const* in, std::size_t n, F&& on_ready)
+   {
+      bool ready = false;
+      std::array<float, chunk_size * max_factor> decimated;
+      std::size_t i = 0;
+      while (i != n)
+      {
+         // Frame by frame, up to the start of a group of factor frames
+         if ((_pos & (_factor - 1)) || n - i < _factor)
+         {
+            if ((*this)(in[i++]))
+            {
+               ready = true;
+               on_ready(i - 1);
+            }
+            continue;
+         }
+
+         // Whole groups of factor frames, up to chunk_size groups or the
+         // end of the history.
+         auto const m = std::min({
+            (n - i) / _factor
+          , chunk_size
+          , (_history_size - _pos) / _factor
+         });
+         auto const frames = m * _factor;
+         std::copy(in + i, in + i + frames, &_history[_pos]);
+         _pos += frames;
+         downsample(in + i, frames, decimated.data());
+
+         _pd.process(decimated.data(), m,
+            [&](std::size_t j)
+            {
+               // Skip the frames after the latest frame of group j
+               update((m - 1 - j) * _factor);
+               ready = true;
+               on_ready(i + (j + 1) * _factor - 1);
+            }
+         );
+         i += frames;
+         if (_pos == _history_size)
+            _pos = 0;
+      }
+      return ready;
+   }
+}
+
+#endif
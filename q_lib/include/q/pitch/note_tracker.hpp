@@ -0,0 +1,283 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_NOTE_TRACKER_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_NOTE_TRACKER_HPP_OCTOBER_17_2020
+
+#include <q/support/literals.hpp>
+#include <q/support/midi.hpp>
+#include <q/fx/envelope.hpp>
+#include <q/pitch/pd_preprocessor.hpp>
+#include <q/pitch/pitch_detector.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // The note_tracker turns an audio channel into MIDI note_on, note_off and
+   // pitch_bend messages (see midi.hpp), e.g. to drive a synthesizer from a
+   // guitar string. The signal goes through the pd_preprocessor, and its
+   // gate gives the note on and off state. The frequency is given by the
+   // pitch_detector:
+   //
+   //    1. After the gate opens, the first frequency that agrees with the
+   //       previous one (within 1/2 semitone) gives the note_on. The first
+   //       frequencies in the attack of a note are not reliable. The key
+   //       is the nearest MIDI note, and the velocity is the peak level of
+   //       the input, mapped from -velocity_range (1) to 0dB (127).
+   //       With fast_onset (see period_detector), the provisional
+   //       frequencies at the onset can give the note_on, well before the
+   //       first full analysis (see q_bench_note_tracker).
+   //
+   //    2. An abrupt change of frequency, more than 1/2 semitone plus
+   //       note_hysteresis away from the key, gives a note_off and a new
+   //       note_on (e.g. hammer-ons, pull-offs and slides). The change is
+   //       abrupt if it is a note shift (see pitch_detector::is_note_shift)
+   //       or a jump of more than 1/2 semitone from the previous frequency.
+   //       The latter catches the shifts that the median filter of the
+   //       pitch_detector let through one analysis late, which are not
+   //       flagged as note shifts.
+   //
+   //    3. Otherwise (e.g. string bends), the deviation from the key gives
+   //       a pitch_bend, given the bend range (in semitones) of the
+   //       receiver. With cycle_bends, the pitch bends are updated every
+   //       cycle of the signal (see pitch_detector cycle tracking), for
+   //       smooth vibrato and bends.
+   //
+   //    4. For the first settle_frames analyses after a note shift (see
+   //       pitch_detector::frames_after_shift), the frequency is not
+   //       settled yet: the pitch_detector does not correct harmonics
+   //       until then. No pitch bends are sent (3) in that time, so the
+   //       bend does not follow a wrong octave. Jumps still retrigger the
+   //       note (2) right away, to keep the latency low.
+   //
+   //    5. The gate closing gives the note_off.
+   //
+   // process(in, n, proc) processes a block of n samples, calling proc(msg,
+   // time) for each message, where time is the offset of the sample in the
+   // block (see midi::processor). The pitch bend, if any, comes before the
+   // note_on, so that the note starts at the right pitch.
+   //
+   // Given a non-zero max_window, the note_tracker does not allocate (see
+   // basic_pitch_detector). Otherwise, the storage is allocated at
+   // construction time. In any case, process does not allocate.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t max_window = 0>
+   class basic_note_tracker
+   {
+   public:
+
+      using pitch_detector_type = basic_pitch_detector<max_window>;
+
+      static constexpr std::uint16_t bend_center = 8192;
+      static constexpr std::uint16_t bend_max = 16383;
+      static constexpr std::size_t settle_frames = 2;
+
+      struct config : pd_preprocessor::config
+      {
+         // Pitch detection
+         decibel              hysteresis              = -45_dB;
+         bool                 fast_onset              = false;
+
+         // MIDI
+         std::uint8_t         channel                 = 0;
+         float                bend_range              = 2;     // semitones
+         float                note_hysteresis         = 0.1;   // semitones
+         decibel              velocity_range          = 48_dB;
+         bool                 cycle_bends             = true;
+      };
+
+                              basic_note_tracker(
+                                 frequency lowest_freq
+                               , frequency highest_freq
+                               , std::uint32_t sps
+                              );
+
+                              basic_note_tracker(
+                                 config const& conf
+                               , frequency lowest_freq
+                               , frequency highest_freq
+                               , std::uint32_t sps
+                              );
+
+                              template <typename Processor>
+      void                    process(float const* in, std::size_t n, Processor&& proc);
+
+      int                     note() const            { return _note; }
+      bool                    gate() const            { return _gate; }
+      std::uint16_t           bend() const            { return _bend; }
+      pitch_detector_type const& get_pitch_detector() const { return _pd; }
+
+   private:
+
+      bool                    is_settled() const;
+                              template <typename Processor>
+      void                    track(float f, std::size_t time, Processor& proc);
+                              template <typename Processor>
+      void                    note_on(float key, std::size_t time, Processor& proc);
+                              template <typename Processor>
+      void                    note_off(std::size_t time, Processor& proc);
+                              template <typename Processor>
+      void                    pitch_bend(float key, std::size_t time, Processor& proc);
+
+      pd_preprocessor         _pre;
+      pitch_detector_type     _pd;
+      peak_envelope_follower  _env;
+      std::uint8_t const      _channel;
+      float const             _bend_range;
+      float const             _note_hysteresis;
+      float const             _velocity_range;
+      bool const              _cycle_bends;
+
+      int                     _note = -1;
+      float                   _key = 0.0f;
+      std::uint16_t           _bend = bend_center;
+      bool                    _gate = false;
+   };
+
+   using note_tracker = basic_note_tracker<>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Implementation
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t max_window>
+   inline basic_note_tracker<max_window>::basic_note_tracker(
+      frequency lowest_freq
+    , frequency highest_freq
+    , std::uint32_t sps
+   )
+    : basic_note_tracker(config{}, lowest_freq, highest_freq, sps)
+   {}
+
+   template <std::size_t max_window>
+   inline basic_note_tracker<max_window>::basic_note_tracker(
+      config const& conf
+    , frequency lowest_freq
+    , frequency highest_freq
+    , std::uint32_t sps
+   )
+    : _pre(conf, lowest_freq, highest_freq, sps)
+    , _pd(lowest_freq, highest_freq, sps, conf.hysteresis)
+    , _env(conf.comp_release, sps)
+    , _channel(conf.channel)
+    , _bend_range(conf.bend_range)
+    , _note_hysteresis(conf.note_hysteresis)
+    , _velocity_range(conf.velocity_range.val)
+    , _cycle_bends(conf.cycle_bends)
+   {
+      _pd.fast_onset(conf.fast_onset);
+      _pd.cycle_tracking(conf.cycle_bends);
+   }
+
+   template <std::size_t max_window>
+   template <typename Processor>
+   inline void basic_note_tracker<max_window>::process(
+      float const* in, std::size_t n, Processor&& proc)
+   {
+      for (std::size_t i = 0; i != n; ++i)
+      {
+         _env(std::abs(in[i]));
+         auto s = _pre(in[i]);
+         bool gate = _pre.gate();
+
+         // The gate closed: end the note and start afresh
+         if (_gate && !gate)
+         {
+            note_off(i, proc);
+            _pd.reset();
+            _key = 0.0f;
+         }
+         _gate = gate;
+
+         if (_pd(s) && gate)
+         {
+            if (auto f = _pd.get_frequency(); f > 0.0f)
+               track(f, i, proc);
+         }
+         else if (_cycle_bends && gate && _note != -1 && is_settled() && _pd.is_new_cycle())
+         {
+            pitch_bend(12 * std::log2(_pd.cycle_frequency() / 440.0f) + 69, i, proc);
+         }
+      }
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_note_tracker<max_window>::is_settled() const
+   {
+      return _pd.frames_after_shift() > settle_frames;
+   }
+
+   template <std::size_t max_window>
+   template <typename Processor>
+   inline void basic_note_tracker<max_window>::track(
+      float f, std::size_t time, Processor& proc)
+   {
+      auto key = 12 * std::log2(f / 440.0f) + 69;
+      bool jump = std::abs(key - _key) > 0.5f;
+      _key = key;
+
+      if (_note == -1)
+      {
+         if (!jump)
+            note_on(key, time, proc);
+      }
+      else if ((jump || _pd.is_note_shift()) &&
+         std::abs(key - _note) > 0.5f + _note_hysteresis)
+      {
+         note_off(time, proc);
+         note_on(key, time, proc);
+      }
+      else if (is_settled())
+      {
+         pitch_bend(key, time, proc);
+      }
+   }
+
+   template <std::size_t max_window>
+   template <typename Processor>
+   inline void basic_note_tracker<max_window>::note_on(
+      float key, std::size_t time, Processor& proc)
+   {
+      auto note = std::lround(key);
+      if (note < 0 || note > 127)
+         return;
+      _note = note;
+      pitch_bend(key, time, proc);
+
+      auto db = decibel{ _env() }.val;
+      auto velocity = std::lround(127 * (1.0f + db / _velocity_range));
+      proc(midi::note_on{ _channel, std::uint8_t(_note)
+       , std::uint8_t(std::clamp<long>(velocity, 1, 127)) }, time);
+   }
+
+   template <std::size_t max_window>
+   template <typename Processor>
+   inline void basic_note_tracker<max_window>::note_off(
+      std::size_t time, Processor& proc)
+   {
+      if (_note != -1)
+      {
+         proc(midi::note_off{ _channel, std::uint8_t(_note), 0 }, time);
+         _note = -1;
+      }
+   }
+
+   template <std::size_t max_window>
+   template <typename Processor>
+   inline void basic_note_tracker<max_window>::pitch_bend(
+      float key, std::size_t time, Processor& proc)
+   {
+      auto bend = std::lround(bend_center + (key - _note) * bend_center / _bend_range);
+      auto value = std::uint16_t(std::clamp<long>(bend, 0, bend_max));
+      if (value != _bend)
+      {
+         _bend = value;
+         proc(midi::pitch_bend{ _channel, value }, time);
+      }
+   }
+}
+
+#endif
@@ -10,6 +10,7 @@
 #include <q/fx/dynamic.hpp>
 #include <q/fx/waveshaper.hpp>
 #include <q/fx/moving_average.hpp>
+#include <q/fx/feature_detection.hpp>
 
 namespace cycfi::q
 {
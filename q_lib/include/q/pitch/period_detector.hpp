@@ -12,18 +12,73 @@
 #include <q/fx/feature_detection.hpp>
 #include <q/fx/envelope.hpp>
 #include <cmath>
+#include <climits>
+#include <algorithm>
+#include <array>
 #include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 namespace cycfi::q
 {
    ////////////////////////////////////////////////////////////////////////////
-   class period_detector
+   // The period_detector analyzes the window every hop frames (see
+   // zero_crossing). The default hop is half the window. With smaller hops,
+   // consecutive windows overlap more, and the bitstream is not rebuilt
+   // from scratch: the previous one is shifted by the hop, and only the
+   // edges that changed are updated.
+   //
+   // Given a non-zero max_window, the period_detector does not allocate. The
+   // zero crossing, bitstream and correlogram are stored in std::arrays
+   // sized for windows of up to max_window frames (the window is twice the
+   // period of the lowest frequency). Otherwise, the storage is allocated
+   // at construction time. The period_detector type alias is the latter.
+   //
+   // For wide frequency ranges, the autocorrelation has to consider many
+   // lags, up to the mid point of the window: the periods between pairs of
+   // strong edges. Given a search decimation factor of 2, 4 or 8 (see
+   // search_decimation), the lags are searched coarse to fine. The
+   // bitstream is OR-folded by the factor into a shorter bitstream, where
+   // the lags are first correlated cheaply. Only the lags with a coarse
+   // periodicity within coarse_periodicity_margin of the best are then
+   // correlated (and refined) at full resolution. This trades some accuracy
+   // for speed. The default factor (1) correlates all the lags at full
+   // resolution. The factor is reduced for short windows, where the full
+   // resolution search is cheap anyway.
+   //
+   // In lazy analysis mode (see lazy_analysis), a window that becomes ready
+   // is not analyzed right away. The pulses of the window are copied (see
+   // zero_crossing_snapshot) and the window is marked pending. The function
+   // operator and process still report the window as ready. The analysis
+   // (bitstream and autocorrelation) runs on the next call to analyze. If
+   // several windows became ready in between, only the latest one is
+   // analyzed. Until then, fundamental(), harmonic(), bits() etc. give the
+   // results of the previous analysis. After an analysis, predict_period()
+   // gives the period predicted from the edges of the analyzed window, not
+   // from the edges that came after it.
+   //
+   // After a reset, the first window is ready only after two periods of the
+   // lowest frequency, even if the note is much higher. In fast onset mode
+   // (see fast_onset), a provisional period is estimated on each falling
+   // edge until then, from the edges captured so far: the period predicted
+   // from similar edges (see predict_period), with its periodicity given by
+   // correlating the partial bitstream, over the frames available. The
+   // function operator and process report the provisional estimates as
+   // ready, and is_provisional() is true. The first full analysis takes over
+   // once the window is ready.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t max_window = 0>
+   class basic_period_detector
    {
    public:
 
       static constexpr float pulse_threshold = 0.6;
       static constexpr float harmonic_periodicity_factor = 16;
       static constexpr float periodicity_diff_factor = 0.008;
+      static constexpr float coarse_periodicity_margin = 0.1;
+      static constexpr std::size_t max_search_decimation = 8;
+      static constexpr std::size_t min_coarse_size = 4;
+      static constexpr float onset_periodicity_margin = 0.05;
 
       struct info
       {
@@ -31,89 +86,465 @@ namespace cycfi::q
          float                _periodicity = 0.0f;
       };
 
-                              period_detector(
+      // The autocorrelation of each lag is computed at most once per
+      // window (see acf). _hits counts the lags found in the cache and
+      // _misses counts the lags actually correlated. With the cache
+      // disabled (see acf_cache), every request is correlated again and
+      // counted as a miss.
+      struct cache_stats
+      {
+         std::size_t          _hits = 0;
+         std::size_t          _misses = 0;
+      };
+
+      static constexpr auto max_window_size =
+         detail::adjust_window_size(max_window) * bitset<>::value_size;
+
+      using zero_crossing_type = basic_zero_crossing<max_window>;
+      using zero_crossing_snapshot_type = basic_zero_crossing_snapshot<max_window>;
+      using bitset_type = std::conditional_t<
+         max_window == 0, bitset<>, static_bitset<max_window_size>>;
+      using correlogram_type = std::conditional_t<
+         max_window == 0
+       , std::vector<std::size_t>
+       , std::array<std::size_t, max_window_size/2 + 1>
+      >;
+
+                              basic_period_detector(
                                  frequency lowest_freq
                                , frequency highest_freq
                                , std::uint32_t sps
                                , decibel hysteresis
+                               , std::size_t hop = 0
                               );
 
-                              period_detector(period_detector const& rhs) = default;
-                              period_detector(period_detector&& rhs) = default;
+                              basic_period_detector(basic_period_detector const& rhs) = default;
+                              basic_period_detector(basic_period_detector&& rhs) = default;
 
       bool                    operator()(float s);
       bool                    operator()() const;
 
+      bool                    process(float const* in, std::size_t n);
+                              template <typename F>
+      bool                    process(float const* in, std::size_t n, F&& on_ready);
+                              template <typename F, typename G>
+      bool                    process(float const* in, std::size_t n, F&& on_ready, G&& on_edge);
+      void                    skip(float const* in, std::size_t n);
+      void                    reset();
+
       bool                    is_ready() const        { return _zc.is_ready(); }
       std::size_t const       minimum_period() const  { return _min_period; }
-      bitset<> const&         bits() const            { return _bits; }
-      zero_crossing const&    edges() const           { return _zc; }
+      bitset_type const&      bits() const            { return _bits; }
+      zero_crossing_type const& edges() const         { return _zc; }
       float                   predict_period() const;
+      std::size_t             edge_mark() const       { return _edge_mark; }
 
       info const&             fundamental() const     { return _fundamental; }
       float                   harmonic(std::size_t index) const;
+      void                    harmonics(float* out, std::size_t n) const;
+
+      correlogram_type const& correlogram() const;
+
+      cache_stats const&      acf_cache_stats() const { return _acf_stats; }
+      void                    reset_acf_cache_stats() { _acf_stats = {}; }
+      void                    acf_cache(bool enable)  { _acf_cache = enable; }
+      bool                    acf_cache() const       { return _acf_cache; }
+
+      void                    search_decimation(std::size_t factor);
+      std::size_t             search_decimation() const { return _decimation; }
+
+      void                    lazy_analysis(bool enable);
+      bool                    lazy_analysis() const   { return _lazy; }
+      bool                    is_pending() const      { return _pending; }
+      bool                    analyze();
+
+      void                    fast_onset(bool enable) { _fast_onset = enable; }
+      bool                    fast_onset() const      { return _fast_onset; }
+      bool                    is_provisional() const  { return _provisional; }
 
    private:
 
-      void                    set_bitstream();
-      void                    autocorrelate();
-      int                     autocorrelate(bitstream_acf<> const& ac, std::size_t& period, bool first) const;
+      bool                    update(bool prev, bool analyze_window = true);
+                              template <typename Edges>
+      void                    set_bitstream(Edges const& edges);
+                              template <typename Edges>
+      bool                    shift_bitstream(Edges const& edges, float threshold);
+                              template <typename Edges>
+      void                    autocorrelate(Edges const& edges);
+                              template <typename Edges>
+      void                    coarse_search(Edges const& edges);
+      bool                    onset_estimate();
+      bool                    is_coarse_candidate(std::size_t period) const;
+      int                     autocorrelate(std::size_t mid, std::size_t& period, bool first) const;
+      std::size_t             acf(std::size_t pos) const;
 
-      zero_crossing           _zc;
+      using acf_valid_type = std::conditional_t<
+         max_window == 0, bitset<>, static_bitset<max_window_size/2 + 1>>;
+      using edge_index_type = std::conditional_t<
+         max_window == 0
+       , std::vector<int>
+       , std::array<int, detail::zero_crossing_capacity(max_window)>
+      >;
+
+      zero_crossing_type      _zc;
       info                    _fundamental;
       std::size_t const       _min_period;
       int                     _range;
-      bitset<>                _bits;
+      bitset_type             _bits;
       float const             _weight;
       std::size_t const       _mid_point;
       float const             _period_diff_threshold;
+      float                   _threshold = 0.0f;
+      bool                    _shiftable = false;
+
+      // The edges with peaks above the threshold (see set_bitstream)
+      edge_index_type         _strong_edges = {};
+      std::size_t             _num_strong_edges = 0;
+
+      mutable correlogram_type _acf = {};
+      mutable acf_valid_type  _acf_valid;
+      mutable cache_stats     _acf_stats;
+      bool                    _acf_cache = true;
       mutable float           _predicted_period = -1.0f;
       std::size_t             _edge_mark = 0;
       mutable std::size_t     _predict_edge = 0;
+
+      // Coarse to fine search (see search_decimation)
+      std::size_t             _decimation = 1;
+      bitset_type             _coarse_bits;
+      correlogram_type        _coarse_acf = {};
+      acf_valid_type          _coarse_valid;
+      std::size_t             _coarse_threshold = 0;
+
+      // Lazy analysis (see lazy_analysis). _pending_period is the period
+      // predicted (see predict_period) when the pending window was ready,
+      // and _pending_edge the edge mark then. _window_period and
+      // _window_edge are those of the window analyzed, valid if
+      // _window_analyzed.
+      bool                    _lazy = false;
+      bool                    _pending = false;
+      zero_crossing_snapshot_type _window;
+      float                   _pending_period = -1.0f;
+      std::size_t             _pending_edge = 0;
+      float                   _window_period = -1.0f;
+      std::size_t             _window_edge = 0;
+      bool                    _window_analyzed = false;
+
+      // Fast onset (see fast_onset). _onset is true from a reset until the
+      // first window is ready.
+      bool                    _fast_onset = false;
+      bool                    _onset = true;
+      bool                    _provisional = false;
    };
 
+   using period_detector = basic_period_detector<>;
+
    ////////////////////////////////////////////////////////////////////////////
    // Implementation
    ////////////////////////////////////////////////////////////////////////////
-   inline period_detector::period_detector(
+   namespace detail
+   {
+      // Predict the period from the zero crossing edges alone: the period
+      // between the latest strong pulse and the most recent similar pulse
+      // before it. Returns -1 if there is no such pair.
+      template <typename ZeroCrossing>
+      inline float predict_period(ZeroCrossing const& zc)
+      {
+         if (zc.num_edges() > 1)
+         {
+            auto threshold = zc.peak_pulse() * period_detector::pulse_threshold;
+            for (int i = zc.num_edges()-1; i > 0; --i)
+            {
+               auto const& edge2 = zc[i];
+               if (edge2._peak >= threshold)
+               {
+                  if (auto j = zc.find_similar(i); j >= 0)
+                     return zc[j].fractional_period(edge2);
+               }
+            }
+         }
+         return -1.0f;
+      }
+   }
+
+   template <std::size_t max_window>
+   inline basic_period_detector<max_window>::basic_period_detector(
       frequency lowest_freq
     , frequency highest_freq
     , std::uint32_t sps
     , decibel hysteresis
+    , std::size_t hop
    )
-    : _zc(hysteresis, float(lowest_freq.period() * 2) * sps)
+    : _zc(hysteresis, float(lowest_freq.period() * 2) * sps, hop)
     , _min_period(float(highest_freq.period()) * sps)
     , _range(float(highest_freq) / float(lowest_freq))
     , _bits(_zc.window_size())
     , _weight(2.0 / _zc.window_size())
     , _mid_point(_zc.window_size() / 2)
     , _period_diff_threshold(_mid_point * periodicity_diff_factor)
+    , _acf_valid(_mid_point + 1)
+    , _coarse_bits(0)
+    , _coarse_valid(0)
+    , _window(0)
    {
       if (highest_freq <= lowest_freq)
          throw std::runtime_error(
             "Error: highest_freq <= lowest_freq."
          );
+      if constexpr (max_window == 0)
+      {
+         _acf.resize(_mid_point + 1, 0);
+         _strong_edges.resize(_zc.capacity());
+      }
+   }
+
+   template <std::size_t max_window>
+   inline void basic_period_detector<max_window>::search_decimation(std::size_t factor)
+   {
+      if (factor == 0 || factor > max_search_decimation || (factor & (factor-1)))
+         throw std::runtime_error(
+            "Error: search decimation must be 1, 2, 4 or 8."
+         );
+
+      // Short windows are not decimated down to less than
+      // min_coarse_size integers.
+      constexpr auto min_bits = min_coarse_size * bitset<>::value_size;
+      while (factor > 1 && _bits.size() / factor < min_bits)
+         factor /= 2;
+
+      _decimation = factor;
+      _coarse_bits = bitset_type(_bits.size() / factor);
+      auto const size = _coarse_bits.size() / 2 + 1;
+      _coarse_valid = acf_valid_type(size);
+      if constexpr (max_window == 0)
+         _coarse_acf.resize(size, 0);
+   }
+
+   template <std::size_t max_window>
+   inline void basic_period_detector<max_window>::lazy_analysis(bool enable)
+   {
+      _lazy = enable;
+      _pending = false;
+      if constexpr (max_window == 0)
+      {
+         if (enable)
+            _window = zero_crossing_snapshot_type(_zc.capacity());
+      }
    }
 
-   inline void period_detector::set_bitstream()
+   template <std::size_t max_window>
+   template <typename Edges>
+   inline void basic_period_detector<max_window>::set_bitstream(Edges const& edges)
    {
-      auto threshold = _zc.peak_pulse() * pulse_threshold;
+      auto threshold = edges.peak_pulse() * pulse_threshold;
+      _num_strong_edges = detail::select_at_least(
+         edges.peaks(), edges.num_edges(), threshold, _strong_edges.data());
 
-      _bits.clear();
-      for (auto i = 0; i != _zc.num_edges(); ++i)
+      // Reuse the previous bitstream, if we can
+      if (!edges.is_continuous() || !_shiftable || !shift_bitstream(edges, threshold))
       {
-         auto const& info = _zc[i];
-         if (info._peak >= threshold)
+         auto const* leading_edges = edges.leading_edges();
+         auto const* trailing_edges = edges.trailing_edges();
+         _bits.clear();
+         _shiftable = true;
+         for (std::size_t k = 0; k != _num_strong_edges; ++k)
          {
-            auto pos = std::max<int>(info._leading_edge, 0);
-            auto n = info._trailing_edge - pos;
+            auto i = _strong_edges[k];
+            auto pos = std::max<int>(leading_edges[i], 0);
+            auto n = trailing_edges[i] - pos;
             _bits.set(pos, n, 1);
+
+            // A pulse that ends before the start of the window (n < 0)
+            // sets all the bits up to the end. That can't be shifted.
+            if (n < 0)
+               _shiftable = false;
+         }
+      }
+      _threshold = threshold;
+
+      // Invalidate the correlogram
+      _acf_valid.clear();
+   }
+
+   template <std::size_t max_window>
+   template <typename Edges>
+   inline bool basic_period_detector<max_window>::shift_bitstream(
+      Edges const& edges, float threshold)
+   {
+      // The window, except for the last hop frames, is the previous window
+      // shifted by the hop. Shift the previous bitstream and update only
+      // the edges that changed: the new edges, the edges that extend past
+      // the previous window, and the edges that crossed the threshold.
+      // Edges do not overlap, so each one can be set or cleared
+      // independently.
+      auto const hop = edges.hop_size();
+      auto const end = int(edges.window_size() - hop);
+      _bits.shift(hop);
+      auto const* peaks = edges.peaks();
+      auto const* leading_edges = edges.leading_edges();
+      auto const* trailing_edges = edges.trailing_edges();
+      for (std::size_t i = 0; i != edges.num_edges(); ++i)
+      {
+         auto pos = std::max<int>(leading_edges[i], 0);
+         auto n = trailing_edges[i] - pos;
+         bool const set = peaks[i] >= threshold;
+         if (n < 0)
+         {
+            if (set)
+               return false;  // Not shiftable (see set_bitstream)
+            continue;
+         }
+
+         bool const was_set =
+            leading_edges[i] < end && peaks[i] >= _threshold;
+         if (set? (!was_set || trailing_edges[i] > end) : was_set)
+            _bits.set(pos, n, set);
+      }
+      return true;
+   }
+
+   template <std::size_t max_window>
+   inline std::size_t basic_period_detector<max_window>::acf(std::size_t pos) const
+   {
+      // Correlate only once per window. The results are saved in the
+      // correlogram for subsequent requests.
+      if (!_acf_cache || !_acf_valid.get(pos))
+      {
+         bitstream_acf<> ac{ _bits };
+         _acf[pos] = ac(pos);
+         _acf_valid.set(pos, 1);
+         ++_acf_stats._misses;
+      }
+      else
+      {
+         ++_acf_stats._hits;
+      }
+      return _acf[pos];
+   }
+
+   template <std::size_t max_window>
+   inline typename basic_period_detector<max_window>::correlogram_type const&
+   basic_period_detector<max_window>::correlogram() const
+   {
+      // Fill the whole correlogram in one sweep.
+      bitstream_acf<> ac{ _bits };
+      ac(0, _mid_point + 1, _acf.data());
+      _acf_valid.set(0, _mid_point + 1, 1);
+      return _acf;
+   }
+
+   namespace detail
+   {
+      // Pack the lowest n bits of each group of size bits of x. Each step
+      // doubles the number of packed bits and the size of the groups.
+      template <std::size_t size, std::size_t n, typename T>
+      constexpr T pack_bits(T x)
+      {
+         constexpr auto value_size = CHAR_BIT * sizeof(T);
+         if constexpr (size == value_size)
+         {
+            return x;
+         }
+         else
+         {
+            constexpr auto low = (T(1) << (n * 2)) - 1;
+            constexpr auto mask = (size * 2 == value_size)?
+               low : low * (~T(0) / ((T(1) << (size * 2)) - 1));
+            return pack_bits<size * 2, n * 2>((x | (x >> (size - n))) & mask);
+         }
+      }
+
+      // OR each group of factor bits of x into one bit. The bits are packed
+      // into the lower (value_size / factor) bits of the result.
+      template <std::size_t factor, typename T>
+      constexpr T fold_bits(T x)
+      {
+         for (std::size_t f = 1; f < factor; f *= 2)
+            x |= x >> f;
+         return pack_bits<factor, 1>(x & (~T(0) / ((T(1) << factor) - 1)));
+      }
+
+      // OR-fold the n integers of the bitstream in by factor, into the
+      // ceil(n / factor) integers of out: bit i of out is set if any of
+      // the bits [i * factor, (i+1) * factor) of in is set.
+      template <std::size_t factor, typename T>
+      inline void fold_bits(T const* in, std::size_t n, T* out)
+      {
+         constexpr auto value_size = CHAR_BIT * sizeof(T);
+         constexpr auto step = value_size / factor;
+         for (std::size_t i = 0; i != n;)
+         {
+            T x = 0;
+            for (std::size_t shift = 0; shift != value_size && i != n; shift += step)
+               x |= fold_bits<factor>(in[i++]) << shift;
+            *out++ = x;
+         }
+      }
+
+      template <typename T>
+      inline void fold_bits(T const* in, std::size_t n, T* out, std::size_t factor)
+      {
+         switch (factor)
+         {
+            case 2: fold_bits<2>(in, n, out); break;
+            case 4: fold_bits<4>(in, n, out); break;
+            case 8: fold_bits<8>(in, n, out); break;
+         }
+      }
+   }
+
+   template <std::size_t max_window>
+   template <typename Edges>
+   inline void basic_period_detector<max_window>::coarse_search(Edges const& edges)
+   {
+      auto const factor = _decimation;
+      detail::fold_bits(
+         _bits.data(), _bits.size() / bitset<>::value_size
+       , _coarse_bits.data(), factor);
+
+      // Correlate the coarse lags of the edge pairs (see autocorrelate)
+      bitstream_acf<> ac{ _coarse_bits };
+      auto const* strong = _strong_edges.data();
+      auto const* leading_edges = edges.leading_edges();
+      _coarse_valid.clear();
+      std::size_t best = _coarse_bits.size();
+      for (std::size_t k1 = 0; k1 + 1 < _num_strong_edges; ++k1)
+      {
+         auto i = strong[k1];
+         for (auto k2 = k1+1; k2 != _num_strong_edges; ++k2)
+         {
+            std::size_t period = leading_edges[strong[k2]] - leading_edges[i];
+            if (period > _mid_point)
+               break;
+            if (period >= _min_period)
+            {
+               auto pos = (period + factor/2) / factor;
+               if (!_coarse_valid.get(pos))
+               {
+                  _coarse_acf[pos] = ac(pos);
+                  _coarse_valid.set(pos, 1);
+                  best = std::min(best, _coarse_acf[pos]);
+               }
+            }
          }
       }
+
+      // The candidates are the coarse lags with periodicity within
+      // coarse_periodicity_margin of the best.
+      _coarse_threshold = best + std::size_t(
+         coarse_periodicity_margin * _coarse_bits.size() / 2);
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_period_detector<max_window>::is_coarse_candidate(
+      std::size_t period) const
+   {
+      return _coarse_acf[(period + _decimation/2) / _decimation] <= _coarse_threshold;
    }
 
    namespace detail
    {
+      template <typename ZeroCrossing>
       struct sub_collector
       {
          // Intermediate data structure for collecting autocorrelation results
@@ -126,7 +557,7 @@ namespace cycfi::q
             std::size_t       _harmonic;
          };
 
-         sub_collector(zero_crossing const& zc, float period_diff_threshold, int range_)
+         sub_collector(ZeroCrossing const& zc, float period_diff_threshold, int range_)
           : _zc(zc)
           , _harmonic_threshold(
                period_detector::harmonic_periodicity_factor*2 / zc.window_size())
@@ -211,7 +642,8 @@ namespace cycfi::q
                save(incoming);
          };
 
-         void get(info const& info, period_detector::info& result)
+         template <typename Result>
+         void get(info const& info, Result& result)
          {
             if (info._period != -1.0f)
             {
@@ -223,28 +655,28 @@ namespace cycfi::q
             }
             else
             {
-               result = period_detector::info{};
+               result = Result{};
             }
          }
 
          float                   _first_period;
          info                    _fundamental;
-         zero_crossing const&    _zc;
+         ZeroCrossing const&     _zc;
          float const             _harmonic_threshold;
          float const             _period_diff_threshold;
          int const               _range;
       };
    }
 
-   inline int period_detector::autocorrelate(bitstream_acf<> const& ac, std::size_t& period, bool first) const
+   template <std::size_t max_window>
+   inline int basic_period_detector<max_window>::autocorrelate(std::size_t mid, std::size_t& period, bool first) const
    {
-      auto count = ac(period);
-      auto mid = ac._mid_array * bitset<>::value_size;
+      auto count = acf(period);
       auto start = period;
 
       if (first && count == 0)   // make sure this is not a false correlation
       {
-         if (ac(period/2) == 0)  // oops false correlation!
+         if (acf(period/2) == 0) // oops false correlation!
             return -1;           // flag the return as a false correlation
       }
       else if (period < 32) // Search minimum if the resolution is low
@@ -252,7 +684,7 @@ namespace cycfi::q
          // Search upwards for the minimum autocorrelation count
          for (auto p = start + 1; p < mid; ++p)
          {
-            auto c = ac(p);
+            auto c = acf(p);
             if (c > count)
                break;
             count = c;
@@ -261,7 +693,7 @@ namespace cycfi::q
          // Search downwards for the minimum autocorrelation count
          for (auto p = start - 1; p > _min_period; --p)
          {
-            auto c = ac(p);
+            auto c = acf(p);
             if (c > count)
                break;
             count = c;
@@ -271,41 +703,43 @@ namespace cycfi::q
       return count;
    }
 
-   inline void period_detector::autocorrelate()
+   template <std::size_t max_window>
+   template <typename Edges>
+   inline void basic_period_detector<max_window>::autocorrelate(Edges const& edges)
    {
-      auto threshold = _zc.peak_pulse() * pulse_threshold;
-
-      CYCFI_ASSERT(_zc.num_edges() > 1, "Not enough edges.");
+      CYCFI_ASSERT(edges.num_edges() > 1, "Not enough edges.");
 
       bitstream_acf<> ac{ _bits };
-      detail::sub_collector collect{_zc, _period_diff_threshold, _range };
+      auto const mid = ac._mid_array * bitset<>::value_size;
+      detail::sub_collector collect{ edges, _period_diff_threshold, _range };
+
+      bool const coarse = _decimation > 1;
+      if (coarse)
+         coarse_search(edges);
 
+      // Only the strong edges (see set_bitstream) are considered
+      auto const* strong = _strong_edges.data();
+      auto const* leading_edges = edges.leading_edges();
       [&]()
       {
-         for (auto i = 0; i != _zc.num_edges()-1; ++i)
+         for (std::size_t k1 = 0; k1 + 1 < _num_strong_edges; ++k1)
          {
-            auto const& first = _zc[i];
-            if (first._peak >= threshold)
+            auto i = strong[k1];
+            for (auto k2 = k1+1; k2 != _num_strong_edges; ++k2)
             {
-               for (auto j = i+1; j != _zc.num_edges(); ++j)
+               auto j = strong[k2];
+               std::size_t period = leading_edges[j] - leading_edges[i];
+               if (period > _mid_point)
+                  break;
+               if (period >= _min_period && (!coarse || is_coarse_candidate(period)))
                {
-                  auto const& next = _zc[j];
-                  if (next._peak >= threshold)
-                  {
-                     auto period = first.period(next);
-                     if (period > _mid_point)
-                        break;
-                     if (period >= _min_period)
-                     {
-                        auto count = autocorrelate(ac, period, collect.empty());
-                        if (count == -1)
-                           return; // Return early if we have a false correlation
-                        float periodicity = 1.0f - (count * _weight);
-                        collect({ i, j, int(period), periodicity });
-                        if (count == 0)
-                           return; // Return early if we have perfect correlation
-                     }
-                  }
+                  auto count = autocorrelate(mid, period, collect.empty());
+                  if (count == -1)
+                     return; // Return early if we have a false correlation
+                  float periodicity = 1.0f - (count * _weight);
+                  collect({ i, j, int(period), periodicity });
+                  if (count == 0)
+                     return; // Return early if we have perfect correlation
                }
             }
          }
@@ -315,12 +749,93 @@ namespace cycfi::q
       collect.get(collect._fundamental, _fundamental);
    }
 
-   inline bool period_detector::operator()(float s)
+   template <std::size_t max_window>
+   inline bool basic_period_detector<max_window>::operator()(float s)
    {
       // Zero crossing
       bool prev = _zc();
-      bool zc = _zc(s);
+      _zc(s);
+      return update(prev);
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_period_detector<max_window>::process(float const* in, std::size_t n)
+   {
+      return process(in, n, [](std::size_t) {});
+   }
+
+   // Process a block of n samples. This gives the same results as calling
+   // the function operator for each sample. on_ready(i) is called right
+   // after the sample at block offset i completed an analysis. Returns true
+   // if at least one analysis was completed.
+   template <std::size_t max_window>
+   template <typename F>
+   inline bool basic_period_detector<max_window>::process(
+      float const* in, std::size_t n, F&& on_ready)
+   {
+      return process(in, n, on_ready, [](std::size_t) {});
+   }
 
+   // Same as above, but also calls on_edge(i) right after the sample at
+   // block offset i completed a pulse (falling edge, see edge_mark). The
+   // latest edge in edges() is then the completed pulse. If the same sample
+   // also completed an analysis, on_ready is called first.
+   template <std::size_t max_window>
+   template <typename F, typename G>
+   inline bool basic_period_detector<max_window>::process(
+      float const* in, std::size_t n, F&& on_ready, G&& on_edge)
+   {
+      bool ready = false;
+      for (std::size_t i = 0; i != n;)
+      {
+         // The zero crossing stops right after the sample that changed its
+         // state, so prev is also the state before that last sample.
+         bool prev = _zc();
+         i += _zc(in + i, n - i);
+         if (update(prev))
+         {
+            ready = true;
+            on_ready(i - 1);
+         }
+         if (prev && !_zc())
+            on_edge(i - 1);
+      }
+      return ready;
+   }
+
+   // Advance by n samples, updating only the zero crossing. The windows
+   // that became ready are not analyzed: fundamental() is not updated and
+   // the bitstream will be rebuilt on the next analysis.
+   template <std::size_t max_window>
+   inline void basic_period_detector<max_window>::skip(float const* in, std::size_t n)
+   {
+      for (std::size_t i = 0; i != n;)
+      {
+         bool prev = _zc();
+         i += _zc(in + i, n - i);
+         update(prev, false);
+      }
+   }
+
+   // Start afresh, e.g. when the input is gated: the zero crossing is reset
+   // and the results of the previous analysis are cleared.
+   template <std::size_t max_window>
+   inline void basic_period_detector<max_window>::reset()
+   {
+      _zc.reset();
+      _fundamental = info{};
+      _shiftable = false;
+      _pending = false;
+      _onset = true;
+      _provisional = false;
+      _predicted_period = -1.0f;
+      _window_analyzed = false;
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_period_detector<max_window>::update(bool prev, bool analyze_window)
+   {
+      bool zc = _zc();
       if (!zc && prev != zc)
       {
          ++_edge_mark;
@@ -328,18 +843,144 @@ namespace cycfi::q
       }
 
       if (_zc.is_reset())
+      {
          _fundamental = info{};
+         _pending = false;
+         _window_analyzed = false;
+         _onset = true;
+         _provisional = false;
+      }
 
       if (_zc.is_ready())
       {
-         set_bitstream();
-         autocorrelate();
+         _onset = false;
+         _provisional = false;
+         if (!analyze_window)
+         {
+            _shiftable = false;
+            _pending = false;
+            return false;
+         }
+
+         if (_lazy)
+         {
+            // A window that was never analyzed breaks the chain of
+            // shifted bitstreams (see set_bitstream).
+            if (_pending)
+               _shiftable = false;
+            _window.assign(_zc);
+            _pending = true;
+
+            // The period predicted from the edges of the window: the edges
+            // of the zero crossing now (the snapshot does not index the
+            // similar edges). As in predict_period, a prediction made
+            // since the latest falling edge is reused.
+            _pending_edge = _edge_mark;
+            _pending_period =
+               (_predicted_period == -1.0f && _edge_mark != _predict_edge)?
+               detail::predict_period(_zc) : _predicted_period;
+            return true;
+         }
+
+         _window_analyzed = false;
+         set_bitstream(_zc);
+         autocorrelate(_zc);
          return true;
       }
+
+      // Until the first window is ready, estimate the period on each
+      // falling edge (see fast_onset).
+      if (_fast_onset && _onset && analyze_window && !zc && prev != zc)
+         return onset_estimate();
       return false;
    }
 
-   inline float period_detector::harmonic(std::size_t index) const
+   // Estimate the period from the edges captured since the reset, before
+   // the first window is ready. Returns true if a provisional fundamental
+   // was found.
+   template <std::size_t max_window>
+   inline bool basic_period_detector<max_window>::onset_estimate()
+   {
+      auto const period = predict_period();
+      if (period < _min_period || period > _mid_point)
+         return false;
+
+      // The partial bitstream, from the strong edges so far. The bits
+      // after the latest frame are all zero. The bitstream will be rebuilt
+      // from scratch for the first window.
+      auto const frames = _zc.frame();
+      auto const threshold = _zc.peak_pulse() * pulse_threshold;
+      auto const* peaks = _zc.peaks();
+      auto const* leading_edges = _zc.leading_edges();
+      auto const* trailing_edges = _zc.trailing_edges();
+      _bits.clear();
+      _acf_valid.clear();
+      _shiftable = false;
+      int start = -1;
+      for (std::size_t i = 0; i != _zc.num_edges(); ++i)
+      {
+         if (peaks[i] < threshold)
+            continue;
+         auto pos = std::max<int>(leading_edges[i], 0);
+         auto end = trailing_edges[i] < pos? int(frames) : trailing_edges[i];
+         if (end > pos)
+            _bits.set(pos, end - pos, 1);
+         if (start < 0)
+            start = pos;
+      }
+
+      // Correlate from the integer holding the first strong edge (the bits
+      // before the note are not counted) up to the latest frame. We need
+      // at least two periods, and a full integer of bits to correlate.
+      constexpr auto value_size = bitset<>::value_size;
+      auto const first = (start / value_size) * value_size;
+      auto const lag = std::size_t(std::round(period));
+      if (start < 0 || frames < first + lag * 2 || frames < first + lag + value_size)
+         return false;
+
+      auto const* data = _bits.data() + first / value_size;
+      auto correlate = [&](std::size_t lag)
+      {
+         auto const n = (frames - first - lag) / value_size;
+         auto count = detail::xor_count_bits(
+            data, data + lag / value_size, n, lag % value_size);
+         return 1.0f - float(count) / (n * value_size);
+      };
+      info result = { period, correlate(lag) };
+
+      // The edges may span several periods. Take the shortest period, a
+      // whole fraction of the predicted period, that is just as periodic.
+      for (std::size_t div = 2; period / div >= _min_period; ++div)
+      {
+         auto const sub_lag = std::size_t(std::round(period / div));
+         auto periodicity = correlate(sub_lag);
+         if (periodicity >= result._periodicity - onset_periodicity_margin)
+            result = { period / div, std::max(periodicity, result._periodicity) };
+      }
+
+      _fundamental = result;
+      _provisional = true;
+      return true;
+   }
+
+   // Analyze the pending window, if any (see lazy_analysis). Returns true
+   // if a window was analyzed.
+   template <std::size_t max_window>
+   inline bool basic_period_detector<max_window>::analyze()
+   {
+      if (!_pending)
+         return false;
+      _pending = false;
+      set_bitstream(_window);
+      autocorrelate(_window);
+      _window_period = _pending_period;
+      _window_edge = _pending_edge;
+      _window_analyzed = true;
+      return true;
+   }
+
+   template <std::size_t max_window>
+   inline float basic_period_detector<max_window>::harmonic(std::size_t index) const
    {
       if (index > 0)
       {
@@ -349,8 +990,7 @@ namespace cycfi::q
          auto target_period = _fundamental._period / index;
          if (target_period >= _min_period && target_period < _mid_point)
          {
-            bitstream_acf<> ac{ _bits };
-            auto count = ac(std::round(target_period));
+            auto count = acf(std::round(target_period));
             float periodicity = 1.0f - (count * _weight);
             return periodicity;
          }
@@ -358,36 +998,59 @@ namespace cycfi::q
       return 0.0f;
    }
 
-   inline bool period_detector::operator()() const
+   // Get the periodicity of the first n harmonics: out[i] receives
+   // harmonic(i+1). Each harmonic is a single lag correlation (see acf),
+   // the same as calling harmonic for each index.
+   template <std::size_t max_window>
+   inline void basic_period_detector<max_window>::harmonics(float* out, std::size_t n) const
+   {
+      if (n == 0)
+         return;
+      out[0] = _fundamental._periodicity;
+
+      for (std::size_t index = 2; index <= n; ++index)
+      {
+         auto target_period = _fundamental._period / index;
+         if (target_period >= _min_period && target_period < _mid_point)
+         {
+            auto count = acf(std::round(target_period));
+            out[index-1] = 1.0f - (count * _weight);
+         }
+         else
+         {
+            out[index-1] = 0.0f;
+         }
+      }
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_period_detector<max_window>::operator()() const
    {
       return _zc();
    }
 
-   inline float period_detector::predict_period() const
+   template <std::size_t max_window>
+   inline float basic_period_detector<max_window>::predict_period() const
    {
-      if (_predicted_period == -1.0f && _edge_mark != _predict_edge)
+      // In lazy analysis mode, predict from the window analyzed. The
+      // prediction is kept for the falling edge of the window, as if it
+      // was made when the window was ready.
+      if (_window_analyzed)
       {
-         _predict_edge = _edge_mark;
-         if (_zc.num_edges() > 1)
+         if (_edge_mark == _window_edge
+            && _predicted_period == -1.0f && _edge_mark != _predict_edge)
          {
-            auto threshold = _zc.peak_pulse() * pulse_threshold;
-            for (int i = _zc.num_edges()-1; i > 0; --i)
-            {
-               auto const& edge2 = _zc[i];
-               if (edge2._peak >= threshold)
-               {
-                  for (int j = i-1; j >= 0; --j)
-                  {
-                     auto const& edge1 = _zc[j];
-                     if (edge1.similar(edge2))
-                     {
-                        _predicted_period = edge1.fractional_period(edge2);
-                        return _predicted_period;
-                     }
-                  }
-               }
-            }
+            _predict_edge = _edge_mark;
+            _predicted_period = _window_period;
          }
+         return _window_period;
+      }
+
+      // The prediction is computed at most once for each falling edge
+      if (_predicted_period == -1.0f && _edge_mark != _predict_edge)
+      {
+         _predict_edge = _edge_mark;
+         _predicted_period = detail::predict_period(_zc);
       }
       return _predicted_period;
    }
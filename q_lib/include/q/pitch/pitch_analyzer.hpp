@@ -0,0 +1,355 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_PITCH_ANALYZER_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_PITCH_ANALYZER_HPP_OCTOBER_17_2020
+
+#include <q/pitch/pitch_detector.hpp>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // pitch_analyzer runs the pitch_detector over long recordings (offline),
+   // using multiple threads. The result is identical to running a single
+   // pitch_detector over the whole recording, sample by sample.
+   //
+   // The input is split into segments, and the analysis is done in three
+   // stages:
+   //
+   //    1. The zero crossing pass (period_detector::skip). This determines
+   //       the analysis windows, which depend on the whole history of the
+   //       input, so it is done serially. Before each segment, a copy of
+   //       the period_detector is saved. This is the exact detector state
+   //       at the start of the segment.
+   //
+   //    2. The period detection (autocorrelation) of each segment, starting
+   //       from its saved period_detector. The segments are independent at
+   //       this point, and are processed in parallel by the worker threads.
+   //
+   //    3. The frequency tracking (pitch_detector::update). This is done
+   //       serially, in order, from the period_detector results saved by
+   //       stage 2 for each analysis window.
+   //
+   // Stages 1 and 3 run in the calling thread, concurrently with the
+   // workers. Stage 1 is the serial bottleneck, but is significantly
+   // cheaper than stage 2.
+   //
+   // If reading the input (or anything else in the calling thread) throws,
+   // the workers are stopped and joined, and the exception is rethrown.
+   //
+   // The result is a track: one point for each analysis window, the same
+   // points where pitch_detector's function operator returns true.
+   ////////////////////////////////////////////////////////////////////////////
+   class pitch_analyzer
+   {
+   public:
+
+      struct point
+      {
+         std::size_t          position;      // Sample index
+         float                frequency;
+         float                periodicity;
+
+         bool operator==(point const& rhs) const
+         {
+            return position == rhs.position
+               && frequency == rhs.frequency
+               && periodicity == rhs.periodicity;
+         }
+      };
+
+      using track = std::vector<point>;
+
+      static constexpr std::size_t max_pending_per_thread = 4;
+
+                              pitch_analyzer(
+                                 frequency lowest_freq
+                               , frequency highest_freq
+                               , std::uint32_t sps
+                               , decibel hysteresis
+                               , std::size_t num_threads = std::thread::hardware_concurrency()
+                               , std::size_t segment_size = 0
+                              );
+
+                              pitch_analyzer(pitch_analyzer const&) = delete;
+      pitch_analyzer&         operator=(pitch_analyzer const&) = delete;
+
+                              template <typename Reader>
+      track                   operator()(Reader& src);
+      track                   operator()(float const* in, std::size_t n);
+
+      std::size_t             num_threads() const     { return _num_threads; }
+      std::size_t             segment_size() const    { return _segment_size; }
+
+   private:
+
+      // The period_detector results used by pitch_detector::update
+      struct analysis
+      {
+         std::size_t             position;
+         period_detector::info   fundamental;
+         float                   predicted_period;
+         std::size_t             edge_mark;
+      };
+
+      struct segment
+      {
+         std::size_t             position;
+         std::vector<float>      samples;
+         period_detector         pd;
+         std::vector<analysis>   results;
+         bool                    done = false;
+      };
+
+      // Replays the period_detector results for pitch_detector::update,
+      // including the caching behavior of period_detector::predict_period.
+      struct replay
+      {
+         period_detector::info const&
+                                 fundamental() const  { return _analysis->fundamental; }
+         std::size_t             minimum_period() const { return _min_period; }
+         float                   predict_period() const;
+         void                    next(analysis const& a);
+
+         analysis const*         _analysis = nullptr;
+         std::size_t             _min_period;
+         mutable float           _predicted_period = -1.0f;
+         mutable std::size_t     _predict_edge = 0;
+         std::size_t             _edge_mark = 0;
+      };
+
+      using segment_ptr = std::unique_ptr<segment>;
+
+      template <typename Read>
+      track                   run(Read&& read);
+      void                    worker();
+      static void             analyze(segment& seg);
+
+      frequency const         _lowest_freq;
+      frequency const         _highest_freq;
+      std::uint32_t const     _sps;
+      decibel const           _hysteresis;
+      std::size_t const       _num_threads;
+      std::size_t const       _segment_size;
+
+      std::mutex              _mutex;
+      std::condition_variable _work_cv;
+      std::condition_variable _done_cv;
+      std::deque<segment*>    _queue;
+      bool                    _stop = false;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Implementation
+   ////////////////////////////////////////////////////////////////////////////
+   inline pitch_analyzer::pitch_analyzer(
+      frequency lowest_freq
+    , frequency highest_freq
+    , std::uint32_t sps
+    , decibel hysteresis
+    , std::size_t num_threads
+    , std::size_t segment_size
+   )
+    : _lowest_freq(lowest_freq)
+    , _highest_freq(highest_freq)
+    , _sps(sps)
+    , _hysteresis(hysteresis)
+    , _num_threads(std::max<std::size_t>(num_threads, 1))
+    , _segment_size(segment_size? segment_size : sps)
+   {}
+
+   inline float pitch_analyzer::replay::predict_period() const
+   {
+      // Same as period_detector::predict_period
+      if (_predicted_period == -1.0f && _edge_mark != _predict_edge)
+      {
+         _predict_edge = _edge_mark;
+         _predicted_period = _analysis->predicted_period;
+      }
+      return _predicted_period;
+   }
+
+   inline void pitch_analyzer::replay::next(analysis const& a)
+   {
+      // The period_detector discards the prediction on every falling edge
+      if (a.edge_mark != _edge_mark)
+         _predicted_period = -1.0f;
+      _edge_mark = a.edge_mark;
+      _analysis = &a;
+   }
+
+   inline void pitch_analyzer::analyze(segment& seg)
+   {
+      auto& pd = seg.pd;
+      pd.process(seg.samples.data(), seg.samples.size(),
+         [&](std::size_t i)
+         {
+            seg.results.push_back({
+               seg.position + i
+             , pd.fundamental()
+             , detail::predict_period(pd.edges())
+             , pd.edge_mark()
+            });
+         }
+      );
+
+      // We no longer need the samples
+      seg.samples = std::vector<float>{};
+   }
+
+   inline void pitch_analyzer::worker()
+   {
+      while (true)
+      {
+         segment* seg = nullptr;
+         {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _work_cv.wait(lock, [&]{ return _stop || !_queue.empty(); });
+            if (_queue.empty())
+               return;
+            seg = _queue.front();
+            _queue.pop_front();
+         }
+
+         analyze(*seg);
+
+         {
+            std::lock_guard<std::mutex> lock(_mutex);
+            seg->done = true;
+         }
+         _done_cv.notify_all();
+      }
+   }
+
+   template <typename Read>
+   inline pitch_analyzer::track pitch_analyzer::run(Read&& read)
+   {
+      track result;
+      pitch_detector tracker{ _lowest_freq, _highest_freq, _sps, _hysteresis };
+      period_detector pd{ _lowest_freq, _highest_freq, _sps, _hysteresis };
+      replay source{ nullptr, pd.minimum_period() };
+
+      std::deque<segment_ptr> pending;
+      auto const max_pending = _num_threads * max_pending_per_thread;
+
+      // Stage 3: frequency tracking of the completed segments, in order
+      auto track_front = [&](std::unique_lock<std::mutex>& lock, bool wait)
+      {
+         while (!pending.empty())
+         {
+            auto& seg = *pending.front();
+            if (!seg.done)
+            {
+               if (!wait)
+                  return;
+               _done_cv.wait(lock, [&]{ return seg.done; });
+            }
+
+            lock.unlock();
+            for (auto const& a : seg.results)
+            {
+               source.next(a);
+               tracker.update(source);
+               result.push_back({
+                  a.position
+                , tracker.get_frequency()
+                , a.fundamental._periodicity
+               });
+            }
+            pending.pop_front();
+            lock.lock();
+         }
+      };
+
+      std::vector<std::thread> workers;
+      auto stop = [&]
+      {
+         {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _queue.clear();
+            _stop = true;
+         }
+         _work_cv.notify_all();
+         for (auto& t : workers)
+            t.join();
+      };
+
+      _stop = false;
+      try
+      {
+         for (std::size_t i = 0; i != _num_threads; ++i)
+            workers.emplace_back([this]{ worker(); });
+
+         std::size_t position = 0;
+         while (true)
+         {
+            // Stage 1: the zero crossing pass
+            auto seg = std::make_unique<segment>(segment{ position, {}, pd, {} });
+            seg->samples.resize(_segment_size);
+            auto n = read(seg->samples.data(), _segment_size);
+            if (n == 0)
+               break;
+            seg->samples.resize(n);
+            pd.skip(seg->samples.data(), n);
+            position += n;
+
+            std::unique_lock<std::mutex> lock(_mutex);
+            _queue.push_back(seg.get());
+            pending.push_back(std::move(seg));
+            _work_cv.notify_one();
+
+            track_front(lock, pending.size() >= max_pending);
+         }
+
+         std::unique_lock<std::mutex> lock(_mutex);
+         track_front(lock, true);
+      }
+      catch (...)
+      {
+         // The workers may still be analyzing segments that we own. Drop
+         // the queued segments and wait for the workers before unwinding.
+         stop();
+         throw;
+      }
+      stop();
+
+      return result;
+   }
+
+   template <typename Reader>
+   inline pitch_analyzer::track pitch_analyzer::operator()(Reader& src)
+   {
+      return run(
+         [&](float* data, std::size_t n) -> std::size_t
+         {
+            return src.read(data, n);
+         }
+      );
+   }
+
+   inline pitch_analyzer::track pitch_analyzer::operator()(float const* in, std::size_t n)
+   {
+      return run(
+         [&](float* data, std::size_t len) -> std::size_t
+         {
+            len = std::min(len, n);
+            std::copy(in, in + len, data);
+            in += len;
+            n -= len;
+            return len;
+         }
+      );
+   }
+}
+
+#endif
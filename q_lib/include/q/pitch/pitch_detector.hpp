@@ -17,66 +17,147 @@
 namespace cycfi::q
 {
    ////////////////////////////////////////////////////////////////////////////
-   class pitch_detector
+   // Given a non-zero max_window, the pitch_detector does not allocate (see
+   // basic_period_detector). The pitch_detector type alias allocates its
+   // storage at construction time. The hop is the number of frames between
+   // analyses (see zero_crossing). The default (0) is half the window.
+   //
+   // In lazy analysis mode (see period_detector::lazy_analysis), the
+   // function operator and process only record that a window is ready. The
+   // latest window is analyzed, and the frequency updated, on the first
+   // query after that: get_frequency, periodicity, is_note_shift, etc. This
+   // is for clients that read the frequency at control rate, e.g. once per
+   // block. Take note that the queries are then not safe to call
+   // concurrently with each other.
+   //
+   // In fast onset mode (see period_detector::fast_onset), a provisional
+   // frequency is given at the note onset, before the first window is
+   // ready. The function operator and process report it as ready, and
+   // is_provisional() is true. Only provisional estimates that are periodic
+   // enough (max_deviation), and that agree with the previous estimate, are
+   // taken. The provisional frequency is kept until a full analysis gives a
+   // frequency that is periodic enough.
+   //
+   // The frequency is updated once per analysis, every hop frames. For
+   // smooth vibrato and bends, cycle tracking (see cycle_tracking) gives a
+   // frequency per cycle of the signal: the cycle frequency. Once the
+   // frequency is known, each strong pulse (see period_detector) that
+   // completes is matched with the pulse one period before it, and their
+   // fractional period (see zero_crossing::info) gives the cycle frequency.
+   // The period one cycle before is the expected period, and the cycle
+   // frequency must be within cycle_tolerance of the frequency of the last
+   // analysis, or it is disregarded. After each sample given to the
+   // function operator, is_new_cycle() tells if there is a new cycle
+   // frequency. process(in, n, on_ready, on_cycle) calls on_cycle(i) for
+   // each one instead. In lazy analysis mode, the cycles are tracked against the
+   // frequency of the last analysis that was queried.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t max_window = 0>
+   class basic_pitch_detector
    {
    public:
 
+      using period_detector_type = basic_period_detector<max_window>;
+      using bitset_type = typename period_detector_type::bitset_type;
+      using zero_crossing_type = typename period_detector_type::zero_crossing_type;
+
       static constexpr float  max_deviation = 0.90f;
       static constexpr float  min_periodicity = 0.8f;
+      static constexpr float  cycle_tolerance = 0.125f;     // approx 2 semitones
 
-                              pitch_detector(
+                              basic_pitch_detector(
                                  frequency lowest_freq
                                , frequency highest_freq
                                , std::uint32_t sps
                                , decibel hysteresis
+                               , std::size_t hop = 0
                               );
 
-                              pitch_detector(pitch_detector const& rhs) = default;
-                              pitch_detector(pitch_detector&& rhs) = default;
+                              basic_pitch_detector(basic_pitch_detector const& rhs) = default;
+                              basic_pitch_detector(basic_pitch_detector&& rhs) = default;
 
       bool                    operator()(float s);
-      float                   get_frequency() const         { return _frequency; }
+      bool                    process(float const* in, std::size_t n);
+                              template <typename F>
+      bool                    process(float const* in, std::size_t n, F&& on_ready);
+                              template <typename F, typename G>
+      bool                    process(float const* in, std::size_t n, F&& on_ready, G&& on_cycle);
+      float                   get_frequency() const;
+      float                   cycle_frequency() const       { return _cycle_frequency; }
+      bool                    is_new_cycle() const          { return _new_cycle; }
       float                   predict_frequency(bool init = false);
       bool                    is_note_shift() const;
-      std::size_t             frames_after_shift() const    { return _frames_after_shift; }
+      std::size_t             frames_after_shift() const;
       float                   periodicity() const;
-      void                    reset()                       { _frequency = 0.0f; }
+      bool                    is_provisional() const        { return _provisional; }
+      void                    reset();
+      void                    search_decimation(std::size_t factor) { _pd.search_decimation(factor); }
+      void                    lazy_analysis(bool enable)    { _pd.lazy_analysis(enable); }
+      bool                    lazy_analysis() const         { return _pd.lazy_analysis(); }
+      void                    fast_onset(bool enable)       { _pd.fast_onset(enable); }
+      bool                    fast_onset() const            { return _pd.fast_onset(); }
+      void                    cycle_tracking(bool enable);
+      bool                    cycle_tracking() const        { return _cycle_tracking; }
+
+      bitset_type const&      bits() const;
+      zero_crossing_type const& edges() const               { return _pd.edges(); }
+      period_detector_type const& get_period_detector() const;
 
-      bitset<> const&         bits() const                  { return _pd.bits(); }
-      zero_crossing const&    edges() const                 { return _pd.edges(); }
-      period_detector const&  get_period_detector() const   { return _pd; }
+                              template <typename PeriodSource>
+      void                    update(PeriodSource const& src);
 
    private:
 
-      float                   calculate_frequency() const;
-      float                   bias(float current, float incoming, bool& shift);
-      void                    bias(float incoming);
+      void                    analyze_pending() const;
+      void                    provisional();
+      void                    collect();
+      bool                    track_cycle();
+                              template <typename PeriodSource>
+      float                   calculate_frequency(PeriodSource const& src) const;
+                              template <typename PeriodSource>
+      float                   predict_frequency(PeriodSource const& src, bool init);
+                              template <typename PeriodSource>
+      float                   bias(PeriodSource const& src, float current, float incoming, bool& shift);
+                              template <typename PeriodSource>
+      void                    bias(PeriodSource const& src, float incoming);
 
       using exp_moving_average_type = exp_moving_average<2>;
 
-      period_detector         _pd;
+      period_detector_type    _pd;
       float                   _frequency;
       median3                 _median;
       median3                 _predict_median;
       std::uint32_t           _sps;
       std::size_t             _frames_after_shift = 0;
+      bool                    _provisional = false;
+      float                   _onset_frequency = 0.0f;
+      bool                    _cycle_tracking = false;
+      bool                    _new_cycle = false;
+      float                   _cycle_frequency = 0.0f;
    };
 
+   using pitch_detector = basic_pitch_detector<>;
+
    ////////////////////////////////////////////////////////////////////////////
    // Implementation
    ////////////////////////////////////////////////////////////////////////////
-   inline pitch_detector::pitch_detector(
+   template <std::size_t max_window>
+   inline basic_pitch_detector<max_window>::basic_pitch_detector(
        q::frequency lowest_freq
      , q::frequency highest_freq
      , std::uint32_t sps
      , decibel hysteresis
+     , std::size_t hop
    )
-     : _pd{ lowest_freq, highest_freq, sps, hysteresis }
+     : _pd{ lowest_freq, highest_freq, sps, hysteresis, hop }
      , _frequency{ 0.0f }
      , _sps{ sps }
    {}
 
-   inline float pitch_detector::bias(float current, float incoming, bool& shift)
+   template <std::size_t max_window>
+   template <typename PeriodSource>
+   inline float basic_pitch_detector<max_window>::bias(
+      PeriodSource const& src, float current, float incoming, bool& shift)
    {
       auto error = current / 32; // approx 1/2 semitone
       auto diff = std::abs(current-incoming);
@@ -113,7 +194,7 @@ namespace cycfi::q
       // this point, we are looking at a potential frequency shift, after
       // passing through the code above, checking for fundamental and
       // harmonic matches).
-      if (_pd.fundamental()._periodicity > min_periodicity)
+      if (src.fundamental()._periodicity > min_periodicity)
       {
          // Now we have a frequency shift
          shift = true;
@@ -122,27 +203,29 @@ namespace cycfi::q
       return current;
    }
 
-   inline void pitch_detector::bias(float incoming)
+   template <std::size_t max_window>
+   template <typename PeriodSource>
+   inline void basic_pitch_detector<max_window>::bias(PeriodSource const& src, float incoming)
    {
       auto current = _frequency;
       ++_frames_after_shift;
       bool shift = false;
-      auto f = bias(current, incoming, shift);
+      auto f = bias(src, current, incoming, shift);
 
       // Don't do anything if incoming is not periodic enough
       // Note that we only do this check on frequency shifts
       if (shift)
       {
-         if (_pd.fundamental()._periodicity < max_deviation)
+         if (src.fundamental()._periodicity < max_deviation)
          {
             // If we don't have enough confidence in the autocorrelation
             // result, we'll try the zero-crossing edges to extract the
             // frequency and the one closest to the current frequency wins.
             bool shift2 = false;
-            auto predicted = predict_frequency();
+            auto predicted = predict_frequency(src, false);
             if (predicted > 0.0f)
             {
-               float f2 = bias(current, predicted, shift2);
+               float f2 = bias(src, current, predicted, shift2);
 
                // If there's no shift, the edges wins
                if (!shift2)
@@ -178,59 +261,292 @@ namespace cycfi::q
       }
    }
 
-   inline bool pitch_detector::operator()(float s)
+   template <std::size_t max_window>
+   inline void basic_pitch_detector<max_window>::reset()
    {
-      _pd(s);
+      _pd.reset();
+      _frequency = 0.0f;
+      _median = 0.0f;
+      _predict_median = 0.0f;
+      _frames_after_shift = 0;
+      _onset_frequency = 0.0f;
+      _provisional = false;
+      _cycle_frequency = 0.0f;
+      _new_cycle = false;
+   }
 
-      if (_pd.is_ready())
+   template <std::size_t max_window>
+   inline void basic_pitch_detector<max_window>::cycle_tracking(bool enable)
+   {
+      _cycle_tracking = enable;
+      _cycle_frequency = 0.0f;
+      _new_cycle = false;
+   }
+
+   // Take the provisional estimate of the period detector at the onset (see
+   // fast onset above).
+   template <std::size_t max_window>
+   inline void basic_pitch_detector<max_window>::provisional()
+   {
+      if (_pd.fundamental()._periodicity >= max_deviation)
       {
-         if (_frequency == 0.0f)
+         // The estimates are not reliable in the attack. Wait until two
+         // consecutive estimates agree (approx 1/2 semitone).
+         auto f = calculate_frequency(_pd);
+         auto prev = std::exchange(_onset_frequency, f);
+         if (f > 0.0f && std::abs(f - prev) < prev / 32)
          {
-            // Disregard if we are not periodic enough
-            if (_pd.fundamental()._periodicity >= max_deviation)
+            _frequency = f;
+            _frames_after_shift = 0;
+            _provisional = true;
+         }
+      }
+   }
+
+   // Update after the period detector completed an analysis, or a window
+   // in lazy analysis mode, or a provisional estimate.
+   template <std::size_t max_window>
+   inline void basic_pitch_detector<max_window>::collect()
+   {
+      if (_pd.is_provisional())
+      {
+         provisional();
+      }
+      else
+      {
+         _onset_frequency = 0.0f;
+         if (!_pd.is_pending())
+            update(_pd);
+      }
+   }
+
+   // Track the cycle completed by the latest pulse (see cycle tracking
+   // above). Returns true if there is a new cycle frequency.
+   template <std::size_t max_window>
+   inline bool basic_pitch_detector<max_window>::track_cycle()
+   {
+      if (_frequency == 0.0f || _provisional)
+         return false;
+
+      auto const& zc = _pd.edges();
+      auto const n = zc.num_edges();
+      if (n < 2)
+         return false;
+
+      auto const threshold = zc.peak_pulse() * period_detector_type::pulse_threshold;
+      auto const edge2 = zc[n-1];
+      if (edge2._peak < threshold)
+         return false;
+
+      // The expected period is the period of the previous cycle, if it is
+      // still close to the frequency (e.g. not a new note).
+      auto const valid = [this](float f)
+      {
+         return std::abs(f - _frequency) < _frequency * cycle_tolerance;
+      };
+      auto const expected = _sps / (valid(_cycle_frequency)? _cycle_frequency : _frequency);
+
+      // Find the strong pulse nearest to the expected period before edge2.
+      // The leading edges are in increasing order, so we can stop once we
+      // are past the expected period.
+      auto const limit = expected * (1.0f + cycle_tolerance) + 1;
+      int match = -1;
+      float match_diff = limit;
+      for (int i = n-2; i >= 0; --i)
+      {
+         auto const edge1 = zc[i];
+         float period = edge2._leading_edge - edge1._leading_edge;
+         if (period > limit)
+            break;
+         if (edge1._peak >= threshold)
+         {
+            auto diff = std::abs(period - expected);
+            if (diff < match_diff)
             {
-               auto f = calculate_frequency();
-               if (f > 0.0f)
-               {
-                  _median(f);       // Apply the median for the future
-                  _frequency = f;   // But assign outright now
-                  _frames_after_shift = 0;
-               }
+               match = i;
+               match_diff = diff;
             }
          }
-         else
+      }
+      if (match < 0)
+         return false;
+
+      // Validate against the frequency of the last analysis
+      auto const f = _sps / zc[match].fractional_period(edge2);
+      if (!valid(f))
+         return false;
+      _cycle_frequency = f;
+      return true;
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_pitch_detector<max_window>::operator()(float s)
+   {
+      auto const mark = _pd.edge_mark();
+      bool ready = _pd(s);
+      if (ready)
+         collect();
+      if (_cycle_tracking)
+         _new_cycle = _pd.edge_mark() != mark && track_cycle();
+      return ready;
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_pitch_detector<max_window>::process(float const* in, std::size_t n)
+   {
+      return process(in, n, [](std::size_t) {});
+   }
+
+   // Process a block of n samples. This gives the same results as calling
+   // the function operator for each sample. on_ready(i) is called right
+   // after the sample at block offset i updated the frequency (or, in lazy
+   // analysis mode, completed a window). This includes the provisional
+   // estimates in fast onset mode.
+   template <std::size_t max_window>
+   template <typename F>
+   inline bool basic_pitch_detector<max_window>::process(float const* in, std::size_t n, F&& on_ready)
+   {
+      return process(in, n, on_ready, [](std::size_t) {});
+   }
+
+   // Same as above, but also calls on_cycle(i) right after the sample at
+   // block offset i gave a new cycle frequency (see cycle tracking above).
+   // If the same sample also updated the frequency, on_ready is called
+   // first.
+   template <std::size_t max_window>
+   template <typename F, typename G>
+   inline bool basic_pitch_detector<max_window>::process(
+      float const* in, std::size_t n, F&& on_ready, G&& on_cycle)
+   {
+      return _pd.process(in, n,
+         [&](std::size_t i)
          {
-            if (_pd.fundamental()._periodicity < min_periodicity)
-               _frames_after_shift = 0;
-            auto f = calculate_frequency();
+            collect();
+            on_ready(i);
+         }
+       , [&](std::size_t i)
+         {
+            if (_cycle_tracking && track_cycle())
+               on_cycle(i);
+         }
+      );
+   }
+
+   // Analyze the pending window, if any, and update the frequency (see lazy
+   // analysis above). A window can only be pending after the function
+   // operator or process were called, so the detector is not a const
+   // object, and the const_cast is safe.
+   template <std::size_t max_window>
+   inline void basic_pitch_detector<max_window>::analyze_pending() const
+   {
+      if (_pd.is_pending())
+      {
+         auto& self = const_cast<basic_pitch_detector&>(*this);
+         self._pd.analyze();
+         self.update(self._pd);
+      }
+   }
+
+   template <std::size_t max_window>
+   inline float basic_pitch_detector<max_window>::get_frequency() const
+   {
+      analyze_pending();
+      return _frequency;
+   }
+
+   template <std::size_t max_window>
+   inline std::size_t basic_pitch_detector<max_window>::frames_after_shift() const
+   {
+      analyze_pending();
+      return _frames_after_shift;
+   }
+
+   template <std::size_t max_window>
+   inline typename basic_pitch_detector<max_window>::bitset_type const&
+   basic_pitch_detector<max_window>::bits() const
+   {
+      analyze_pending();
+      return _pd.bits();
+   }
+
+   template <std::size_t max_window>
+   inline typename basic_pitch_detector<max_window>::period_detector_type const&
+   basic_pitch_detector<max_window>::get_period_detector() const
+   {
+      analyze_pending();
+      return _pd;
+   }
+
+   // Update the frequency after the period detector is ready. This is
+   // done by the function operator and process. PeriodSource provides the
+   // period_detector results used here: fundamental(), predict_period()
+   // and minimum_period().
+   template <std::size_t max_window>
+   template <typename PeriodSource>
+   inline void basic_pitch_detector<max_window>::update(PeriodSource const& src)
+   {
+      // The first frequency, or the first one after a provisional estimate
+      if (_frequency == 0.0f || _provisional)
+      {
+         // Disregard if we are not periodic enough
+         if (src.fundamental()._periodicity >= max_deviation)
+         {
+            auto f = calculate_frequency(src);
             if (f > 0.0f)
-               bias(f);
+            {
+               _median(f);       // Apply the median for the future
+               _frequency = f;   // But assign outright now
+               _frames_after_shift = 0;
+               _provisional = false;
+            }
          }
       }
-      return _pd.is_ready();
+      else
+      {
+         if (src.fundamental()._periodicity < min_periodicity)
+            _frames_after_shift = 0;
+         auto f = calculate_frequency(src);
+         if (f > 0.0f)
+            bias(src, f);
+      }
    }
 
-   inline float pitch_detector::calculate_frequency() const
+   template <std::size_t max_window>
+   template <typename PeriodSource>
+   inline float basic_pitch_detector<max_window>::calculate_frequency(PeriodSource const& src) const
    {
-      if (_pd.fundamental()._period != -1)
-         return _sps / _pd.fundamental()._period;
+      if (src.fundamental()._period != -1)
+         return _sps / src.fundamental()._period;
       return 0.0f;
    }
 
-   inline float pitch_detector::periodicity() const
+   template <std::size_t max_window>
+   inline float basic_pitch_detector<max_window>::periodicity() const
    {
+      analyze_pending();
       return _pd.fundamental()._periodicity;
    }
 
-   inline bool pitch_detector::is_note_shift() const
+   template <std::size_t max_window>
+   inline bool basic_pitch_detector<max_window>::is_note_shift() const
    {
+      analyze_pending();
       return _frames_after_shift == 0;
    }
 
-   inline float pitch_detector::predict_frequency(bool init)
+   template <std::size_t max_window>
+   inline float basic_pitch_detector<max_window>::predict_frequency(bool init)
+   {
+      analyze_pending();
+      return predict_frequency(_pd, init);
+   }
+
+   template <std::size_t max_window>
+   template <typename PeriodSource>
+   inline float basic_pitch_detector<max_window>::predict_frequency(PeriodSource const& src, bool init)
    {
-      auto period = _pd.predict_period();
-      if (period < _pd.minimum_period())
+      auto period = src.predict_period();
+      if (period < src.minimum_period())
          return 0.0f;
       auto f = _sps / period;
       if (_frequency != f)
@@ -0,0 +1,237 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_PITCH_DETECTOR_BANK_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_PITCH_DETECTOR_BANK_HPP_OCTOBER_17_2020
+
+#include <q/pitch/pitch_detector.hpp>
+#include <q/utility/worker_pool.hpp>
+#include <array>
+#include <memory>
+#include <utility>
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // pitch_detector_bank tracks the pitch of N channels (e.g. the strings of
+   // a multi-channel pickup) processed together, one block at a time.
+   //
+   // The bank is an array of complete, independent detectors, one per
+   // channel. The detectors are statically sized for windows of up to
+   // max_window frames (see basic_pitch_detector), so the bank does not
+   // allocate (but for the optional worker_pool). They are kept
+   // contiguously in a std::array, each one aligned to its own cache
+   // lines, so that channels processed by different threads do not share
+   // cache lines. Each channel's state (zero crossing, bitstream,
+   // correlogram and medians) stays together in its detector.
+   //
+   // Each block is processed one channel at a time, with the block
+   // function of the detector (see basic_pitch_detector::process). That
+   // skips the samples between pulses with a vectorized scan, which a
+   // per-sample loop across the channels would give up. Only the results
+   // of the latest block (frequency, periodicity and when the channel
+   // became ready) are kept in per-channel arrays, indexed by channel.
+   //
+   // Given a non-zero number of workers, the bank owns a worker_pool. The
+   // channels are independent, so when more than one channel is expected to
+   // run its autocorrelation in the same block, the whole block processing
+   // of the channels is fanned out to the workers. Otherwise, the channels
+   // are processed serially in the calling thread.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t N, std::size_t max_window>
+   class pitch_detector_bank
+   {
+   public:
+
+      static_assert(max_window > 0, "max_window must be non-zero");
+
+      static constexpr std::size_t num_channels = N;
+      static constexpr std::size_t cache_line_size = 64;
+
+      using frequencies = std::array<frequency, N>;
+      using pitch_detector_type = basic_pitch_detector<max_window>;
+
+                              pitch_detector_bank(
+                                 frequency lowest_freq
+                               , frequency highest_freq
+                               , std::uint32_t sps
+                               , decibel hysteresis
+                               , std::size_t num_workers = 0
+                              );
+
+                              pitch_detector_bank(
+                                 frequencies const& lowest_freq
+                               , frequencies const& highest_freq
+                               , std::uint32_t sps
+                               , decibel hysteresis
+                               , std::size_t num_workers = 0
+                              );
+
+                              pitch_detector_bank(pitch_detector_bank const&) = delete;
+      pitch_detector_bank&    operator=(pitch_detector_bank const&) = delete;
+
+      void                    process(float const* const in[], std::size_t n);
+
+      bool                    is_ready(std::size_t channel) const       { return _num_ready[channel] != 0; }
+      std::size_t             num_ready(std::size_t channel) const      { return _num_ready[channel]; }
+      std::size_t             ready_offset(std::size_t channel) const   { return _ready_offset[channel]; }
+      float                   get_frequency(std::size_t channel) const  { return _frequency[channel]; }
+      float                   periodicity(std::size_t channel) const    { return _periodicity[channel]; }
+
+      pitch_detector_type const& operator[](std::size_t channel) const  { return _channels[channel]._pd; }
+      pitch_detector_type&    operator[](std::size_t channel)           { return _channels[channel]._pd; }
+
+      std::size_t             num_workers() const                       { return _workers? _workers->size() : 0; }
+
+   private:
+
+      struct alignas(cache_line_size) channel
+      {
+         pitch_detector_type  _pd;
+      };
+
+      using channels = std::array<channel, N>;
+      using worker_pool_ptr = std::unique_ptr<worker_pool>;
+
+                              template <std::size_t... I>
+      static channels         make_channels(
+                                 frequencies const& lowest_freq
+                               , frequencies const& highest_freq
+                               , std::uint32_t sps
+                               , decibel hysteresis
+                               , std::index_sequence<I...>
+                              );
+
+      void                    process(std::size_t channel, float const* in, std::size_t n);
+
+      channels                      _channels;
+      worker_pool_ptr               _workers;
+
+      // Results of the latest block, per channel. num_ready is the number
+      // of times the channel became ready and ready_offset is the block
+      // offset of the latest one.
+      std::array<float, N>          _frequency = {};
+      std::array<float, N>          _periodicity = {};
+      std::array<std::size_t, N>    _num_ready = {};
+      std::array<std::size_t, N>    _ready_offset = {};
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Implementation
+   ////////////////////////////////////////////////////////////////////////////
+   namespace detail
+   {
+      template <typename T, std::size_t... I>
+      inline std::array<T, sizeof...(I)>
+      fill_array(T val, std::index_sequence<I...>)
+      {
+         return {{ (void(I), val)... }};
+      }
+
+      template <std::size_t N, typename T>
+      inline std::array<T, N> fill_array(T val)
+      {
+         return fill_array(val, std::make_index_sequence<N>{});
+      }
+   }
+
+   template <std::size_t N, std::size_t max_window>
+   inline pitch_detector_bank<N, max_window>::pitch_detector_bank(
+      frequency lowest_freq
+    , frequency highest_freq
+    , std::uint32_t sps
+    , decibel hysteresis
+    , std::size_t num_workers
+   )
+    : pitch_detector_bank(
+         detail::fill_array<N>(lowest_freq)
+       , detail::fill_array<N>(highest_freq)
+       , sps, hysteresis, num_workers
+      )
+   {}
+
+   template <std::size_t N, std::size_t max_window>
+   template <std::size_t... I>
+   inline typename pitch_detector_bank<N, max_window>::channels
+   pitch_detector_bank<N, max_window>::make_channels(
+      frequencies const& lowest_freq
+    , frequencies const& highest_freq
+    , std::uint32_t sps
+    , decibel hysteresis
+    , std::index_sequence<I...>
+   )
+   {
+      return {{ channel{ { lowest_freq[I], highest_freq[I], sps, hysteresis } }... }};
+   }
+
+   template <std::size_t N, std::size_t max_window>
+   inline pitch_detector_bank<N, max_window>::pitch_detector_bank(
+      frequencies const& lowest_freq
+    , frequencies const& highest_freq
+    , std::uint32_t sps
+    , decibel hysteresis
+    , std::size_t num_workers
+   )
+    : _channels(make_channels(
+         lowest_freq, highest_freq, sps, hysteresis, std::make_index_sequence<N>{}
+      ))
+   {
+      if (num_workers > 0)
+         _workers = std::make_unique<worker_pool>(num_workers);
+   }
+
+   template <std::size_t N, std::size_t max_window>
+   inline void pitch_detector_bank<N, max_window>::process(
+      std::size_t channel, float const* in, std::size_t n)
+   {
+      auto& pd = _channels[channel]._pd;
+      std::size_t num_ready = 0;
+      std::size_t offset = 0;
+      pd.process(in, n,
+         [&](std::size_t i)
+         {
+            ++num_ready;
+            offset = i;
+         }
+      );
+      _num_ready[channel] = num_ready;
+      _ready_offset[channel] = offset;
+      _frequency[channel] = pd.get_frequency();
+      _periodicity[channel] = pd.periodicity();
+   }
+
+   template <std::size_t N, std::size_t max_window>
+   inline void pitch_detector_bank<N, max_window>::process(float const* const in[], std::size_t n)
+   {
+      if (_workers)
+      {
+         // A channel becomes ready (and runs its autocorrelation) once its
+         // zero crossing frame reaches the end of the window.
+         std::size_t expected = 0;
+         for (auto const& ch : _channels)
+         {
+            auto const& zc = ch._pd.edges();
+            if (zc.frame() + n >= zc.window_size())
+               ++expected;
+         }
+
+         if (expected > 1)
+         {
+            _workers->run(N,
+               [&](std::size_t channel)
+               {
+                  process(channel, in[channel], n);
+               }
+            );
+            return;
+         }
+      }
+
+      for (std::size_t channel = 0; channel != N; ++channel)
+         process(channel, in[channel], n);
+   }
+}
+
+#endif
@@ -6,7 +6,9 @@
 #if !defined(CYCFI_Q_MIDI_HPP_OCTOBER_8_2012)
 #define CYCFI_Q_MIDI_HPP_OCTOBER_8_2012
 
+#include <cctype>
 #include <cstdint>
+#include <string_view>
 #include <q/support/notes.hpp>
 
 #if defined(B0)
@@ -9,9 +9,12 @@
 #include <type_traits>
 #include <cstddef>
 #include <vector>
+#include <array>
 #include <algorithm>
 #include <cstdint>
 #include <q/support/base.hpp>
+#include <q/detail/init_store.hpp>
+#include <infra/assert.hpp>
 
 namespace cycfi::q
 {
@@ -20,20 +23,26 @@ namespace cycfi::q
    // stored in a std::vector with a size that is fixed at construction time,
    // given the number of bits required.
    //
+   // Alternatively, the Storage can be a std::array, holding the maximum
+   // number of integers, for a bitset that does not allocate. The number of
+   // bits required, given at construction time, can be less than that
+   // maximum. See static_bitset below.
+   //
    // Member functions are provided for:
    //
    //    1. Setting individual bits and ranges of bits
    //    2. Geting each bit at position i
    //    3. Clearing all bits
-   //    4. Getting the actual integers that stores the bits.
+   //    4. Shifting all bits towards position 0
+   //    5. Getting the actual integers that stores the bits.
    ////////////////////////////////////////////////////////////////////////////
-   template <typename T = natural_uint>
+   template <typename T = natural_uint, typename Storage = std::vector<T>>
    class bitset
    {
    public:
 
       using value_type = T;
-      using vector_type = std::vector<T>;
+      using storage_type = Storage;
 
       static_assert(std::is_unsigned<T>::value, "T must be unsigned");
       static constexpr auto value_size = CHAR_BIT * sizeof(T);
@@ -48,6 +57,7 @@ namespace cycfi::q
 
       std::size_t    size() const;
       void           clear();
+      void           shift(std::size_t n);
       void           set(std::size_t i, bool val);
       void           set(std::size_t i, std::size_t n, bool val);
       bool           get(std::size_t i) const;
@@ -57,45 +67,102 @@ namespace cycfi::q
 
    private:
 
-      vector_type    _bits;
+      storage_type   _bits;
+      std::size_t    _size;
    };
 
+   namespace detail
+   {
+      template <typename T>
+      constexpr std::size_t bitset_array_size(std::size_t num_bits)
+      {
+         constexpr auto value_size = CHAR_BIT * sizeof(T);
+         return (num_bits + value_size - 1) / value_size;
+      }
+   }
+
+   ////////////////////////////////////////////////////////////////////////////
+   // static_bitset: A bitset that can hold up to max_bits, with std::array
+   // storage.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t max_bits, typename T = natural_uint>
+   using static_bitset =
+      bitset<T, std::array<T, detail::bitset_array_size<T>(max_bits)>>;
+
    ////////////////////////////////////////////////////////////////////////////
    // Implementation
    ////////////////////////////////////////////////////////////////////////////
-   template <typename T>
-   inline bitset<T>::bitset(std::size_t num_bits)
+   template <typename T, typename Storage>
+   inline bitset<T, Storage>::bitset(std::size_t num_bits)
+    : _size(detail::bitset_array_size<T>(num_bits))
+   {
+      if constexpr (detail::resizable_container<Storage>::value)
+      {
+         _bits.resize(_size, 0);
+      }
+      else
+      {
+         CYCFI_ASSERT(_size <= _bits.size(), "Too many bits for the Storage.");
+         clear();
+      }
+   }
+
+   template <typename T, typename Storage>
+   inline std::size_t bitset<T, Storage>::size() const
    {
-      auto array_size = (num_bits + value_size - 1) / value_size;
-      _bits.resize(array_size, 0);
+      return _size * value_size;
    }
 
-   template <typename T>
-   inline std::size_t bitset<T>::size() const
+   template <typename T, typename Storage>
+   inline void bitset<T, Storage>::clear()
    {
-      return _bits.size() * value_size;
+      std::fill(_bits.begin(), _bits.begin() + _size, 0);
    }
 
-   template <typename T>
-   inline void bitset<T>::clear()
+   // Shift all bits by n towards position 0 (the bit at position i+n is moved
+   // to position i). The n topmost bits are cleared.
+   template <typename T, typename Storage>
+   inline void bitset<T, Storage>::shift(std::size_t n)
    {
-      std::fill(_bits.begin(), _bits.end(), 0);
+      auto const array_size = _size;
+      auto const index = n / value_size;
+      if (index >= array_size)
+      {
+         clear();
+         return;
+      }
+
+      auto* p = _bits.data();
+      auto const last = array_size - index;
+      auto const shift = n % value_size;
+      if (shift == 0)
+      {
+         std::copy(p + index, p + array_size, p);
+      }
+      else
+      {
+         auto const shift2 = value_size - shift;
+         for (std::size_t i = 0; i != last - 1; ++i)
+            p[i] = (p[i + index] >> shift) | (p[i + index + 1] << shift2);
+         p[last - 1] = p[array_size - 1] >> shift;
+      }
+      std::fill(p + last, p + array_size, 0);
    }
 
-   template <typename T>
-   inline void bitset<T>::set(std::size_t i, bool val)
+   template <typename T, typename Storage>
+   inline void bitset<T, Storage>::set(std::size_t i, bool val)
    {
       // Check that we don't get past the storage
       if (i > size())
          return;
 
-      auto mask = 1 << (i % value_size);
+      auto mask = one << (i % value_size);
       auto& ref = _bits[i / value_size];
       ref ^= (-T(val) ^ ref) & mask;
    }
 
-   template <typename T>
-   inline bool bitset<T>::get(std::size_t i) const
+   template <typename T, typename Storage>
+   inline bool bitset<T, Storage>::get(std::size_t i) const
    {
       // Check we don't get past the storage
       if (i > size())
@@ -105,8 +172,8 @@ namespace cycfi::q
       return (_bits[i / value_size] & mask) != 0;
    }
 
-   template <typename T>
-   inline void bitset<T>::set(std::size_t i, std::size_t n, bool val)
+   template <typename T, typename Storage>
+   inline void bitset<T, Storage>::set(std::size_t i, std::size_t n, bool val)
    {
       // Check that the index (i) does not get past size
       auto size_ = size();
@@ -177,14 +244,14 @@ namespace cycfi::q
       }
    }
 
-   template <typename T>
-   inline T* bitset<T>::data()
+   template <typename T, typename Storage>
+   inline T* bitset<T, Storage>::data()
    {
       return _bits.data();
    }
 
-   template <typename T>
-   inline T const* bitset<T>::data() const
+   template <typename T, typename Storage>
+   inline T const* bitset<T, Storage>::data() const
    {
       return _bits.data();
    }
@@ -7,7 +7,7 @@
 #define CYCFI_Q_AUTO_CORRELATOR_HPP_MARCH_12_2018
 
 #include <q/utility/bitset.hpp>
-#include <q/detail/count_bits.hpp>
+#include <q/detail/xor_count_bits.hpp>
 #include <q/support/base.hpp>
 
 namespace cycfi::q
@@ -37,15 +37,21 @@ namespace cycfi::q
    // After XOR, the number of bits (set to 1) is counted. The lower the
    // count, the higher the periodicity. A count of zero gives perfect
    // correlation: there is no mismatch.
+   //
+   // The XOR and bit count is done by detail::xor_count_bits, which selects
+   // a vectorized kernel (AVX-512 VPOPCNTDQ, AVX2 or POPCNT), supported by
+   // the CPU, at runtime. See xor_count_bits.hpp.
    ////////////////////////////////////////////////////////////////////////////
    template <typename T = natural_uint>
    struct bitstream_acf
    {
-      static constexpr auto value_size = bitset<>::value_size;
+      static constexpr auto value_size = bitset<T>::value_size;
 
-      bitstream_acf(bitset<T> const& bits)
-         : _bits(bits)
-         , _mid_array(std::max<std::size_t>(((bits.size() / value_size) / 2) - 1, 1))
+      template <typename Storage>
+      bitstream_acf(bitset<T, Storage> const& bits)
+         : _data(bits.data())
+         , _size(bits.size())
+         , _mid_array(std::max<std::size_t>(((_size / value_size) / 2) - 1, 1))
       {}
 
       std::size_t operator()(std::size_t pos) const
@@ -53,29 +59,46 @@ namespace cycfi::q
          auto const index = pos / value_size;
          auto const shift = pos % value_size;
 
-         auto const* p1 = _bits.data();
-         auto const* p2 = _bits.data() + index;
-         auto count = 0;
+         auto const* p1 = _data;
+         auto const* p2 = _data + index;
+         return detail::xor_count_bits(p1, p2, _mid_array, shift);
+      };
 
-         if (shift == 0)
-         {
-            for (auto i = 0; i != _mid_array; ++i)
-               count += detail::count_bits(*p1++ ^ *p2++);
-         }
-         else
+      // Correlate for all positions in [first, last) in one sweep, where
+      // last <= (size/2)+1. The results are written to out[0..(last-first)).
+      // Positions that share the same integer offset (pos / value_size)
+      // are processed together as a block, loading each integer only once
+      // for all the shifts in the block.
+      void operator()(std::size_t first, std::size_t last, std::size_t* out) const
+      {
+         std::size_t block[value_size];
+         auto const* p1 = _data;
+         auto const array_size = _size / value_size;
+         for (auto pos = first; pos < last;)
          {
-            auto shift2 = value_size - shift;
-            for (auto i = 0; i != _mid_array; ++i)
+            auto const index = pos / value_size;
+            auto const shift = pos % value_size;
+            auto const n = std::min<std::size_t>(value_size - shift, last - pos);
+
+            // The block needs one more integer past the end of the array
+            // (see detail::xor_count_bits_block). Correlate the positions
+            // one at a time if we don't have that.
+            if (index + _mid_array >= array_size)
+            {
+               for (auto i = pos; i != pos + n; ++i)
+                  *out++ = (*this)(i);
+            }
+            else
             {
-               auto v = *p2++ >> shift;
-               v |= *p2 << shift2;
-               count += detail::count_bits(*p1++ ^ v);
+               detail::xor_count_bits_block(p1, p1 + index, _mid_array, block);
+               out = std::copy(block + shift, block + shift + n, out);
             }
+            pos += n;
          }
-         return count;
-      };
+      }
 
-      bitset<T> const&     _bits;
+      T const* const       _data;
+      std::size_t const    _size;
       std::size_t const    _mid_array;
    };
 }
@@ -0,0 +1,220 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#if !defined(CYCFI_Q_WORKER_POOL_HPP_OCTOBER_17_2020)
+#define CYCFI_Q_WORKER_POOL_HPP_OCTOBER_17_2020
+
+#include <q/support/base.hpp>
+#include <infra/assert.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+# include <immintrin.h>
+#endif
+
+namespace cycfi::q
+{
+   ////////////////////////////////////////////////////////////////////////////
+   // worker_pool is a small, fixed pool of threads for fanning out
+   // independent jobs from a real-time thread.
+   //
+   // run(count, f) calls f(i) for each i in [0, count) and returns when all
+   // the calls are done. count should be less than max_jobs. The calling
+   // thread takes part in the work, claiming jobs the same way as the
+   // workers do, so run never waits for a worker that is not already
+   // executing one of the jobs.
+   //
+   // run does not allocate, but it is not strictly wait free. If some
+   // workers are sleeping, run locks the mutex to notify them, which may
+   // make a system call (e.g. a futex wake). The workers hold the mutex
+   // only briefly, to check for work before they sleep. run also spins
+   // until the jobs already claimed by the workers are done, which takes
+   // longer if a worker is preempted in the middle of a job. The threads
+   // are created by the constructor and joined by the destructor, both of
+   // which should be called outside the real-time thread.
+   //
+   // After a job, the workers spin for a short while (spin_count pauses),
+   // in case run is called again right away, then sleep until the next
+   // run. Idle workers do not use the CPU.
+   ////////////////////////////////////////////////////////////////////////////
+   class worker_pool
+   {
+   public:
+
+      static constexpr auto spin_count = 4096;
+      static constexpr std::size_t max_jobs = 1 << 20;
+
+      explicit                worker_pool(std::size_t num_threads);
+                              worker_pool(worker_pool const&) = delete;
+                              ~worker_pool();
+
+      worker_pool&            operator=(worker_pool const&) = delete;
+
+      std::size_t             size() const { return _threads.size(); }
+
+                              template <typename F>
+      void                    run(std::size_t count, F&& f);
+
+   private:
+
+      using job_function = void(*)(void* context, std::size_t index);
+
+      // All the information needed to claim a job is packed in a single
+      // word: the generation (incremented on each run), the job count and
+      // the index of the next job to claim.
+      using work_type = std::uint64_t;
+
+      static work_type        make_work(std::uint32_t gen, std::size_t count, std::size_t index);
+      static std::uint32_t    generation(work_type work) { return work >> 40; }
+      static std::size_t      count(work_type work) { return (work >> 20) & (max_jobs-1); }
+      static std::size_t      index(work_type work) { return work & (max_jobs-1); }
+      static void             pause();
+
+      void                    worker();
+      void                    execute(std::uint32_t gen);
+
+      std::vector<std::thread>   _threads;
+      std::atomic<work_type>     _work{ 0 };
+      job_function               _function = nullptr;
+      void*                      _context = nullptr;
+      std::atomic<std::size_t>   _done{ 0 };
+      std::atomic<bool>          _stop{ false };
+      std::atomic<std::size_t>   _sleepers{ 0 };
+      std::mutex                 _mutex;
+      std::condition_variable    _cv;
+   };
+
+   ////////////////////////////////////////////////////////////////////////////
+   // Implementation
+   ////////////////////////////////////////////////////////////////////////////
+   inline worker_pool::worker_pool(std::size_t num_threads)
+   {
+      _threads.reserve(num_threads);
+      for (std::size_t i = 0; i != num_threads; ++i)
+         _threads.emplace_back([this]{ worker(); });
+   }
+
+   inline worker_pool::~worker_pool()
+   {
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         _stop = true;
+      }
+      _cv.notify_all();
+      for (auto& t : _threads)
+         t.join();
+   }
+
+   inline worker_pool::work_type
+   worker_pool::make_work(std::uint32_t gen, std::size_t count, std::size_t index)
+   {
+      return (work_type(gen & 0xffffff) << 40) | (work_type(count) << 20) | index;
+   }
+
+   inline void worker_pool::pause()
+   {
+#if defined(__x86_64__) || defined(_M_X64)
+      _mm_pause();
+#endif
+   }
+
+   template <typename F>
+   inline void worker_pool::run(std::size_t count, F&& f)
+   {
+      CYCFI_ASSERT(count < max_jobs, "Too many jobs.");
+      if (count == 0)
+         return;
+
+      using function_type = std::remove_reference_t<F>;
+      auto const gen = generation(_work.load(std::memory_order_relaxed)) + 1;
+
+      // No worker can be executing a job at this point, so we can safely
+      // set up the new jobs before publishing them.
+      _function =
+         [](void* context, std::size_t i)
+         {
+            (*static_cast<function_type*>(context))(i);
+         };
+      _context = const_cast<void*>(static_cast<void const*>(&f));
+      _done.store(0, std::memory_order_relaxed);
+
+      // A worker going to sleep registers in _sleepers before it checks
+      // for work (see worker). Either it sees the new work, or we see it
+      // registered and notify it with the mutex held, after it either
+      // checked for work or started waiting.
+      _work.store(make_work(gen, count, 0));
+      if (_sleepers.load() != 0)
+      {
+         std::lock_guard<std::mutex> lock(_mutex);
+         _cv.notify_all();
+      }
+
+      execute(gen);
+      while (_done.load(std::memory_order_acquire) != count)
+         pause();
+   }
+
+   inline void worker_pool::execute(std::uint32_t gen)
+   {
+      auto work = _work.load(std::memory_order_acquire);
+      while (generation(work) == (gen & 0xffffff) && index(work) < count(work))
+      {
+         // A claimed job can't be completed before we are done with it, so
+         // _function and _context are stable after a successful claim.
+         if (_work.compare_exchange_weak(work, work + 1, std::memory_order_acq_rel))
+         {
+            _function(_context, index(work));
+            _done.fetch_add(1, std::memory_order_release);
+            work = _work.load(std::memory_order_acquire);
+         }
+      }
+   }
+
+   inline void worker_pool::worker()
+   {
+      auto seen = generation(_work.load(std::memory_order_acquire));
+      bool spin = false;
+      while (!_stop)
+      {
+         auto gen = generation(_work.load(std::memory_order_acquire));
+         if (gen != seen)
+         {
+            seen = gen;
+            execute(gen);
+            spin = true;
+            continue;
+         }
+
+         // Spin for a short while after a job only
+         if (spin)
+         {
+            spin = false;
+            for (auto i = 0; i != spin_count; ++i)
+            {
+               pause();
+               if (generation(_work.load(std::memory_order_relaxed)) != seen)
+                  break;
+            }
+            continue;
+         }
+
+         // Sleep until the next run (see run)
+         _sleepers.fetch_add(1);
+         {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cv.wait(lock, [&]{ return _stop || generation(_work.load()) != seen; });
+         }
+         _sleepers.fetch_sub(1, std::memory_order_relaxed);
+      }
+   }
+}
+
+#endif
@@ -8,24 +8,60 @@
 
 #include <q/support/base.hpp>
 #include <q/utility/bitset.hpp>
-#include <q/utility/ring_buffer.hpp>
 #include <q/support/decibel.hpp>
+#include <q/detail/count_bits.hpp>
+#include <q/detail/simd.hpp>
 #include <infra/assert.hpp>
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 namespace cycfi::q
 {
+   namespace detail
+   {
+      // The window size, in number of bitset integers
+      constexpr std::size_t adjust_window_size(std::size_t window)
+      {
+         constexpr auto bits = bitset<>::value_size;
+         return std::max<std::size_t>(2, (window + bits - 1) / bits);
+      }
+
+      // The number of edges that can be held, given the window size
+      constexpr std::size_t zero_crossing_capacity(std::size_t window)
+      {
+         return smallest_pow2(adjust_window_size(window) * bitset<>::value_size / 2);
+      }
+   }
+
    ////////////////////////////////////////////////////////////////////////////
    // The zero_crossing class saves zero-crossing information necessary to
    // extract accurate timing information such as periods between pulses for
    // performing analysis such as bitstream autocorrelation.
    //
-   // Each zero crossing pulse is saved in a ring buffer of info elements.
-   // Data include the maximum height of the waveform bounded by the pulse,
-   // the pulse width, as well as the leading edge and trailing edge frame
-   // positions (number of samples from the start) and y coordinates (the
-   // sample values before and after each zero crossing) of the zero
-   // crossings.
+   // Data about each zero crossing pulse include the maximum height of the
+   // waveform bounded by the pulse, the pulse width, as well as the leading
+   // edge and trailing edge frame positions (number of samples from the
+   // start) and y coordinates (the sample values before and after each zero
+   // crossing) of the zero crossings.
+   //
+   // The data are stored in separate arrays, one for each field (structure
+   // of arrays), so that scans that need only one or two fields, such as
+   // the peaks and the leading edges, touch only those. The index operator
+   // returns an info: a reference to the fields of one pulse. peaks(),
+   // leading_edges() and trailing_edges() give direct access to the
+   // arrays, num_edges() elements each, in the same order as the index
+   // operator.
+   //
+   // find_similar(index) returns the index of the latest edge before the
+   // given edge that is similar to it (see info::similar), or -1 if there
+   // is none. The few edges right before the given edge are tested first.
+   // Beyond those, the completed pulses are indexed (bucketed) by their
+   // quantized peaks and widths, so that only the edges in the neighboring
+   // buckets have to be tested for similarity.
    //
    // Only the latest few (finite amount) of zero crossing information is
    // saved, given by the window constructor parameter. The window is the
@@ -35,15 +71,20 @@ namespace cycfi::q
    // Each call to the function operator, given a sample s, returns the
    // zero-crossing state (bool). is_ready() returns true when we have
    // sufficient info to perform analysis. is_ready() returns true after
-   // every window/2 frames. Information about each zero crossing can be
+   // every hop frames. Information about each zero crossing can be
    // obtained using the index operator[]. The leftmost edge (oldest) is at
    // the 0th index while the rightmost edge (latest) is at index
    // num_edges()-1.
    //
-   // After window/2 frames, the leading edge and trailing edge frame
-   // positions are shifted by -window/2 such that an edge at frame index N
-   // will be shifted to N-window/2. For example, if the window size is 100
-   // and the leading edge is at frame 45, it will be shifted to -5 (45-50).
+   // The hop constructor parameter is the number of frames between
+   // analyses. The default (0) is window/2. Smaller hops give overlapping
+   // windows, and more frequent analyses (lower latency). The hop is
+   // limited to window/2.
+   //
+   // After hop frames, the leading edge and trailing edge frame positions
+   // are shifted by -hop such that an edge at frame index N will be shifted
+   // to N-hop. For example, if the window size is 100, the hop is 50 and
+   // the leading edge is at frame 45, it will be shifted to -5 (45-50).
    //
    // This procedure is done to ensure seamless operation from one window to
    // the next. In the example above, frame index -5 is already past the left
@@ -52,67 +93,213 @@ namespace cycfi::q
    // latest edge to have a trailing edge that goes past the right side of
    // the window. If for example, with the same window size 100, there can be
    // an edge with a leading edge at 95 and trailing edge at 120.
+   //
+   // is_continuous() returns true if the current window is the previous
+   // window shifted by hop, with no reset in between. Clients can use this
+   // to reuse the analysis of the overlapping part of the window. The
+   // zero_crossing restarts itself when there are no more edges in the
+   // window, dropping the edges but keeping the running peaks. Clients can
+   // also call reset() to drop all the edges and the peaks, e.g. when the
+   // input is gated, which may leave a pulse open indefinitely. After a
+   // reset, the zero_crossing starts like a new one.
+   //
+   // The block function operator, given a pointer to n samples, processes
+   // the samples until the zero-crossing state changes, or until the
+   // zero_crossing becomes ready or is reset, and returns the number of
+   // samples consumed. This is equivalent to calling the function operator
+   // for each of the consumed samples, but the stretches between pulses,
+   // where nothing happens except time passing, are skipped using a
+   // vectorized threshold scan.
+   //
+   // Given a non-zero max_window, the pulse data are stored in
+   // std::arrays holding enough elements for windows of up to max_window
+   // frames, so that the zero_crossing does not allocate. The window
+   // constructor parameter must not exceed max_window. Otherwise, the
+   // storage is allocated at construction time, given the window. The
+   // zero_crossing type alias is the latter.
    ////////////////////////////////////////////////////////////////////////////
-   class zero_crossing
+   template <std::size_t max_window = 0>
+   class basic_zero_crossing
    {
    public:
 
       static constexpr float pulse_height_diff = 0.8;
       static constexpr float pulse_width_diff = 0.85;
       static constexpr auto undefined_edge = int_min<int>();
+      static constexpr std::size_t num_buckets = 256;
 
-      struct info
+      // The sample values before and after the zero crossing. This is not
+      // a std::pair, to keep the zero_crossing trivially copyable.
+      struct crossing_data
       {
-         using crossing_data = std::pair<float, float>;
-
-         void              update_peak(float s, std::size_t frame);
-         std::size_t       period(info const& next) const;
-         float             fractional_period(info const& next) const;
-         int               width() const;
-         bool              similar(info const& next) const;
-
-         crossing_data     _crossing;
-         float             _peak;
-         int               _leading_edge = undefined_edge;
-         int               _trailing_edge = undefined_edge;
-         float             _width = 0.0f;
+         float             first;
+         float             second;
       };
 
-                           zero_crossing(decibel hysteresis, std::size_t window);
-                           zero_crossing(zero_crossing const& rhs) = default;
-                           zero_crossing(zero_crossing&& rhs) = default;
+      template <bool is_const>
+      struct basic_info
+      {
+         template <typename T>
+         using ref = std::conditional_t<is_const, T const&, T&>;
+
+         void              update_peak(float s, std::size_t frame) const;
+                           template <bool is_const_>
+         std::size_t       period(basic_info<is_const_> const& next) const;
+                           template <bool is_const_>
+         float             fractional_period(basic_info<is_const_> const& next) const;
+                           template <bool is_const_>
+         bool              similar(basic_info<is_const_> const& next) const;
+
+         ref<crossing_data> _crossing;
+         ref<float>        _peak;
+         ref<int>          _leading_edge;
+         ref<int>          _trailing_edge;
+         ref<float>        _width;
+      };
+
+      using info = basic_info<false>;
+      using const_info = basic_info<true>;
+
+                           basic_zero_crossing(
+                              decibel hysteresis
+                            , std::size_t window
+                            , std::size_t hop = 0
+                           );
+                           basic_zero_crossing(basic_zero_crossing const& rhs) = default;
+                           basic_zero_crossing(basic_zero_crossing&& rhs) = default;
 
       std::size_t          num_edges() const;
       std::size_t          capacity() const;
       std::size_t          frame() const;
       std::size_t          window_size() const;
+      std::size_t          hop_size() const;
       bool                 is_ready() const;
       float                peak_pulse() const;
       bool                 is_reset() const;
+      bool                 is_continuous() const;
+      void                 reset();
 
       bool                 operator()(float s);
+      std::size_t          operator()(float const* in, std::size_t n);
       bool                 operator()() const;
-      info const&          operator[](std::size_t index) const;
-      info&                operator[](std::size_t index);
+      const_info           operator[](std::size_t index) const;
+      info                 operator[](std::size_t index);
+      int                  find_similar(std::size_t index) const;
+
+      float const*         peaks() const;
+      int const*           leading_edges() const;
+      int const*           trailing_edges() const;
 
    private:
 
+      void                 restart();
       void                 update_state(float s);
+      void                 push(float s);
+      void                 update_index() const;
       void                 shift(std::size_t n);
-      void                 reset();
 
-      using info_storage = ring_buffer<info>;
+      template <typename T>
+      using storage = std::conditional_t<
+         max_window == 0
+       , std::vector<T>
+       , std::array<T, detail::zero_crossing_capacity(max_window)>
+      >;
 
       float                _prev = 0.0f;
       float const          _hysteresis;
       bool                 _state = false;
       std::size_t          _num_edges = 0;
       std::size_t const    _window_size;
-      info_storage         _info;
+      std::size_t const    _hop_size;
+      std::size_t const    _capacity;
+
+      // The pulse data. The edges are stored at [_first, _first+_num_edges).
+      std::size_t          _first = 0;
+      storage<crossing_data> _crossings;
+      storage<float>       _peaks;
+      storage<int>         _leading_edges;
+      storage<int>         _trailing_edges;
+      storage<float>       _widths;
+
+      // The similarity index. Each edge is given an id, in order,
+      // starting from 1. The id of the edge at position i of the arrays
+      // is _id_base + i. Each bucket holds the id of the latest edge in
+      // the bucket, and each edge links to the previous edge in its
+      // bucket. The ids of the edges that are no longer held (including 0)
+      // mark the end of the list. The completed pulses are indexed only
+      // when needed (see update_index), starting from the id _indexed.
+      std::size_t          _id_base = 1;
+      mutable std::size_t  _indexed = 1;
+      mutable storage<std::size_t> _links;
+
       std::size_t          _frame = 0;
       bool                 _ready = false;
+      bool                 _continuous = false;
       float                _peak_update = 0.0f;
       float                _peak = 0.0f;
+
+      // The heads of the similarity index lists (see _links)
+      mutable std::array<std::size_t, num_buckets> _buckets = {};
+   };
+
+   using zero_crossing = basic_zero_crossing<>;
+
+   ////////////////////////////////////////////////////////////////////////////
+   // A zero_crossing_snapshot holds a copy of the pulses of a zero_crossing
+   // window, taken when the zero_crossing is ready, so that the window can
+   // still be analyzed after the zero_crossing has moved on (see
+   // period_detector::lazy_analysis). It provides the read-only part of the
+   // zero_crossing interface used for the analysis. Only the edges held by
+   // the zero_crossing are copied.
+   //
+   // Given a non-zero max_window, the snapshot does not allocate (see
+   // basic_zero_crossing). Otherwise, the storage for capacity edges is
+   // allocated at construction time.
+   ////////////////////////////////////////////////////////////////////////////
+   template <std::size_t max_window = 0>
+   class basic_zero_crossing_snapshot
+   {
+   public:
+
+      using zero_crossing_type = basic_zero_crossing<max_window>;
+      using crossing_data = typename zero_crossing_type::crossing_data;
+      using const_info = typename zero_crossing_type::const_info;
+
+                           basic_zero_crossing_snapshot(std::size_t capacity = 0);
+
+      void                 assign(zero_crossing_type const& zc);
+
+      std::size_t          num_edges() const       { return _num_edges; }
+      std::size_t          window_size() const     { return _window_size; }
+      std::size_t          hop_size() const        { return _hop_size; }
+      float                peak_pulse() const      { return _peak_pulse; }
+      bool                 is_continuous() const   { return _continuous; }
+
+      const_info           operator[](std::size_t index) const;
+      float const*         peaks() const           { return _peaks.data(); }
+      int const*           leading_edges() const   { return _leading_edges.data(); }
+      int const*           trailing_edges() const  { return _trailing_edges.data(); }
+
+   private:
+
+      template <typename T>
+      using storage = std::conditional_t<
+         max_window == 0
+       , std::vector<T>
+       , std::array<T, detail::zero_crossing_capacity(max_window)>
+      >;
+
+      std::size_t          _num_edges = 0;
+      std::size_t          _window_size = 0;
+      std::size_t          _hop_size = 0;
+      float                _peak_pulse = 0.0f;
+      bool                 _continuous = false;
+
+      storage<crossing_data> _crossings = {};
+      storage<float>       _peaks = {};
+      storage<int>         _leading_edges = {};
+      storage<int>         _trailing_edges = {};
+      storage<float>       _widths = {};
    };
 
    ////////////////////////////////////////////////////////////////////////////
@@ -120,39 +307,262 @@ namespace cycfi::q
    ////////////////////////////////////////////////////////////////////////////
    namespace detail
    {
-      inline std::size_t adjust_window_size(std::size_t window)
+      // State updated while inside a pulse (see zero_crossing::update_state
+      // and zero_crossing::info::update_peak).
+      struct pulse_state
       {
-         constexpr auto bits = bitset<>::value_size;
-         return std::max<std::size_t>(2, (window + bits - 1) / bits);
+         float             peak;
+         float             width;
+         float             peak_update;
+         float             prev;
+         std::size_t       frame;
+         int               leading_edge;
+      };
+
+      inline bool scan_pulse(float s, float hysteresis, pulse_state& p)
+      {
+         if (s < hysteresis)
+            return false;
+         if (s > 0.0f)
+         {
+            p.peak = std::max(s, p.peak);
+            if ((p.width == 0.0f) && (s < (p.peak * 0.3)))
+               p.width = p.frame - p.leading_edge;
+            p.peak_update = std::max(s, p.peak_update);
+         }
+         p.prev = s;
+         ++p.frame;
+         return true;
+      }
+
+      // Process the samples inside a pulse, up to the falling edge. Returns
+      // the number of samples processed. p.peak is never zero inside a
+      // pulse, so the non-positive samples can be ignored when updating the
+      // peaks.
+      inline std::size_t scan_pulse(
+         float const* in, std::size_t n, float offset, float hysteresis
+       , pulse_state& p)
+      {
+         std::size_t i = 0;
+#if defined(CYCFI_Q_X86_SIMD)
+         if (n >= 4)
+         {
+            auto const offset_ = _mm_set1_ps(offset);
+            auto const hysteresis_ = _mm_set1_ps(hysteresis);
+            auto const zero = _mm_setzero_ps();
+            auto const filter = _mm_set1_ps(0.3001f);
+            auto peak = _mm_set1_ps(p.peak);
+            auto peak_update = _mm_set1_ps(p.peak_update);
+            auto last = _mm_set1_ps(p.prev);
+            auto width = p.width;
+            auto frame = p.frame;
+
+            auto max4 = [](__m128 x)
+            {
+               x = _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 3, 0, 1)));
+               return _mm_max_ps(x, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 0, 3, 2)));
+            };
+
+            // While the width is not known, we need the running maximum
+            for (; width == 0.0f && i + 4 <= n; i += 4, frame += 4)
+            {
+               auto s = _mm_add_ps(_mm_loadu_ps(in + i), offset_);
+               if (_mm_movemask_ps(_mm_cmplt_ps(s, hysteresis_)))
+                  break;
+
+               auto pos = _mm_and_ps(s, _mm_cmpgt_ps(s, zero));
+               auto max = _mm_max_ps(pos, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(pos), 4)));
+               max = _mm_max_ps(max, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(max), 8)));
+               max = _mm_max_ps(max, peak);
+
+               // Candidates for s < peak * 0.3. The exact test is done in
+               // double precision, like info::update_peak.
+               auto mask = _mm_movemask_ps(
+                  _mm_and_ps(_mm_cmplt_ps(s, _mm_mul_ps(max, filter)), _mm_cmpgt_ps(s, zero)));
+               if (mask)
+               {
+                  alignas(16) float s_[4], max_[4];
+                  _mm_store_ps(s_, s);
+                  _mm_store_ps(max_, max);
+                  for (auto j = 0; j != 4; ++j)
+                  {
+                     if ((mask & (1 << j)) && (s_[j] < (max_[j] * 0.3)))
+                     {
+                        width = (frame + j) - p.leading_edge;
+                        break;
+                     }
+                  }
+               }
+
+               peak = _mm_shuffle_ps(max, max, _MM_SHUFFLE(3, 3, 3, 3));
+               peak_update = _mm_max_ps(pos, peak_update);
+               last = s;
+            }
+
+            // After that, we only need the maximum
+            for (; i + 4 <= n; i += 4, frame += 4)
+            {
+               auto s = _mm_add_ps(_mm_loadu_ps(in + i), offset_);
+               if (_mm_movemask_ps(_mm_cmplt_ps(s, hysteresis_)))
+                  break;
+
+               auto pos = _mm_and_ps(s, _mm_cmpgt_ps(s, zero));
+               peak = _mm_max_ps(pos, peak);
+               peak_update = _mm_max_ps(pos, peak_update);
+               last = s;
+            }
+
+            p.peak = _mm_cvtss_f32(max4(peak));
+            p.peak_update = _mm_cvtss_f32(max4(peak_update));
+            p.prev = _mm_cvtss_f32(_mm_shuffle_ps(last, last, _MM_SHUFFLE(3, 3, 3, 3)));
+            p.width = width;
+            p.frame = frame;
+         }
+#endif
+         for (; i != n; ++i)
+            if (!scan_pulse(in[i] + offset, hysteresis, p))
+               break;
+         return i;
+      }
+
+      // Returns the number of leading samples in [in, in+n) where
+      // in[i] + offset is not above zero.
+      inline std::size_t count_not_above(float const* in, std::size_t n, float offset)
+      {
+         std::size_t i = 0;
+#if defined(CYCFI_Q_X86_SIMD)
+         auto const offset_ = _mm_set1_ps(offset);
+         auto const zero = _mm_setzero_ps();
+         for (; i + 8 <= n; i += 8)
+         {
+            auto a = _mm_add_ps(_mm_loadu_ps(in + i), offset_);
+            auto b = _mm_add_ps(_mm_loadu_ps(in + i + 4), offset_);
+            auto mask = std::uint32_t(
+               _mm_movemask_ps(_mm_cmpgt_ps(a, zero))
+             | (_mm_movemask_ps(_mm_cmpgt_ps(b, zero)) << 4)
+            );
+            if (mask)
+               return i + count_trailing_zeros(mask);
+         }
+#endif
+         for (; i != n; ++i)
+            if (in[i] + offset > 0.0f)
+               break;
+         return i;
+      }
+
+      // Saves the indices of the elements in [in, in+n) that are greater
+      // than or equal to threshold to out, in order. Returns the number of
+      // indices saved.
+      inline std::size_t select_at_least(
+         float const* in, std::size_t n, float threshold, int* out)
+      {
+         std::size_t count = 0;
+         std::size_t i = 0;
+#if defined(CYCFI_Q_X86_SIMD)
+         auto const threshold_ = _mm_set1_ps(threshold);
+         for (; i + 4 <= n; i += 4)
+         {
+            auto mask = std::uint32_t(
+               _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(in + i), threshold_)));
+            for (; mask; mask &= mask - 1)
+               out[count++] = i + count_trailing_zeros(mask);
+         }
+#endif
+         for (; i != n; ++i)
+            if (in[i] >= threshold)
+               out[count++] = i;
+         return count;
+      }
+
+      // Quantized peaks and widths for the similarity index. Similar
+      // pulses are at most one step apart: the steps (1/2 octave) are
+      // larger than the maximum log2 ratio of similar peaks (0.32) and
+      // widths (0.23), even with fast_log2, which can magnify log2 ratios
+      // by up to ln(2)*2 (1.39) times. Zero widths (unknown) are all in one
+      // step, far from the others.
+      inline int quantize_similar(float x)
+      {
+         return std::floor(fast_log2(x) * 2);
+      }
+
+      inline std::size_t similar_bucket(int peak, int width, std::size_t num_buckets)
+      {
+         return std::size_t(peak * 31 + width) & (num_buckets - 1);
       }
    }
 
-   inline zero_crossing::zero_crossing(decibel hysteresis, std::size_t window)
+   template <std::size_t max_window>
+   inline basic_zero_crossing<max_window>::basic_zero_crossing(
+      decibel hysteresis
+    , std::size_t window
+    , std::size_t hop
+   )
     : _hysteresis(-float(hysteresis))
     , _window_size(detail::adjust_window_size(window) * bitset<>::value_size)
-    , _info(_window_size / 2)
-   {}
+    , _hop_size(
+         (hop == 0 || hop > _window_size / 2)? _window_size / 2 : hop)
+    , _capacity(detail::zero_crossing_capacity(window))
+    , _crossings{}
+    , _peaks{}
+    , _leading_edges{}
+    , _trailing_edges{}
+    , _widths{}
+    , _links{}
+   {
+      if constexpr (max_window != 0)
+      {
+         if (_window_size > detail::adjust_window_size(max_window) * bitset<>::value_size)
+            throw std::runtime_error(
+               "Error: window > max_window."
+            );
+      }
+      else
+      {
+         _crossings.resize(_capacity);
+         _peaks.resize(_capacity);
+         _leading_edges.resize(_capacity);
+         _trailing_edges.resize(_capacity);
+         _widths.resize(_capacity);
+         _links.resize(_capacity);
+      }
+   }
 
-   inline void zero_crossing::info::update_peak(float s, std::size_t frame)
+   template <std::size_t max_window>
+   template <bool is_const>
+   inline void basic_zero_crossing<max_window>::basic_info<is_const>::update_peak(
+      float s, std::size_t frame) const
    {
       _peak = std::max(s, _peak);
       if ((_width == 0.0f) && (s < (_peak * 0.3)))
          _width = frame - _leading_edge;
    }
 
-   inline std::size_t zero_crossing::info::period(info const& next) const
+   template <std::size_t max_window>
+   template <bool is_const>
+   template <bool is_const_>
+   inline std::size_t basic_zero_crossing<max_window>::basic_info<is_const>::period(
+      basic_info<is_const_> const& next) const
    {
       CYCFI_ASSERT(_leading_edge <= next._leading_edge, "Invalid order.");
       return next._leading_edge - _leading_edge;
    }
 
-   inline bool zero_crossing::info::similar(info const& next) const
+   template <std::size_t max_window>
+   template <bool is_const>
+   template <bool is_const_>
+   inline bool basic_zero_crossing<max_window>::basic_info<is_const>::similar(
+      basic_info<is_const_> const& next) const
    {
       return rel_within(_peak, next._peak, 1.0f-pulse_height_diff) &&
          rel_within(_width, next._width, 1.0f-pulse_width_diff);
    }
 
-   inline float zero_crossing::info::fractional_period(info const& next) const
+   template <std::size_t max_window>
+   template <bool is_const>
+   template <bool is_const_>
+   inline float basic_zero_crossing<max_window>::basic_info<is_const>::fractional_period(
+      basic_info<is_const_> const& next) const
    {
       CYCFI_ASSERT(_leading_edge <= next._leading_edge, "Invalid order.");
 
@@ -173,73 +583,107 @@ namespace cycfi::q
       return result + (dx2 - dx1);
    }
 
-   inline std::size_t zero_crossing::num_edges() const
+   template <std::size_t max_window>
+   inline std::size_t basic_zero_crossing<max_window>::num_edges() const
    {
       return _num_edges;
    }
 
-   inline std::size_t zero_crossing::capacity() const
+   template <std::size_t max_window>
+   inline std::size_t basic_zero_crossing<max_window>::capacity() const
    {
-      return _info.size();
+      return _capacity;
    }
 
-   inline std::size_t zero_crossing::frame() const
+   template <std::size_t max_window>
+   inline std::size_t basic_zero_crossing<max_window>::frame() const
    {
       return _frame;
    }
 
-   inline std::size_t zero_crossing::window_size() const
+   template <std::size_t max_window>
+   inline std::size_t basic_zero_crossing<max_window>::window_size() const
    {
       return _window_size;
    }
 
-   inline void zero_crossing::reset()
+   template <std::size_t max_window>
+   inline std::size_t basic_zero_crossing<max_window>::hop_size() const
+   {
+      return _hop_size;
+   }
+
+   template <std::size_t max_window>
+   inline void basic_zero_crossing<max_window>::restart()
    {
+      // The new edges are stored after the old ones, so that they get new
+      // ids (see _id_base).
+      _first += _num_edges;
       _num_edges = 0;
       _state = false;
       _frame = 0;
+      _ready = false;
+      _continuous = false;
    }
 
-   inline bool zero_crossing::is_reset() const
+   template <std::size_t max_window>
+   inline void basic_zero_crossing<max_window>::reset()
+   {
+      restart();
+      _prev = 0.0f;
+      _peak = 0.0f;
+      _peak_update = 0.0f;
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_zero_crossing<max_window>::is_reset() const
    {
       return _frame == 0;
    }
 
-   inline bool zero_crossing::is_ready() const
+   template <std::size_t max_window>
+   inline bool basic_zero_crossing<max_window>::is_continuous() const
+   {
+      return _continuous;
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_zero_crossing<max_window>::is_ready() const
    {
       return _ready;
    }
 
-   inline float zero_crossing::peak_pulse() const
+   template <std::size_t max_window>
+   inline float basic_zero_crossing<max_window>::peak_pulse() const
    {
       return std::max(_peak, _peak_update);
    }
 
-   inline void zero_crossing::update_state(float s)
+   template <std::size_t max_window>
+   inline void basic_zero_crossing<max_window>::update_state(float s)
    {
       if (_ready)
       {
-         shift(_window_size / 2);
+         shift(_hop_size);
          _ready = false;
+         _continuous = !is_reset();
          _peak = _peak_update;
          _peak_update = 0.0f;
       }
 
       if (num_edges() >= capacity())
-         reset();
+         restart();
 
       if (s > 0.0f)
       {
          if (!_state)
          {
-            CYCFI_ASSERT(_num_edges < _info.size(), "Bad _size");
-            _info.push({ { _prev, s }, s, int(_frame) });
-            ++_num_edges;
+            push(s);
             _state = 1;
          }
          else
          {
-            _info[0].update_peak(s, _frame);
+            (*this)[_num_edges-1].update_peak(s, _frame);
          }
          if (s > _peak_update)
          {
@@ -249,8 +693,7 @@ namespace cycfi::q
       else if (_state && s < _hysteresis)
       {
          _state = 0;
-         auto& info = _info[0];
-         info._trailing_edge = _frame;
+         _trailing_edges[_first + _num_edges-1] = _frame;
          if (_peak == 0.0f)
             _peak = _peak_update;
       }
@@ -258,66 +701,309 @@ namespace cycfi::q
       _prev = s;
    }
 
-   inline bool zero_crossing::operator()(float s)
+   template <std::size_t max_window>
+   inline bool basic_zero_crossing<max_window>::operator()(float s)
    {
       // Offset s by half of hysteresis, so that zero cross detection is
       // centered on the actual zero.
       s += _hysteresis / 2;
 
       if (num_edges() >= capacity())
-         reset();
+         restart();
 
       if ((_frame == _window_size/2) && num_edges() == 0)
-         reset();
+         restart();
 
       update_state(s);
 
       if (++_frame >= _window_size && !_state)
       {
-         // Remove half the size from _frame, so we can continue seamlessly
-         _frame -= _window_size / 2;
+         // Remove the hop size from _frame, so we can continue seamlessly
+         _frame -= _hop_size;
 
          // We need at least two rising edges.
          if (num_edges() > 1)
             _ready = true;
          else
-            reset();
+            restart();
       }
 
       return _state;
    };
 
-   inline bool zero_crossing::operator()() const
+   template <std::size_t max_window>
+   inline std::size_t basic_zero_crossing<max_window>::operator()(float const* in, std::size_t n)
+   {
+      auto const offset = _hysteresis / 2;
+      std::size_t i = 0;
+      while (i != n)
+      {
+         // Between pulses, skip all samples that do not cross zero, as
+         // long as no window event (see operator()(float s)) can happen.
+         if (!_state && !_ready && num_edges() < capacity()
+            && (_frame + 1 < _window_size))
+         {
+            auto limit = _window_size - 1 - _frame;
+            if (num_edges() == 0 && _frame <= _window_size/2)
+               limit = _window_size/2 - _frame;
+            limit = std::min(limit, n - i);
+
+            if (auto skip = detail::count_not_above(in + i, limit, offset))
+            {
+               _prev = in[i + skip - 1] + offset;
+               _frame += skip;
+               i += skip;
+               continue;
+            }
+         }
+
+         // Inside a pulse, nothing happens until the falling edge, except
+         // for updating the peaks.
+         else if (_state && !_ready && num_edges() < capacity())
+         {
+            auto info = (*this)[_num_edges-1];
+            detail::pulse_state p{
+               info._peak, info._width, _peak_update, _prev, _frame, info._leading_edge
+            };
+
+            if (auto count = detail::scan_pulse(in + i, n - i, offset, _hysteresis, p))
+            {
+               info._peak = p.peak;
+               info._width = p.width;
+               _peak_update = p.peak_update;
+               _prev = p.prev;
+               _frame = p.frame;
+               i += count;
+               continue;
+            }
+         }
+
+         bool state = _state;
+         (*this)(in[i++]);
+         if (_state != state || _ready || is_reset())
+            break;
+      }
+      return i;
+   }
+
+   template <std::size_t max_window>
+   inline bool basic_zero_crossing<max_window>::operator()() const
    {
       return _state;
    }
 
-   inline zero_crossing::info const&
-   zero_crossing::operator[](std::size_t index) const
+   template <std::size_t max_window>
+   inline typename basic_zero_crossing<max_window>::const_info
+   basic_zero_crossing<max_window>::operator[](std::size_t index) const
+   {
+      auto i = _first + index;
+      return {
+         _crossings[i], _peaks[i], _leading_edges[i], _trailing_edges[i], _widths[i]
+      };
+   }
+
+   template <std::size_t max_window>
+   inline typename basic_zero_crossing<max_window>::info
+   basic_zero_crossing<max_window>::operator[](std::size_t index)
+   {
+      auto i = _first + index;
+      return {
+         _crossings[i], _peaks[i], _leading_edges[i], _trailing_edges[i], _widths[i]
+      };
+   }
+
+   template <std::size_t max_window>
+   inline void basic_zero_crossing<max_window>::update_index() const
+   {
+      // Index the completed pulses that are not yet indexed. The peak and
+      // width of a completed pulse will no longer change. The latest pulse
+      // is not complete while the state is true.
+      auto const end = _first + _num_edges - (_state? 1 : 0);
+      auto i = std::max(_indexed, _id_base + _first) - _id_base;
+      for (; i < end; ++i)
+      {
+         auto bucket = detail::similar_bucket(
+            detail::quantize_similar(_peaks[i])
+          , detail::quantize_similar(_widths[i])
+          , num_buckets
+         );
+         _links[i] = _buckets[bucket];
+         _buckets[bucket] = _id_base + i;
+      }
+      _indexed = std::max(_indexed, _id_base + end);
+   }
+
+   template <std::size_t max_window>
+   inline int basic_zero_crossing<max_window>::find_similar(std::size_t index) const
    {
-      return _info[(_num_edges-1)-index];
+      // Most of the time, it is one of the previous few edges
+      auto const edge2 = (*this)[index];
+      auto const recent = std::min<std::size_t>(index, 8);
+      for (std::size_t i = index; i != index - recent;)
+      {
+         if ((*this)[--i].similar(edge2))
+            return i;
+      }
+      if (recent == index)
+         return -1;
+
+      update_index();
+      auto const first_id = _id_base + _first;
+      auto const id2 = first_id + index;
+      auto const peak = detail::quantize_similar(edge2._peak);
+      auto const width = detail::quantize_similar(edge2._width);
+
+      // Search the neighboring buckets for the latest similar edge before
+      // edge2. Each bucket list is ordered from the latest to the oldest.
+      std::array<std::size_t, 9> visited;
+      std::size_t num_visited = 0;
+      std::size_t found = 0;
+      for (auto dp = -1; dp <= 1; ++dp)
+      {
+         for (auto dw = -1; dw <= 1; ++dw)
+         {
+            auto bucket = detail::similar_bucket(peak + dp, width + dw, num_buckets);
+            auto end = visited.begin() + num_visited;
+            if (std::find(visited.begin(), end, bucket) != end)
+               continue;
+            visited[num_visited++] = bucket;
+
+            for (auto id = _buckets[bucket]; id >= first_id && id > found;)
+            {
+               auto i = id - first_id;
+               if (id < id2 && (*this)[i].similar(edge2))
+               {
+                  found = id;
+                  break;
+               }
+               id = _links[_first + i];
+            }
+         }
+      }
+      return found? int(found - first_id) : -1;
    }
 
-   inline zero_crossing::info&
-   zero_crossing::operator[](std::size_t index)
+   template <std::size_t max_window>
+   inline float const* basic_zero_crossing<max_window>::peaks() const
    {
-      return _info[(_num_edges-1)-index];
+      return _peaks.data() + _first;
    }
 
-   inline void zero_crossing::shift(std::size_t n)
+   template <std::size_t max_window>
+   inline int const* basic_zero_crossing<max_window>::leading_edges() const
    {
-      _info[0]._leading_edge -= n;
+      return _leading_edges.data() + _first;
+   }
+
+   template <std::size_t max_window>
+   inline int const* basic_zero_crossing<max_window>::trailing_edges() const
+   {
+      return _trailing_edges.data() + _first;
+   }
+
+   template <std::size_t max_window>
+   inline void basic_zero_crossing<max_window>::push(float s)
+   {
+      CYCFI_ASSERT(_num_edges < _capacity, "Bad _size");
+
+      // Move the edges to the start of the arrays when we reach the end
+      if (_first + _num_edges == _capacity)
+      {
+         auto move = [this](auto& data)
+         {
+            std::copy(
+               data.begin() + _first
+             , data.begin() + _first + _num_edges
+             , data.begin()
+            );
+         };
+         move(_crossings);
+         move(_peaks);
+         move(_leading_edges);
+         move(_trailing_edges);
+         move(_widths);
+         move(_links);
+         _id_base += _first;
+         _first = 0;
+      }
+
+      auto i = _first + _num_edges++;
+      _crossings[i] = { _prev, s };
+      _peaks[i] = s;
+      _leading_edges[i] = int(_frame);
+      _trailing_edges[i] = undefined_edge;
+      _widths[i] = 0.0f;
+   }
+
+   template <std::size_t max_window>
+   inline void basic_zero_crossing<max_window>::shift(std::size_t n)
+   {
+      auto* leading_edges = _leading_edges.data() + _first;
+      auto* trailing_edges = _trailing_edges.data() + _first;
+      auto i = _num_edges-1;
+      leading_edges[i] -= n;
       if (!_state)
-         _info[0]._trailing_edge -= n;
-      auto i = 1;
-      for (; i != _num_edges; ++i)
+         trailing_edges[i] -= n;
+
+      // Keep the edges with trailing edges that are still in the window.
+      // The older edges are dropped.
+      while (i != 0)
       {
-         _info[i]._leading_edge -= n;
-         int edge = (_info[i]._trailing_edge -= n);
-         if (edge < 0.0f)
+         leading_edges[i-1] -= n;
+         if ((trailing_edges[i-1] -= n) < 0)
             break;
+         --i;
+      }
+      _first += i;
+      _num_edges -= i;
+   }
+
+   template <std::size_t max_window>
+   inline basic_zero_crossing_snapshot<max_window>::basic_zero_crossing_snapshot(
+      std::size_t capacity)
+   {
+      if constexpr (max_window == 0)
+      {
+         _crossings.resize(capacity);
+         _peaks.resize(capacity);
+         _leading_edges.resize(capacity);
+         _trailing_edges.resize(capacity);
+         _widths.resize(capacity);
       }
-      _num_edges = i;
+   }
+
+   template <std::size_t max_window>
+   inline void basic_zero_crossing_snapshot<max_window>::assign(
+      zero_crossing_type const& zc)
+   {
+      CYCFI_ASSERT(zc.num_edges() <= _peaks.size(), "Not enough capacity.");
+
+      auto const n = zc.num_edges();
+      _num_edges = n;
+      _window_size = zc.window_size();
+      _hop_size = zc.hop_size();
+      _peak_pulse = zc.peak_pulse();
+      _continuous = zc.is_continuous();
+      if (n == 0)
+         return;
+
+      // The pulse data are contiguous
+      auto const first = zc[0];
+      std::copy_n(&first._crossing, n, _crossings.begin());
+      std::copy_n(zc.peaks(), n, _peaks.begin());
+      std::copy_n(zc.leading_edges(), n, _leading_edges.begin());
+      std::copy_n(zc.trailing_edges(), n, _trailing_edges.begin());
+      std::copy_n(&first._width, n, _widths.begin());
+   }
+
+   template <std::size_t max_window>
+   inline typename basic_zero_crossing_snapshot<max_window>::const_info
+   basic_zero_crossing_snapshot<max_window>::operator[](std::size_t index) const
+   {
+      return {
+         _crossings[index], _peaks[index], _leading_edges[index]
+       , _trailing_edges[index], _widths[index]
+      };
    }
 }
 
@@ -0,0 +1,104 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <q/fft/convolver.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// Convolver benchmark: convolves ten seconds of noise at 48 kHz with IRs of
+// 0.5, 1 and 3 seconds, with uniform partitions and with small head and
+// large tail partitions, and prints one CSV line per configuration:
+//
+//    ir_seconds:       The IR length in seconds
+//    block_size:       The (head) block size, i.e. the latency
+//    tail_block_size:  The tail block size (0: uniform partitions)
+//    prepare_ms:       Time to prepare the IR (convolution_ir)
+//    ns_per_sample:    Average cost per sample (best of all repetitions)
+//    cpu_48k:          Fraction of one CPU core per 48 kHz channel
+//
+// Usage: q_bench_convolver [repetitions]. The default is 3 repetitions.
+// The host block size is the block size.
+////////////////////////////////////////////////////////////////////////////////
+namespace q = cycfi::q;
+using clock_ = std::chrono::steady_clock;
+
+constexpr std::size_t sps = 48000;
+constexpr std::size_t length = sps * 10;
+
+std::vector<float> noise(std::size_t n, unsigned seed)
+{
+   std::mt19937 gen(seed);
+   std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+   std::vector<float> r(n);
+   for (auto& x : r)
+      x = dist(gen);
+   return r;
+}
+
+void bench(
+   int reps, double ir_seconds
+ , std::size_t block_size, std::size_t tail_block_size)
+{
+   auto ir = noise(std::size_t(ir_seconds * sps), 1);
+   for (std::size_t i = 0; i != ir.size(); ++i)
+      ir[i] *= std::exp(-6.0f * i / ir.size());
+   auto in = noise(length, 2);
+   std::vector<float> out(length);
+
+   auto start = clock_::now();
+   auto prepared = std::make_shared<q::convolution_ir>(ir, block_size, tail_block_size);
+   std::chrono::duration<double, std::milli> prepare = clock_::now() - start;
+
+   double best = std::numeric_limits<double>::max();
+   for (int rep = 0; rep != reps; ++rep)
+   {
+      q::convolver conv{ prepared };
+      auto start = clock_::now();
+      for (std::size_t i = 0; i < length; i += block_size)
+      {
+         auto n = std::min(block_size, length - i);
+         conv.process(in.data() + i, out.data() + i, n);
+      }
+      std::chrono::duration<double, std::nano> elapsed = clock_::now() - start;
+      best = std::min(best, elapsed.count() / length);
+   }
+
+   std::cout
+      << ir_seconds << ','
+      << block_size << ','
+      << tail_block_size << ','
+      << prepare.count() << ','
+      << best << ','
+      << (best * sps / 1e9)
+      << std::endl;
+}
+
+int main(int argc, char const* argv[])
+{
+   int reps = argc > 1? std::max(1, std::atoi(argv[1])) : 3;
+
+   std::cout
+      << "ir_seconds,block_size,tail_block_size,prepare_ms,ns_per_sample,cpu_48k"
+      << std::endl;
+
+   for (auto ir_seconds : { 0.5, 1.0, 3.0 })
+   {
+      bench(reps, ir_seconds, 64, 0);
+      bench(reps, ir_seconds, 256, 0);
+      bench(reps, ir_seconds, 1024, 0);
+      bench(reps, ir_seconds, 64, 2048);
+      bench(reps, ir_seconds, 256, 4096);
+   }
+   return 0;
+}
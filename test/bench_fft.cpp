@@ -0,0 +1,142 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <q/fft/fft.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// FFT benchmark: runs the complex FFT for N = 64 to 65536 and prints one CSV
+// line per N:
+//
+//    n:                The FFT size (complex points)
+//    double_ns:        fft<N>(double*) time per transform
+//    scalar_ns:        Single precision scalar kernel time per transform
+//    sse2_ns:          Single precision SSE2 kernel time per transform
+//    avx2_ns:          Single precision AVX2 kernel time per transform
+//    speedup:          double_ns over the best single precision time
+//    max_error:        Maximum error of the best single precision kernel
+//                      against the double FFT, relative to the peak
+//                      magnitude
+//
+// Times are the best of all repetitions. Kernels not supported by the CPU
+// are left empty. Usage: q_bench_fft [repetitions]. The default is 5
+// repetitions.
+////////////////////////////////////////////////////////////////////////////////
+namespace q = cycfi::q;
+using q::detail::simd_level;
+using clock_ = std::chrono::steady_clock;
+
+// Each measurement runs about this many points
+constexpr std::size_t work = 1 << 22;
+
+std::vector<double> random_data(std::size_t n)
+{
+   std::mt19937 gen(n);
+   std::uniform_real_distribution<double> dist(-1.0, 1.0);
+   std::vector<double> r(n);
+   for (auto& x : r)
+      x = dist(gen);
+   return r;
+}
+
+template <typename F>
+double time_ns(std::size_t n, int reps, F&& f)
+{
+   std::size_t iterations = std::max<std::size_t>(work / n, 1);
+   double best = std::numeric_limits<double>::max();
+   for (int rep = 0; rep != reps; ++rep)
+   {
+      auto start = clock_::now();
+      for (std::size_t i = 0; i != iterations; ++i)
+         f();
+      std::chrono::duration<double, std::nano> elapsed = clock_::now() - start;
+      best = std::min(best, elapsed.count() / iterations);
+   }
+   return best;
+}
+
+template <std::size_t N>
+void bench(int reps)
+{
+   auto const orig = random_data(2*N);
+   auto const& tables = q::detail::get_fft_float_tables<N>();
+
+   // The forward and inverse transforms, to keep the data bounded
+   std::vector<double> data = orig;
+   auto double_ns = time_ns(N, reps, [&]
+   {
+      q::fft<N>(data.data());
+      q::ifft<N>(data.data());
+   }) / 2;
+
+   std::cout << N << ',' << double_ns << ',';
+
+   double best = std::numeric_limits<double>::max();
+   simd_level best_level = simd_level::scalar;
+   for (auto level : { simd_level::scalar, simd_level::popcnt, simd_level::avx2 })
+   {
+      if (q::detail::cpu_supports(level))
+      {
+         auto fwd = q::detail::get_fft_float(level, false);
+         auto inv = q::detail::get_fft_float(level, true);
+         std::vector<float> fdata(orig.begin(), orig.end());
+         auto ns = time_ns(N, reps, [&]
+         {
+            fwd(fdata.data(), tables.view());
+            inv(fdata.data(), tables.view());
+         }) / 2;
+         std::cout << ns;
+         if (ns < best)
+         {
+            best = ns;
+            best_level = level;
+         }
+      }
+      std::cout << ',';
+   }
+
+   // The error of the best kernel
+   std::vector<double> ref = orig;
+   std::vector<float> fdata(orig.begin(), orig.end());
+   q::fft<N>(ref.data());
+   q::detail::get_fft_float(best_level, false)(fdata.data(), tables.view());
+
+   double peak = 0, error = 0;
+   for (std::size_t i = 0; i != 2*N; ++i)
+   {
+      peak = std::max(peak, std::abs(ref[i]));
+      error = std::max(error, std::abs(fdata[i] - ref[i]));
+   }
+
+   std::cout << (double_ns / best) << ',' << (error / peak) << std::endl;
+}
+
+template <std::size_t... P>
+void bench_all(int reps, std::index_sequence<P...>)
+{
+   (bench<(std::size_t(64) << P)>(reps), ...);
+}
+
+int main(int argc, char const* argv[])
+{
+   int reps = argc > 1? std::max(1, std::atoi(argv[1])) : 5;
+
+   std::cout
+      << "n,double_ns,scalar_ns,sse2_ns,avx2_ns,speedup,max_error"
+      << std::endl;
+
+   // N = 64 to 65536
+   bench_all(reps, std::make_index_sequence<11>{});
+   return 0;
+}
@@ -0,0 +1,187 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <q/support/literals.hpp>
+#include <q/pitch/note_tracker.hpp>
+#include <q_io/audio_file.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "notes.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Note tracking benchmark: runs the note_tracker over every file in
+// audio_files and prints one CSV line per file and configuration:
+//
+//    file:             The audio file name
+//    config:           default or fast_onset (see period_detector)
+//    samples:          Number of samples processed
+//    sps:              Sample rate
+//    ns_per_sample:    Average cost per sample (best of all repetitions)
+//    note_ons:         Number of note_on messages
+//    pitch_bends:      Number of pitch_bend messages
+//    onset:            The sample where the first note starts
+//    note_on:          The sample of the first note_on
+//    key:              The key of the first note_on
+//    latency_ms:       End-to-end latency: (note_on - onset) in milliseconds
+//
+// onset, note_on, key and latency_ms are empty if there is no onset or
+// note_on. Usage: q_bench_note_tracker [repetitions] [block_size]. The
+// default is 5 repetitions, with blocks of 256 samples.
+////////////////////////////////////////////////////////////////////////////////
+namespace q = cycfi::q;
+namespace fs = std::filesystem;
+namespace midi = q::midi;
+using namespace q::literals;
+using namespace notes;
+using clock_ = std::chrono::steady_clock;
+
+// The frequency range, covering all the files
+auto const lowest_freq = low_fs * 0.8;
+auto const highest_freq = high_e * 5;
+
+// Onset detection
+constexpr auto onset_threshold = 0.01f;         // -40dB
+
+struct counter : midi::processor
+{
+   using midi::processor::operator();
+
+   void operator()(midi::note_on msg, std::size_t time)
+   {
+      if (_note_ons++ == 0)
+      {
+         _note_on = _base + time;
+         _key = msg.key();
+      }
+   }
+
+   void operator()(midi::pitch_bend msg, std::size_t time)
+   {
+      ++_pitch_bends;
+   }
+
+   std::size_t       _base = 0;
+   std::size_t       _note_ons = 0;
+   std::size_t       _pitch_bends = 0;
+   std::size_t       _note_on = std::size_t(-1);
+   int               _key = -1;
+};
+
+struct result
+{
+   double            ns_per_sample = 0;
+   std::size_t       onset = std::size_t(-1);
+   counter           messages;
+};
+
+std::size_t find_onset(std::vector<float> const& in)
+{
+   for (std::size_t i = 0; i != in.size(); ++i)
+      if (std::abs(in[i]) > onset_threshold)
+         return i;
+   return std::size_t(-1);
+}
+
+result bench(
+   std::vector<float> const& in, std::uint32_t sps, int reps
+ , std::size_t block_size, bool fast_onset)
+{
+   result r;
+   r.onset = find_onset(in);
+   r.ns_per_sample = std::numeric_limits<double>::max();
+
+   q::note_tracker::config conf;
+   conf.fast_onset = fast_onset;
+
+   for (int rep = 0; rep != reps; ++rep)
+   {
+      q::note_tracker nt{ conf, lowest_freq, highest_freq, sps };
+      counter messages;
+      auto start = clock_::now();
+      for (std::size_t i = 0; i < in.size(); i += block_size)
+      {
+         messages._base = i;
+         nt.process(in.data() + i, std::min(block_size, in.size() - i), messages);
+      }
+      std::chrono::duration<double, std::nano> elapsed = clock_::now() - start;
+      r.ns_per_sample = std::min(r.ns_per_sample, elapsed.count() / in.size());
+      r.messages = messages;
+   }
+   return r;
+}
+
+void print(
+   std::string const& file, char const* config
+ , std::size_t samples, std::uint32_t sps, result const& r)
+{
+   auto const& m = r.messages;
+   std::cout
+      << '"' << file << "\","
+      << config << ','
+      << samples << ','
+      << sps << ','
+      << r.ns_per_sample << ','
+      << m._note_ons << ','
+      << m._pitch_bends << ',';
+
+   if (r.onset != std::size_t(-1))
+      std::cout << r.onset;
+   std::cout << ',';
+   if (m._note_on != std::size_t(-1))
+      std::cout << m._note_on << ',' << m._key;
+   else
+      std::cout << ',';
+   std::cout << ',';
+   if (r.onset != std::size_t(-1) && m._note_on != std::size_t(-1))
+      std::cout << ((double(m._note_on) - r.onset) * 1000 / sps);
+   std::cout << std::endl;
+}
+
+int main(int argc, char const* argv[])
+{
+   int reps = argc > 1? std::max(1, std::atoi(argv[1])) : 5;
+   std::size_t block_size = argc > 2? std::max(1, std::atoi(argv[2])) : 256;
+
+   std::vector<std::string> files;
+   for (auto const& entry : fs::directory_iterator("audio_files"))
+   {
+      if (entry.path().extension() == ".wav")
+         files.push_back(entry.path().filename().string());
+   }
+   std::sort(files.begin(), files.end());
+
+   std::cout
+      << "file,config,samples,sps,ns_per_sample,note_ons,pitch_bends,"
+         "onset,note_on,key,latency_ms"
+      << std::endl;
+
+   for (auto const& file : files)
+   {
+      q::wav_reader src{ "audio_files/" + file };
+      if (!src || src.num_channels() != 1)
+      {
+         std::cerr << "Skipping " << file << std::endl;
+         continue;
+      }
+
+      std::uint32_t const sps = src.sps();
+      std::vector<float> in(src.length());
+      src.read(in);
+
+      print(file, "default", in.size(), sps,
+         bench(in, sps, reps, block_size, false));
+      print(file, "fast_onset", in.size(), sps,
+         bench(in, sps, reps, block_size, true));
+   }
+   return 0;
+}
@@ -0,0 +1,251 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <q/support/literals.hpp>
+#include <q/pitch/pitch_detector.hpp>
+#include <q_io/audio_file.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "notes.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// Pitch detection benchmark: runs the pitch_detector and period_detector over
+// every file in audio_files and prints one CSV line per file and detector:
+//
+//    file:             The audio file name
+//    detector:         pitch_detector or period_detector
+//    samples:          Number of samples processed
+//    sps:              Sample rate
+//    samples_per_sec:  Throughput (best of all repetitions)
+//    ns_per_sample:    Average cost per sample (best of all repetitions)
+//    analyses:         Number of samples that triggered an analysis
+//                      (autocorrelation)
+//    analysis_p50_ns,
+//    analysis_p99_ns,
+//    analysis_max_ns:  Cost of the samples that triggered an analysis
+//    onset:            The sample where the first note starts
+//    stable:           The sample of the first analysis of a run of
+//                      stable_count analyses with stable frequencies
+//    latency_ms:       Detection latency: (stable - onset) in milliseconds
+//
+// onset, stable and latency_ms are empty if there is no onset or stable
+// frequency. Usage: q_bench_pitch [repetitions] [search_decimation]. The
+// default is 5 repetitions, searching the lags at full resolution (see
+// period_detector::search_decimation). search_decimation must be 1, 2, 4
+// or 8.
+////////////////////////////////////////////////////////////////////////////////
+namespace q = cycfi::q;
+namespace fs = std::filesystem;
+using namespace q::literals;
+using namespace notes;
+using clock_ = std::chrono::steady_clock;
+
+// The frequency range, covering all the files
+auto const lowest_freq = low_fs * 0.8;
+auto const highest_freq = high_e * 5;
+auto const hysteresis = -45_dB;
+
+// Onset and stable frequency detection
+constexpr auto onset_threshold = 0.01f;         // -40dB
+constexpr auto stable_tolerance = 0.01f;        // ~1/6 semitone
+constexpr auto stable_count = 3;
+
+struct result
+{
+   double            ns_per_sample = 0;
+   std::vector<double> analysis_ns;
+   std::size_t       onset = std::size_t(-1);
+   std::size_t       stable = std::size_t(-1);
+};
+
+std::size_t find_onset(std::vector<float> const& in)
+{
+   for (std::size_t i = 0; i != in.size(); ++i)
+      if (std::abs(in[i]) > onset_threshold)
+         return i;
+   return std::size_t(-1);
+}
+
+// Tracks the analyses, looking for the first run of stable frequencies
+struct stable_detector
+{
+   void operator()(std::size_t pos, float f)
+   {
+      if (_stable != std::size_t(-1))
+         return;
+      if (f > 0.0f && _prev > 0.0f && std::abs(f - _prev) < _prev * stable_tolerance)
+      {
+         if (++_count == stable_count - 1)
+            _stable = _start;
+      }
+      else
+      {
+         _count = 0;
+         _start = pos;
+      }
+      _prev = f;
+   }
+
+   float             _prev = 0.0f;
+   int               _count = 0;
+   std::size_t       _start = 0;
+   std::size_t       _stable = std::size_t(-1);
+};
+
+template <typename Detector, typename Frequency>
+result bench(
+   std::vector<float> const& in, std::uint32_t sps, int reps
+ , std::size_t decimation, Frequency get_frequency)
+{
+   result r;
+
+   // Throughput
+   r.ns_per_sample = std::numeric_limits<double>::max();
+   float chk = 0.0f;
+   for (int rep = 0; rep != reps; ++rep)
+   {
+      Detector pd{ lowest_freq, highest_freq, sps, hysteresis };
+      pd.search_decimation(decimation);
+      auto start = clock_::now();
+      for (auto s : in)
+      {
+         if (pd(s))
+            chk += get_frequency(pd, sps);
+      }
+      std::chrono::duration<double, std::nano> elapsed = clock_::now() - start;
+      r.ns_per_sample = std::min(r.ns_per_sample, elapsed.count() / in.size());
+   }
+
+   // Cost of the analyses, detection latency
+   Detector pd{ lowest_freq, highest_freq, sps, hysteresis };
+   pd.search_decimation(decimation);
+   stable_detector stable;
+   r.onset = find_onset(in);
+   for (std::size_t i = 0; i != in.size(); ++i)
+   {
+      auto start = clock_::now();
+      bool ready = pd(in[i]);
+      std::chrono::duration<double, std::nano> elapsed = clock_::now() - start;
+      if (ready)
+      {
+         r.analysis_ns.push_back(elapsed.count());
+         if (r.onset != std::size_t(-1) && i >= r.onset)
+            stable(i, get_frequency(pd, sps));
+      }
+   }
+   r.stable = stable._stable;
+
+   // Keep the optimizer from removing the throughput loop
+   if (chk == -1.0f)
+      std::cerr << chk;
+   return r;
+}
+
+double percentile(std::vector<double> v, double p)
+{
+   if (v.empty())
+      return 0;
+   auto n = std::min<std::size_t>(v.size()-1, p * v.size());
+   std::nth_element(v.begin(), v.begin() + n, v.end());
+   return v[n];
+}
+
+void print(
+   std::string const& file, char const* detector
+ , std::size_t samples, std::uint32_t sps, result const& r)
+{
+   auto max = r.analysis_ns.empty()? 0.0 :
+      *std::max_element(r.analysis_ns.begin(), r.analysis_ns.end());
+
+   std::cout
+      << '"' << file << "\","
+      << detector << ','
+      << samples << ','
+      << sps << ','
+      << (1e9 / r.ns_per_sample) << ','
+      << r.ns_per_sample << ','
+      << r.analysis_ns.size() << ','
+      << percentile(r.analysis_ns, 0.5) << ','
+      << percentile(r.analysis_ns, 0.99) << ','
+      << max << ',';
+
+   if (r.onset != std::size_t(-1))
+      std::cout << r.onset;
+   std::cout << ',';
+   if (r.stable != std::size_t(-1))
+      std::cout << r.stable;
+   std::cout << ',';
+   if (r.onset != std::size_t(-1) && r.stable != std::size_t(-1))
+      std::cout << ((double(r.stable) - r.onset) * 1000 / sps);
+   std::cout << std::endl;
+}
+
+int main(int argc, char const* argv[])
+{
+   int reps = argc > 1? std::max(1, std::atoi(argv[1])) : 5;
+   int decimation = argc > 2? std::atoi(argv[2]) : 1;
+
+   // See period_detector::search_decimation
+   if (decimation != 1 && decimation != 2 && decimation != 4 && decimation != 8)
+   {
+      std::cerr
+         << "Usage: q_bench_pitch [repetitions] [search_decimation]" << std::endl
+         << "search_decimation must be 1, 2, 4 or 8." << std::endl;
+      return 1;
+   }
+
+   std::vector<std::string> files;
+   for (auto const& entry : fs::directory_iterator("audio_files"))
+   {
+      if (entry.path().extension() == ".wav")
+         files.push_back(entry.path().filename().string());
+   }
+   std::sort(files.begin(), files.end());
+
+   std::cout
+      << "file,detector,samples,sps,samples_per_sec,ns_per_sample,analyses,"
+         "analysis_p50_ns,analysis_p99_ns,analysis_max_ns,onset,stable,latency_ms"
+      << std::endl;
+
+   for (auto const& file : files)
+   {
+      q::wav_reader src{ "audio_files/" + file };
+      if (!src || src.num_channels() != 1)
+      {
+         std::cerr << "Skipping " << file << std::endl;
+         continue;
+      }
+
+      std::uint32_t const sps = src.sps();
+      std::vector<float> in(src.length());
+      src.read(in);
+
+      auto pitch = bench<q::pitch_detector>(in, sps, reps, decimation,
+         [](q::pitch_detector const& pd, std::uint32_t)
+         {
+            return pd.get_frequency();
+         }
+      );
+      print(file, "pitch_detector", in.size(), sps, pitch);
+
+      auto period = bench<q::period_detector>(in, sps, reps, decimation,
+         [](q::period_detector const& pd, std::uint32_t sps)
+         {
+            auto period = pd.fundamental()._period;
+            return period > 0? sps / period : 0.0f;
+         }
+      );
+      print(file, "period_detector", in.size(), sps, period);
+   }
+   return 0;
+}
@@ -0,0 +1,163 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <q/support/literals.hpp>
+#include <q/pitch/pitch_analyzer.hpp>
+#include <q_io/audio_file.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+#include "notes.hpp"
+
+////////////////////////////////////////////////////////////////////////////////
+// pitch_analyzer scaling benchmark: concatenates every mono file in
+// audio_files (with the sample rate of the first one) into one recording,
+// and prints one CSV line per stage and thread count:
+//
+//    stage:            pitch_detector: a single pitch_detector, sample by
+//                      sample (the serial reference)
+//                      skip: the serial zero crossing pass of the
+//                      pitch_analyzer alone (period_detector::skip)
+//                      pitch_analyzer: the whole pitch_analyzer
+//    threads:          Number of worker threads
+//    ns_per_sample:    Average cost per sample (best of all repetitions)
+//    speedup:          pitch_detector ns_per_sample / ns_per_sample. For
+//                      skip, this is the upper bound of the pitch_analyzer
+//                      speedup, with any number of threads.
+//
+// The pitch_analyzer runs with 1, 2, 4 ... max_threads threads. Usage:
+// q_bench_pitch_analyzer [repetitions] [max_threads]. The default is 3
+// repetitions, up to std::thread::hardware_concurrency threads.
+////////////////////////////////////////////////////////////////////////////////
+namespace q = cycfi::q;
+namespace fs = std::filesystem;
+using namespace q::literals;
+using namespace notes;
+using clock_ = std::chrono::steady_clock;
+
+// The frequency range, covering all the files (see bench_pitch.cpp)
+auto const lowest_freq = low_fs * 0.8;
+auto const highest_freq = high_e * 5;
+auto const hysteresis = -45_dB;
+
+template <typename F>
+double best_ns_per_sample(std::size_t samples, int reps, F f)
+{
+   double best = std::numeric_limits<double>::max();
+   for (int rep = 0; rep != reps; ++rep)
+   {
+      auto start = clock_::now();
+      f();
+      std::chrono::duration<double, std::nano> elapsed = clock_::now() - start;
+      best = std::min(best, elapsed.count() / samples);
+   }
+   return best;
+}
+
+void print(char const* stage, std::size_t threads, double ns, double serial_ns)
+{
+   std::cout
+      << stage << ','
+      << threads << ','
+      << ns << ','
+      << (serial_ns / ns)
+      << std::endl;
+}
+
+int main(int argc, char const* argv[])
+{
+   int reps = argc > 1? std::max(1, std::atoi(argv[1])) : 3;
+   std::size_t max_threads = argc > 2? std::max(1, std::atoi(argv[2])) :
+      std::max(1u, std::thread::hardware_concurrency());
+
+   std::vector<std::string> files;
+   for (auto const& entry : fs::directory_iterator("audio_files"))
+   {
+      if (entry.path().extension() == ".wav")
+         files.push_back(entry.path().filename().string());
+   }
+   std::sort(files.begin(), files.end());
+
+   std::uint32_t sps = 0;
+   std::vector<float> in;
+   for (auto const& file : files)
+   {
+      q::wav_reader src{ "audio_files/" + file };
+      if (!src || src.num_channels() != 1 || (sps && src.sps() != sps))
+      {
+         std::cerr << "Skipping " << file << std::endl;
+         continue;
+      }
+      sps = src.sps();
+      auto pos = in.size();
+      in.resize(pos + src.length());
+      src.read(in.data() + pos, src.length());
+   }
+   if (in.empty())
+   {
+      std::cerr << "Error: no audio files." << std::endl;
+      return 1;
+   }
+
+   std::cerr
+      << in.size() << " samples at " << sps << " sps, "
+      << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+
+   std::cout << "stage,threads,ns_per_sample,speedup" << std::endl;
+
+   // Keeps the optimizer from removing the loops
+   float chk = 0.0f;
+
+   auto serial = best_ns_per_sample(in.size(), reps,
+      [&]
+      {
+         q::pitch_detector pd{ lowest_freq, highest_freq, sps, hysteresis };
+         for (auto s : in)
+         {
+            if (pd(s))
+               chk += pd.get_frequency();
+         }
+      }
+   );
+   print("pitch_detector", 1, serial, serial);
+
+   // The serial stage of the pitch_analyzer, in segments of the default size
+   auto skip = best_ns_per_sample(in.size(), reps,
+      [&]
+      {
+         q::period_detector pd{ lowest_freq, highest_freq, sps, hysteresis };
+         for (std::size_t i = 0; i < in.size(); i += sps)
+            pd.skip(in.data() + i, std::min<std::size_t>(sps, in.size() - i));
+         chk += pd.fundamental()._period;
+      }
+   );
+   print("skip", 1, skip, serial);
+
+   for (std::size_t threads = 1; ; threads *= 2)
+   {
+      threads = std::min(threads, max_threads);
+      auto ns = best_ns_per_sample(in.size(), reps,
+         [&]
+         {
+            q::pitch_analyzer pa{ lowest_freq, highest_freq, sps, hysteresis, threads };
+            chk += pa(in.data(), in.size()).size();
+         }
+      );
+      print("pitch_analyzer", threads, ns, serial);
+      if (threads == max_threads)
+         break;
+   }
+
+   if (chk == -1.0f)
+      std::cerr << chk;
+   return 0;
+}
@@ -0,0 +1,97 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#include <q/fft/stft.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////
+// STFT benchmark: runs the stft with 75% overlap (hop = N/4) and a Hann
+// window, with a spectral callback that does nothing, for N = 1024, 2048
+// and 4096, and prints one CSV line per N:
+//
+//    n:                The FFT size
+//    hop:              The hop size
+//    block_size:       The host block size
+//    ns_per_sample:    Average cost per sample (best of all repetitions)
+//    us_per_hop:       Average cost per hop (analysis and resynthesis)
+//    cpu_48k:          Fraction of one CPU core for a 48 kHz stream
+//    latency:          The latency in samples
+//    max_error:        Maximum reconstruction error
+//
+// Usage: q_bench_stft [repetitions] [block_size]. The default is 5
+// repetitions, with blocks of 256 samples.
+////////////////////////////////////////////////////////////////////////////////
+namespace q = cycfi::q;
+using clock_ = std::chrono::steady_clock;
+
+// Ten seconds of audio at 48 kHz
+constexpr std::size_t length = 480000;
+
+template <std::size_t N>
+void bench(int reps, std::size_t block_size)
+{
+   std::mt19937 gen(N);
+   std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+   std::vector<float> in(length);
+   for (auto& x : in)
+      x = dist(gen);
+   std::vector<float> out(length);
+
+   constexpr auto hop = N/4;
+   double best = std::numeric_limits<double>::max();
+   std::size_t latency = 0;
+   for (int rep = 0; rep != reps; ++rep)
+   {
+      auto stft = std::make_unique<q::stft<N>>(hop);
+      latency = stft->latency();
+      auto start = clock_::now();
+      for (std::size_t i = 0; i < length; i += block_size)
+      {
+         auto n = std::min(block_size, length - i);
+         stft->process(in.data() + i, out.data() + i, n, [](float*) {});
+      }
+      std::chrono::duration<double, std::nano> elapsed = clock_::now() - start;
+      best = std::min(best, elapsed.count() / length);
+   }
+
+   float error = 0;
+   for (std::size_t i = latency; i != length; ++i)
+      error = std::max(error, std::abs(out[i] - in[i - latency]));
+
+   std::cout
+      << N << ','
+      << hop << ','
+      << block_size << ','
+      << best << ','
+      << (best * hop / 1000) << ','
+      << (best * 48000 / 1e9) << ','
+      << latency << ','
+      << error
+      << std::endl;
+}
+
+int main(int argc, char const* argv[])
+{
+   int reps = argc > 1? std::max(1, std::atoi(argv[1])) : 5;
+   std::size_t block_size = argc > 2? std::max(1, std::atoi(argv[2])) : 256;
+
+   std::cout
+      << "n,hop,block_size,ns_per_sample,us_per_hop,cpu_48k,latency,max_error"
+      << std::endl;
+
+   bench<1024>(reps, block_size);
+   bench<2048>(reps, block_size);
+   bench<4096>(reps, block_size);
+   return 0;
+}
@@ -71,6 +71,12 @@ TEST_CASE("Test_bitset_64")
    CHECK(bs.data()[0] == 8);
    CHECK(bs.get(3));
 
+   bs.set(40, true);
+   CHECK(bs.data()[0] == 0x0000010000000008);
+   CHECK(bs.get(40));
+   bs.set(40, false);
+   CHECK(bs.data()[0] == 8);
+
    bs.set(8, 32, true);
    CHECK(bs.data()[0] == 0x000000FFFFFFFF08);
    CHECK(bs.data()[1] == 0x0000000000000000);
@@ -98,4 +104,40 @@ TEST_CASE("Test_bitset_64")
    CHECK(bs.get(1));
    CHECK(bs.get(126));
    CHECK(!bs.get(127));
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test_bitset_shift")
+{
+   q::bitset<std::uint64_t> bs{ 192 };
+
+   bs.set(1, 190, true);
+   bs.shift(64);
+   CHECK(bs.data()[0] == 0xFFFFFFFFFFFFFFFF);
+   CHECK(bs.data()[1] == 0x7FFFFFFFFFFFFFFF);
+   CHECK(bs.data()[2] == 0x0000000000000000);
+
+   bs.clear();
+   bs.set(100, 20, true);
+   bs.shift(96);
+   CHECK(bs.data()[0] == 0x0000000000FFFFF0);
+   CHECK(bs.data()[1] == 0x0000000000000000);
+   CHECK(bs.data()[2] == 0x0000000000000000);
+
+   bs.clear();
+   bs.set(60, 10, true);
+   bs.set(130, 62, true);
+   bs.shift(32);
+   CHECK(bs.get(28));
+   CHECK(bs.get(37));
+   CHECK(!bs.get(38));
+   CHECK(!bs.get(97));
+   CHECK(bs.get(98));
+   CHECK(bs.get(159));
+   CHECK(!bs.get(160));
+   CHECK(bs.data()[2] == 0x00000000FFFFFFFF);
+
+   bs.shift(192);
+   CHECK(bs.data()[0] == 0x0000000000000000);
+   CHECK(bs.data()[1] == 0x0000000000000000);
+   CHECK(bs.data()[2] == 0x0000000000000000);
+}
@@ -0,0 +1,235 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#define CATCH_CONFIG_MAIN
+#include <infra/catch.hpp>
+
+#include <q/support/literals.hpp>
+#include <q/utility/bitstream_acf.hpp>
+#include <q/utility/zero_crossing.hpp>
+
+#include <vector>
+#include <iostream>
+#include <chrono>
+#include "notes.hpp"
+
+namespace q = cycfi::q;
+using namespace q::literals;
+using namespace notes;
+
+namespace detail = q::detail;
+using level = detail::simd_level;
+using value_type = q::bitset<>::value_type;
+
+struct window
+{
+   char const*    name;
+   q::frequency   lowest_freq;
+   std::uint32_t  sps;
+};
+
+// The window sizes used by the period_detector: 2x the period of the lowest
+// frequency (see period_detector's constructor).
+window const windows[] =
+{
+   { "high_e 44.1k", high_e * 0.8, 44100 },
+   { "d 44.1k", d * 0.8, 44100 },
+   { "low_e 44.1k", low_e * 0.8, 44100 },
+   { "low_e 48k", low_e * 0.8, 48000 },
+   { "low_b 48k", low_b * 0.8, 48000 },
+   { "low_fs 48k", low_fs * 0.8, 48000 },
+   { "low_e 96k", low_e * 0.8, 96000 },
+   { "low_fs 96k", low_fs * 0.8, 96000 },
+   { "30 Hz 96k", 30_Hz, 96000 },
+   { "30 Hz 192k", 30_Hz, 192000 },
+};
+
+std::pair<level, char const*> const levels[] =
+{
+   { level::scalar, "scalar" },
+   { level::popcnt, "popcnt" },
+   { level::avx2, "avx2" },
+   { level::avx512, "avx512" },
+};
+
+std::size_t window_size(window const& w)
+{
+   auto zc = q::zero_crossing{ -45_dB, float(w.lowest_freq.period() * 2) * w.sps };
+   return zc.window_size();
+}
+
+q::bitset<> random_bits(std::size_t size)
+{
+   q::bitset<> bits{ size };
+   for (auto i = 0; i != size; ++i)
+      bits.set(i, q::fast_rand() & 1);
+   return bits;
+}
+
+TEST_CASE("Test_kernels")
+{
+   for (auto const& w : windows)
+   {
+      auto bits = random_bits(window_size(w));
+      q::bitstream_acf<> ac{ bits };
+      auto mid_point = bits.size() / 2;
+
+      for (auto [l, name] : levels)
+      {
+         if (!detail::cpu_supports(l))
+            continue;
+
+         INFO("Window: " << w.name << ", kernel: " << name);
+         auto f = detail::get_xor_count_bits<value_type>(l);
+         for (auto pos = 0; pos != mid_point; ++pos)
+         {
+            auto const* p1 = bits.data();
+            auto const* p2 = bits.data() + (pos / ac.value_size);
+            auto shift = pos % ac.value_size;
+            auto expected = detail::xor_count_bits_scalar(p1, p2, ac._mid_array, shift);
+            REQUIRE(f(p1, p2, ac._mid_array, shift) == expected);
+            REQUIRE(ac(pos) == expected);
+         }
+      }
+   }
+}
+
+// All the 64-bit unsigned integer types use the vectorized kernels, not
+// only std::uint64_t (see detail::is_uint64).
+template <typename T>
+void test_kernel_type(q::bitset<> const& bits)
+{
+   std::vector<T> data(bits.data(), bits.data() + bits.size() / bits.value_size);
+   q::bitstream_acf<> ac{ bits };
+   for (auto [l, name] : levels)
+   {
+      if (!detail::cpu_supports(l))
+         continue;
+
+      INFO("kernel: " << name);
+      auto f = detail::get_xor_count_bits<T>(l);
+      auto fb = detail::get_xor_count_bits_block<T>(l);
+      std::size_t block[64];
+      for (std::size_t index = 0; index + ac._mid_array < data.size(); ++index)
+      {
+         fb(data.data(), data.data() + index, ac._mid_array, block);
+         for (std::size_t shift = 0; shift != 64; ++shift)
+         {
+            auto expected = ac(index * 64 + shift);
+            REQUIRE(f(data.data(), data.data() + index, ac._mid_array, shift) == expected);
+            REQUIRE(block[shift] == expected);
+         }
+      }
+   }
+}
+
+TEST_CASE("Test_kernel_types")
+{
+   static_assert(detail::is_uint64<unsigned long long>);
+   static_assert(detail::is_uint64<std::uint64_t>);
+   static_assert(!detail::is_uint64<std::uint32_t>);
+   static_assert(!detail::is_uint64<std::int64_t>);
+
+   auto bits = random_bits(window_size(windows[2]));
+   test_kernel_type<unsigned long long>(bits);
+   if constexpr (sizeof(unsigned long) == 8)
+      test_kernel_type<unsigned long>(bits);
+}
+
+TEST_CASE("Test_correlogram")
+{
+   for (auto const& w : windows)
+   {
+      auto bits = random_bits(window_size(w));
+      q::bitstream_acf<> ac{ bits };
+      auto mid_point = bits.size() / 2;
+
+      for (auto [l, name] : levels)
+      {
+         if (!detail::cpu_supports(l))
+            continue;
+
+         INFO("Window: " << w.name << ", kernel: " << name);
+         auto f = detail::get_xor_count_bits_block<value_type>(l);
+         std::size_t block[ac.value_size];
+         for (auto pos = 0; pos < mid_point; pos += ac.value_size)
+         {
+            auto const* p1 = bits.data();
+            auto const* p2 = bits.data() + (pos / ac.value_size);
+            f(p1, p2, ac._mid_array, block);
+            for (auto shift = 0; shift != ac.value_size; ++shift)
+            {
+               auto expected = detail::xor_count_bits_scalar(p1, p2, ac._mid_array, shift);
+               REQUIRE(block[shift] == expected);
+            }
+         }
+      }
+
+      // Partial ranges, up to and including the mid point
+      std::vector<std::size_t> curve(mid_point + 1);
+      for (auto first : { 0, 1, 63, 64, 100 })
+      {
+         ac(first, mid_point + 1, curve.data());
+         for (auto pos = first; pos != mid_point + 1; ++pos)
+            REQUIRE(curve[pos-first] == ac(pos));
+      }
+   }
+}
+
+TEST_CASE("Bench_kernels")
+{
+   constexpr auto iterations = 20;
+
+   std::cout << "bitstream_acf: nanoseconds per correlation" << std::endl;
+   for (auto const& w : windows)
+   {
+      auto bits = random_bits(window_size(w));
+      q::bitstream_acf<> ac{ bits };
+      auto mid_point = bits.size() / 2;
+
+      std::cout << '"' << w.name << "\" (" << bits.size() << " bits):";
+      for (auto [l, name] : levels)
+      {
+         if (!detail::cpu_supports(l))
+            continue;
+
+         auto f = detail::get_xor_count_bits<value_type>(l);
+         std::size_t sum = 0;
+         auto start = std::chrono::high_resolution_clock::now();
+         for (auto i = 0; i != iterations; ++i)
+         {
+            for (auto pos = 0; pos != mid_point; ++pos)
+            {
+               auto const* p1 = bits.data();
+               auto const* p2 = bits.data() + (pos / ac.value_size);
+               sum += f(p1, p2, ac._mid_array, pos % ac.value_size);
+            }
+         }
+         auto elapsed = std::chrono::high_resolution_clock::now() - start;
+         auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+         CHECK(sum != 0);
+
+         std::cout
+            << ' ' << name << ": "
+            << (double(ns.count()) / (iterations * mid_point));
+      }
+
+      // The whole correlogram in one sweep
+      {
+         std::vector<std::size_t> curve(mid_point);
+         auto start = std::chrono::high_resolution_clock::now();
+         for (auto i = 0; i != iterations; ++i)
+            ac(0, mid_point, curve.data());
+         auto elapsed = std::chrono::high_resolution_clock::now() - start;
+         auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+         CHECK(curve[mid_point-1] != 0);
+
+         std::cout
+            << " correlogram: "
+            << (double(ns.count()) / (iterations * mid_point));
+      }
+      std::cout << std::endl;
+   }
+}
@@ -0,0 +1,236 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#define CATCH_CONFIG_MAIN
+#include <infra/catch.hpp>
+
+#include <q/fft/convolver.hpp>
+#include <q_io/audio_file.hpp>
+#include <algorithm>
+#include <cmath>
+#include <future>
+#include <random>
+#include <vector>
+
+namespace q = cycfi::q;
+
+std::vector<float> random_signal(std::size_t n, unsigned seed)
+{
+   std::mt19937 gen(seed);
+   std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+   std::vector<float> r(n);
+   for (auto& x : r)
+      x = dist(gen);
+   return r;
+}
+
+// A decaying noise burst, like a room impulse response
+std::vector<float> random_ir(std::size_t n, unsigned seed)
+{
+   auto ir = random_signal(n, seed);
+   for (std::size_t i = 0; i != n; ++i)
+      ir[i] *= std::exp(-3.0f * i / n);
+   return ir;
+}
+
+// Direct convolution, delayed by latency samples
+std::vector<float> convolve(
+   std::vector<float> const& in, std::vector<float> const& ir
+ , std::size_t latency)
+{
+   std::vector<float> out(in.size());
+   for (std::size_t i = latency; i != in.size(); ++i)
+   {
+      double sum = 0;
+      auto n = std::min(ir.size(), i - latency + 1);
+      for (std::size_t j = 0; j != n; ++j)
+         sum += double(ir[j]) * in[i - latency - j];
+      out[i] = float(sum);
+   }
+   return out;
+}
+
+// Process in place, in blocks of block_size. Returns the output.
+std::vector<float> process(
+   q::convolver& conv, std::vector<float> const& in, std::size_t block_size)
+{
+   auto out = in;
+   for (std::size_t i = 0; i < out.size(); i += block_size)
+   {
+      auto n = std::min(block_size, out.size() - i);
+      conv.process(out.data() + i, out.data() + i, n);
+   }
+   return out;
+}
+
+float max_error(std::vector<float> const& a, std::vector<float> const& b)
+{
+   float error = 0;
+   for (std::size_t i = 0; i != a.size(); ++i)
+      error = std::max(error, std::abs(a[i] - b[i]));
+   return error;
+}
+
+void test_convolver(
+   std::size_t ir_length, std::size_t block_size
+ , std::size_t tail_block_size, std::size_t host_block_size)
+{
+   INFO(
+      "IR: " << ir_length << " block: " << block_size
+      << " tail: " << tail_block_size << " host block: " << host_block_size
+   );
+
+   auto ir = random_ir(ir_length, ir_length);
+   auto in = random_signal(ir_length * 3, 7);
+   auto conv = q::convolver{
+      std::make_shared<q::convolution_ir>(ir, block_size, tail_block_size)
+   };
+   CHECK(conv.latency() == block_size);
+
+   auto out = process(conv, in, host_block_size);
+   CHECK(max_error(out, convolve(in, ir, block_size)) < 1e-4);
+
+   // Again, after a reset
+   conv.reset();
+   out = process(conv, in, host_block_size);
+   CHECK(max_error(out, convolve(in, ir, block_size)) < 1e-4);
+}
+
+TEST_CASE("Test_convolver")
+{
+   // Uniform partitions, host blocks of any size
+   test_convolver(1000, 64, 0, 64);
+   test_convolver(1000, 64, 0, 1);
+   test_convolver(1000, 64, 0, 37);
+   test_convolver(1000, 64, 0, 500);
+   test_convolver(1, 2, 0, 3);
+   test_convolver(5, 2, 0, 3);
+   test_convolver(4096, 256, 0, 128);
+
+   // Small head partitions and a tail of large partitions
+   test_convolver(3000, 32, 256, 32);
+   test_convolver(3000, 32, 256, 100);
+   test_convolver(10000, 64, 1024, 64);
+
+   // The IR fits in the head: no tail
+   test_convolver(500, 64, 1024, 64);
+   CHECK(q::convolution_ir(random_ir(500, 1), 64, 1024).tail_block_size() == 0);
+   CHECK(q::convolution_ir(random_ir(2000, 1), 64, 1024).tail_block_size() == 1024);
+
+   CHECK_THROWS(q::convolution_ir(random_ir(100, 1), 0));
+   CHECK_THROWS(q::convolution_ir(random_ir(100, 1), 48));
+   CHECK_THROWS(q::convolution_ir(random_ir(100, 1), 64, 64));
+   CHECK_THROWS(q::convolution_ir(random_ir(100, 1), 64, 100));
+   CHECK_THROWS(q::convolution_ir(std::vector<float>{}, 64));
+}
+
+TEST_CASE("Test_convolver_latency")
+{
+   // A unit impulse IR: the output is the input, delayed by the block size
+   auto ir = std::make_shared<q::convolution_ir>(std::vector<float>{ 1.0f }, 128);
+   q::convolver conv{ ir };
+   auto in = random_signal(1024, 3);
+   auto out = process(conv, in, 100);
+   for (std::size_t i = 0; i != 128; ++i)
+      CHECK(std::abs(out[i]) < 1e-6);
+   for (std::size_t i = 128; i != in.size(); ++i)
+      CHECK(std::abs(out[i] - in[i - 128]) < 1e-6);
+}
+
+TEST_CASE("Test_convolver_wav")
+{
+   constexpr auto sps = 44100;
+   constexpr std::size_t ir_length = 3000;
+   constexpr std::size_t block_size = 64;
+
+   // A stereo IR: a different IR per channel
+   std::vector<float> irs[] = { random_ir(ir_length, 1), random_ir(ir_length, 2) };
+   {
+      std::vector<float> interleaved(ir_length * 2);
+      for (std::size_t i = 0; i != ir_length; ++i)
+      {
+         interleaved[i*2] = irs[0][i];
+         interleaved[i*2+1] = irs[1][i];
+      }
+      q::wav_writer wav{ "results/convolver_ir.wav", 2, sps };
+      wav.write(interleaved.data(), interleaved.size());
+   }
+
+   // Load and transform the IRs off the audio thread
+   auto load = [&](std::size_t channel)
+   {
+      q::wav_reader wav{ "results/convolver_ir.wav" };
+      return std::make_shared<q::convolution_ir>(
+         q::read_channel(wav, channel), block_size
+      );
+   };
+   auto ir0 = std::async(std::launch::async, load, 0);
+   auto ir1 = std::async(std::launch::async, load, 1);
+   q::convolver_bank bank{ { ir0.get(), ir1.get() } };
+   CHECK(bank.size() == 2);
+   CHECK(bank.latency() == block_size);
+   CHECK(bank[1].ir()->length() == ir_length);
+
+   // Process audio_channels, in blocks of 256 frames
+   std::vector<float> in[] = { random_signal(8192, 3), random_signal(8192, 4) };
+   std::vector<float> out[] = { std::vector<float>(8192), std::vector<float>(8192) };
+   for (std::size_t i = 0; i != 8192; i += 256)
+   {
+      float const* in_buffers[] = { in[0].data() + i, in[1].data() + i };
+      float* out_buffers[] = { out[0].data() + i, out[1].data() + i };
+      bank.process(
+         q::audio_channels<float const>{ in_buffers, 2, 256 }
+       , q::audio_channels<float>{ out_buffers, 2, 256 }
+      );
+   }
+
+   for (std::size_t ch = 0; ch != 2; ++ch)
+   {
+      INFO("Channel: " << ch);
+      CHECK(max_error(out[ch], convolve(in[ch], irs[ch], block_size)) < 1e-4);
+   }
+
+   // Only the frames present in both in and out are processed
+   {
+      bank.reset();
+      std::vector<float> short_in(100, 1.0f);
+      std::vector<float> long_out(256, 2.0f);
+      float const* in_buffers[] = { short_in.data() };
+      float* out_buffers[] = { long_out.data() };
+      bank.process(
+         q::audio_channels<float const>{ in_buffers, 1, short_in.size() }
+       , q::audio_channels<float>{ out_buffers, 1, long_out.size() }
+      );
+      CHECK(std::count(long_out.begin() + 100, long_out.end(), 2.0f) == 156);
+   }
+
+   q::wav_reader wav{ "results/convolver_ir.wav" };
+   CHECK_THROWS(q::read_channel(wav, 2));
+}
+
+TEST_CASE("Test_spectrum_mac")
+{
+   // All the kernels give the same results
+   constexpr std::size_t n = 64;
+   alignas(32) float x[n*2], h[n*2], expected[n*2], acc[n*2];
+   auto rx = random_signal(n*2, 1);
+   auto rh = random_signal(n*2, 2);
+   std::copy(rx.begin(), rx.end(), x);
+   std::copy(rh.begin(), rh.end(), h);
+   std::fill(expected, expected + n*2, 1.0f);
+   q::detail::spectrum_mac_scalar(expected, x, h, n);
+
+   using q::detail::simd_level;
+   for (auto level : { simd_level::popcnt, simd_level::avx2 })
+   {
+      if (!q::detail::cpu_supports(level))
+         continue;
+      INFO("simd_level: " << int(level));
+      std::fill(acc, acc + n*2, 1.0f);
+      q::detail::get_spectrum_mac(level)(acc, x, h, n);
+      for (std::size_t i = 0; i != n*2; ++i)
+         CHECK(std::abs(acc[i] - expected[i]) < 1e-6);
+   }
+}
@@ -3,16 +3,24 @@
 
    Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
 =============================================================================*/
+#define CATCH_CONFIG_MAIN
+#include <infra/catch.hpp>
+
 #include <q/fft/fft.hpp>
+#include <q/fft/fft_plan.hpp>
 #include <q_io/audio_file.hpp>
 #include <array>
+#include <complex>
+#include <random>
+#include <thread>
+#include <vector>
 
 namespace q = cycfi::q;
 using namespace q::literals;
 
 constexpr auto sps = 48000;
 
-int main()
+TEST_CASE("Test_fft")
 {
    constexpr std::size_t p = 7;
    constexpr std::size_t n = 1<<p;
@@ -46,7 +54,7 @@ int main()
       auto ch3 = pos+2;
 
       out[ch2] = data[i] / (n/2);
-      out[ch3] = data[i+1] / (n/2);
+      out[ch3] = (i+1 < _2n)? data[i+1] / (n/2) : 0;
    }
 
    ////////////////////////////////////////////////////////////////////////////
@@ -56,6 +64,304 @@ int main()
       "results/fft.wav", n_channels, sps
    );
    wav.write(out);
+}
+
+using complex = std::complex<double>;
+
+// Reference DFT: X[k] = sum of x[n] * exp(-2*pi*i*k*n/N)
+std::vector<complex> dft(std::vector<complex> const& x)
+{
+   auto n = x.size();
+   std::vector<complex> r(n);
+   for (std::size_t k = 0; k != n; ++k)
+   {
+      for (std::size_t i = 0; i != n; ++i)
+         r[k] += x[i] * std::polar(1.0, double(-2_pi * ((k * i) % n) / n));
+   }
+   return r;
+}
+
+std::vector<double> random_data(std::size_t n)
+{
+   std::mt19937 gen(n);
+   std::uniform_real_distribution<double> dist(-1.0, 1.0);
+   std::vector<double> r(n);
+   for (auto& x : r)
+      x = dist(gen);
+   return r;
+}
+
+template <std::size_t N>
+void test_ifft()
+{
+   INFO("N: " << N);
+   auto data = random_data(2*N);
+   auto orig = data;
+
+   std::vector<complex> x(N);
+   for (std::size_t i = 0; i != N; ++i)
+      x[i] = { data[2*i], data[2*i+1] };
+   auto ref = dft(x);
+
+   q::fft<N>(data.data());
+   for (std::size_t k = 0; k != N; ++k)
+   {
+      CHECK(std::abs(data[2*k] - ref[k].real()) < 1e-9);
+      CHECK(std::abs(data[2*k+1] - ref[k].imag()) < 1e-9);
+   }
+
+   q::ifft<N>(data.data());
+   for (std::size_t i = 0; i != 2*N; ++i)
+      CHECK(std::abs(data[i] - orig[i]) < 1e-12);
+}
+
+template <std::size_t N>
+void test_rfft()
+{
+   INFO("N: " << N);
+   auto data = random_data(N);
+   auto orig = data;
+   auto ref = dft(std::vector<complex>(data.begin(), data.end()));
+
+   q::rfft<N>(data.data());
+
+   // Packed Hermitian spectrum
+   CHECK(std::abs(data[0] - ref[0].real()) < 1e-9);
+   CHECK(std::abs(data[1] - ref[N/2].real()) < 1e-9);
+   for (std::size_t k = 1; k != N/2; ++k)
+   {
+      CHECK(std::abs(data[2*k] - ref[k].real()) < 1e-9);
+      CHECK(std::abs(data[2*k+1] - ref[k].imag()) < 1e-9);
+   }
+
+   q::irfft<N>(data.data());
+   for (std::size_t i = 0; i != N; ++i)
+      CHECK(std::abs(data[i] - orig[i]) < 1e-12);
+}
+
+TEST_CASE("Test_ifft")
+{
+   test_ifft<2>();
+   test_ifft<4>();
+   test_ifft<8>();
+   test_ifft<64>();
+   test_ifft<1024>();
+}
+
+TEST_CASE("Test_rfft")
+{
+   test_rfft<4>();
+   test_rfft<8>();
+   test_rfft<16>();
+   test_rfft<64>();
+   test_rfft<1024>();
+}
+
+TEST_CASE("Test_rfft_sine")
+{
+   // A sine at bin 10 and a cosine at bin 20 (plus DC) of a real signal
+   constexpr std::size_t n = 256;
+   std::array<double, n> data;
+   for (std::size_t i = 0; i != n; ++i)
+   {
+      data[i] =
+         0.25 +
+         0.5 * std::sin(2_pi * i * 10 / n) +
+         0.3 * std::cos(2_pi * i * 20 / n)
+      ;
+   }
+
+   q::rfft<n>(data.data());
+   CHECK(std::abs(data[0] - 0.25 * n) < 1e-9);
+   CHECK(std::abs(data[1]) < 1e-9);
+   for (std::size_t k = 1; k != n/2; ++k)
+   {
+      INFO("k: " << k);
+      auto re = k == 20? 0.3 * n/2 : 0.0;
+      auto im = k == 10? -0.5 * n/2 : 0.0;
+      CHECK(std::abs(data[2*k] - re) < 1e-9);
+      CHECK(std::abs(data[2*k+1] - im) < 1e-9);
+   }
+}
+
+// Maximum error of the float FFT relative to the double FFT, relative to
+// the peak magnitude, for the given kernel (see detail::get_fft_float)
+template <std::size_t N>
+double fft_float_error(q::detail::simd_level level)
+{
+   auto data = random_data(2*N);
+   std::vector<float> fdata(data.begin(), data.end());
+   auto const& tables = q::detail::get_fft_float_tables<N>();
+
+   q::fft<N>(data.data());
+   q::detail::get_fft_float(level, false)(fdata.data(), tables.view());
+
+   double peak = 0, error = 0;
+   for (std::size_t i = 0; i != 2*N; ++i)
+   {
+      peak = std::max(peak, std::abs(data[i]));
+      error = std::max(error, std::abs(fdata[i] - data[i]));
+   }
+   return error / peak;
+}
+
+template <std::size_t N>
+void test_fft_float()
+{
+   using q::detail::simd_level;
+   INFO("N: " << N);
+
+   for (auto level : { simd_level::scalar, simd_level::popcnt, simd_level::avx2 })
+   {
+      if (!q::detail::cpu_supports(level))
+         continue;
+      INFO("simd_level: " << int(level));
+      CHECK(fft_float_error<N>(level) < 1e-6);
+
+      // Round trip
+      auto data = random_data(2*N);
+      std::vector<float> fdata(data.begin(), data.end());
+      auto const& tables = q::detail::get_fft_float_tables<N>();
+      q::detail::get_fft_float(level, false)(fdata.data(), tables.view());
+      q::detail::get_fft_float(level, true)(fdata.data(), tables.view());
+      for (std::size_t i = 0; i != 2*N; ++i)
+         CHECK(std::abs(fdata[i] - data[i]) < 1e-5);
+   }
+}
+
+template <std::size_t N>
+void test_rfft_float()
+{
+   INFO("N: " << N);
+   auto data = random_data(N);
+   std::vector<float> fdata(data.begin(), data.end());
+
+   q::rfft<N>(data.data());
+   q::rfft<N>(fdata.data());
+
+   double peak = 0, error = 0;
+   for (std::size_t i = 0; i != N; ++i)
+   {
+      peak = std::max(peak, std::abs(data[i]));
+      error = std::max(error, std::abs(fdata[i] - data[i]));
+   }
+   CHECK(error / peak < 1e-6);
+
+   q::irfft<N>(fdata.data());
+   auto orig = random_data(N);
+   for (std::size_t i = 0; i != N; ++i)
+      CHECK(std::abs(fdata[i] - orig[i]) < 1e-5);
+}
+
+TEST_CASE("Test_fft_float")
+{
+   test_fft_float<2>();
+   test_fft_float<4>();
+   test_fft_float<8>();
+   test_fft_float<16>();
+   test_fft_float<32>();
+   test_fft_float<64>();
+   test_fft_float<128>();
+   test_fft_float<1024>();
+   test_fft_float<2048>();
+   test_fft_float<65536>();
+}
+
+TEST_CASE("Test_rfft_float")
+{
+   test_rfft_float<4>();
+   test_rfft_float<8>();
+   test_rfft_float<64>();
+   test_rfft_float<1024>();
+   test_rfft_float<8192>();
+}
+
+template <std::size_t N>
+void test_fft_plan()
+{
+   INFO("N: " << N);
+   q::fft_plan plan{ N };
+   CHECK(plan.size() == N);
+
+   auto data = random_data(2*N);
+   std::vector<float> a(data.begin(), data.end());
+   std::vector<float> b = a;
+
+   // Same kernels and tables as fft<N>
+   q::fft<N>(a.data());
+   plan.forward(b.data());
+   CHECK(a == b);
+
+   plan.inverse(b.data());
+   for (std::size_t i = 0; i != 2*N; ++i)
+      CHECK(std::abs(b[i] - data[i]) < 1e-5);
+}
+
+template <std::size_t N>
+void test_rfft_plan()
+{
+   INFO("N: " << N);
+   q::rfft_plan plan{ N };
+   CHECK(plan.size() == N);
+
+   auto data = random_data(N);
+   std::vector<float> a(data.begin(), data.end());
+   std::vector<float> b = a;
+
+   q::rfft<N>(a.data());
+   plan.forward(b.data());
+   CHECK(a == b);
+
+   plan.inverse(b.data());
+   for (std::size_t i = 0; i != N; ++i)
+      CHECK(std::abs(b[i] - data[i]) < 1e-5);
+}
+
+TEST_CASE("Test_fft_plan")
+{
+   test_fft_plan<2>();
+   test_fft_plan<4>();
+   test_fft_plan<8>();
+   test_fft_plan<512>();
+   test_fft_plan<4096>();
+   test_rfft_plan<4>();
+   test_rfft_plan<8>();
+   test_rfft_plan<2048>();
+
+   CHECK_THROWS(q::fft_plan{ 0 });
+   CHECK_THROWS(q::fft_plan{ 1 });
+   CHECK_THROWS(q::fft_plan{ 1000 });
+   CHECK_THROWS(q::rfft_plan{ 2 });
+   CHECK_THROWS(q::rfft_plan{ 3000 });
+}
+
+TEST_CASE("Test_fft_plan_shared")
+{
+   // One plan, used by many threads at the same time
+   constexpr std::size_t n = 1024;
+   q::fft_plan const plan{ n };
+
+   auto data = random_data(2*n);
+   std::vector<float> expected(data.begin(), data.end());
+   plan.forward(expected.data());
+
+   constexpr auto num_threads = 4;
+   std::vector<std::vector<float>> results(num_threads);
+   std::vector<std::thread> threads;
+   for (std::size_t t = 0; t != num_threads; ++t)
+   {
+      threads.emplace_back([&, t]
+      {
+         for (int i = 0; i != 100; ++i)
+         {
+            results[t].assign(data.begin(), data.end());
+            plan.forward(results[t].data());
+         }
+      });
+   }
+   for (auto& t : threads)
+      t.join();
 
-   return 0;
+   for (auto const& r : results)
+      CHECK(r == expected);
 }
@@ -0,0 +1,179 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#define CATCH_CONFIG_MAIN
+#include <infra/catch.hpp>
+
+#include <q/support/literals.hpp>
+#include <q/pitch/note_tracker.hpp>
+
+#include <algorithm>
+#include <vector>
+#include "notes.hpp"
+
+namespace q = cycfi::q;
+namespace midi = q::midi;
+using namespace q::literals;
+using namespace notes;
+
+constexpr auto pi = q::pi;
+constexpr auto sps = 44100;
+
+struct event
+{
+   enum type { note_on, note_off, pitch_bend };
+
+   bool operator==(event const& rhs) const
+   {
+      return _type == rhs._type && _value == rhs._value && _time == rhs._time;
+   }
+
+   type           _type;
+   int            _value;
+   std::size_t    _time;
+};
+
+struct recorder : midi::processor
+{
+   using midi::processor::operator();
+
+   void operator()(midi::note_on msg, std::size_t time)
+   {
+      _events.push_back({ event::note_on, msg.key(), _base + time });
+   }
+
+   void operator()(midi::note_off msg, std::size_t time)
+   {
+      _events.push_back({ event::note_off, msg.key(), _base + time });
+   }
+
+   void operator()(midi::pitch_bend msg, std::size_t time)
+   {
+      _events.push_back({ event::pitch_bend, msg.value(), _base + time });
+   }
+
+   std::vector<event>   _events;
+   std::size_t          _base = 0;
+};
+
+// Generate a decaying note with harmonics, with an optional vibrato depth
+// (relative to freq) at 5.5Hz.
+void gen_note(
+   std::vector<float>& out, q::frequency freq
+ , std::size_t size, double depth = 0.0)
+{
+   double angle = 0;
+   for (std::size_t i = 0; i != size; ++i)
+   {
+      auto env = std::exp(-3.0 * i / sps);
+      out.push_back(env * (
+         0.3 * std::sin(2 * pi * angle)
+       + 0.4 * std::sin(2 * 2 * pi * angle)
+       + 0.3 * std::sin(3 * 2 * pi * angle)
+      ));
+      angle += double(freq) * (1 + depth * std::sin(2 * pi * 5.5 * i / sps)) / sps;
+   }
+}
+
+std::vector<event> track(std::vector<float> const& in, std::size_t block_size)
+{
+   q::note_tracker nt{ low_e * 0.8, high_e * 5, sps };
+   recorder rec;
+   for (std::size_t i = 0; i < in.size(); i += block_size)
+   {
+      rec._base = i;
+      nt.process(in.data() + i, std::min(block_size, in.size() - i), rec);
+   }
+   return rec._events;
+}
+
+std::vector<int> keys(std::vector<event> const& events, event::type type)
+{
+   std::vector<int> result;
+   for (auto const& e : events)
+      if (e._type == type)
+         result.push_back(e._value);
+   return result;
+}
+
+TEST_CASE("Test_notes")
+{
+   std::vector<float> in;
+   for (auto freq : { a, d, g, high_e })
+   {
+      gen_note(in, freq, sps / 2);
+      in.insert(in.end(), sps / 4, 0.0f);
+   }
+
+   auto events = track(in, 256);
+   CHECK(keys(events, event::note_on) == std::vector<int>{ 45, 50, 55, 64 });
+   CHECK(keys(events, event::note_off) == std::vector<int>{ 45, 50, 55, 64 });
+
+   // Each note is on until the silence, and in tune
+   std::size_t onset = 0;
+   int bend = midi::pitch_bend{ 0, 8192 }.value();
+   for (auto const& e : events)
+   {
+      switch (e._type)
+      {
+         case event::note_on:
+            CHECK(e._time >= onset);
+            CHECK(e._time < onset + sps / 10);
+            CHECK(std::abs(bend - 8192) < 8192 / 10); // 20 cents
+            break;
+
+         case event::note_off:
+            CHECK(e._time >= onset + sps / 2);
+            CHECK(e._time < onset + sps * 3 / 4);
+            onset += sps * 3 / 4;
+            break;
+
+         case event::pitch_bend:
+            bend = e._value;
+            break;
+      }
+   }
+
+   // Blocks give the same results
+   for (std::size_t block_size : { 1, 7, 4096 })
+   {
+      INFO("Block size: " << block_size);
+      CHECK(track(in, block_size) == events);
+   }
+}
+
+TEST_CASE("Test_legato")
+{
+   // A (110Hz) to C (130.81Hz) without a break
+   std::vector<float> in;
+   gen_note(in, a, sps / 2);
+   std::vector<float> note;
+   gen_note(note, C[3], sps / 2);
+   for (auto s : note)
+      in.push_back(s * std::exp(-1.5f));
+
+   auto events = track(in, 256);
+   CHECK(keys(events, event::note_on) == std::vector<int>{ 45, 48 });
+   CHECK(keys(events, event::note_off) == std::vector<int>{ 45 });
+}
+
+TEST_CASE("Test_vibrato")
+{
+   // +/- 3% (approx 1/2 semitone)
+   std::vector<float> in;
+   gen_note(in, g, sps, 0.03);
+
+   auto events = track(in, 256);
+   CHECK(keys(events, event::note_on) == std::vector<int>{ 55 });
+
+   // The pitch bends follow the vibrato (bend range: 2 semitones)
+   auto bends = keys(events, event::pitch_bend);
+   CHECK(bends.size() > 100);
+   auto [min, max] = std::minmax_element(bends.begin(), bends.end());
+   CHECK(*min < 8192 - 1500);
+   CHECK(*max > 8192 + 1500);
+   CHECK(*min > 8192 - 3000);
+   CHECK(*max < 8192 + 3000);
+}
@@ -3,9 +3,14 @@
 
    Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
 =============================================================================*/
+#define CATCH_CONFIG_MAIN
+#include <infra/catch.hpp>
+
 #include <q/support/literals.hpp>
 #include <q_io/audio_file.hpp>
 #include <q/fx/onset_detector.hpp>
+#include <algorithm>
+#include <cmath>
 #include <vector>
 #include "notes.hpp"
 
@@ -64,7 +69,7 @@ void process(std::string name, q::frequency f)
    process(name, in, sps, n * 1.1);
 }
 
-int main()
+TEST_CASE("Test_onset_detector")
 {
    process("1a-Low-E", low_e);
    process("1b-Low-E-12th", low_e);
@@ -72,8 +77,117 @@ int main()
    process("Hammer-Pull High E", high_e);
    process("Bend-Slide G", g);
    process("GStaccato", g);
+}
+
+constexpr auto sps = 44100;
+
+// A train of plucks: decaying harmonic tones, each one louder than what is
+// left of the previous one, starting at the given times.
+std::vector<float> gen_plucks(std::vector<std::size_t> const& starts)
+{
+   std::vector<float> signal(starts.back() + sps / 2);
+   for (std::size_t k = 0; k != starts.size(); ++k)
+   {
+      auto freq = double(k % 2? a : low_e);
+      auto end = (k + 1 < starts.size())? starts[k+1] : signal.size();
+      for (auto i = starts[k]; i != end; ++i)
+      {
+         auto t = double(i - starts[k]) / sps;
+         auto angle = 2_pi * freq * t;
+         signal[i] = 0.8 * std::exp(-8 * t)
+            * (0.5 * std::sin(angle) + 0.3 * std::sin(2 * angle) + 0.2 * std::sin(3 * angle));
+      }
+   }
+   return signal;
+}
+
+std::vector<std::size_t> const pluck_starts = {
+   sps / 10, sps / 2, sps, sps * 3 / 2, sps * 7 / 4, sps * 5 / 2
+};
+
+// The onsets, calling the function operator for each sample
+std::vector<std::size_t> onsets(q::onset_detector& od, std::vector<float> const& in)
+{
+   std::vector<std::size_t> r;
+   for (std::size_t i = 0; i != in.size(); ++i)
+      if (od(in[i]))
+         r.push_back(i);
+   return r;
+}
+
+TEST_CASE("Test_onset_detector_plucks")
+{
+   auto in = gen_plucks(pluck_starts);
+   auto od = q::onset_detector{ -36_dB, sps };
+   auto result = onsets(od, in);
 
-   return 0;
+   // One onset per pluck, within 2ms of its start
+   REQUIRE(result.size() == pluck_starts.size());
+   for (std::size_t i = 0; i != result.size(); ++i)
+   {
+      INFO("Pluck: " << i);
+      CHECK(result[i] >= pluck_starts[i]);
+      CHECK(result[i] < pluck_starts[i] + sps / 500);
+   }
 }
 
+TEST_CASE("Test_onset_detector_block")
+{
+   auto in = gen_plucks(pluck_starts);
+   auto ref = q::onset_detector{ -36_dB, sps };
+   auto expected = onsets(ref, in);
+   REQUIRE(expected.size() == pluck_starts.size());
+
+   // The block interface gives the same onsets as the function operator,
+   // for any block size. Truncating the output to max_onsets drops the
+   // extra offsets only: the detector state is the same.
+   for (std::size_t block_size : { 1, 64, 1000, sps / 2, sps * 4 })
+   {
+      for (std::size_t max_onsets : { 0, 1, 8 })
+      {
+         INFO("block_size: " << block_size << " max_onsets: " << max_onsets);
+         auto od = q::onset_detector{ -36_dB, sps };
+         std::vector<std::size_t> buff(max_onsets);
+         std::vector<std::size_t> result, full;
+
+         for (std::size_t pos = 0; pos < in.size(); pos += block_size)
+         {
+            auto n = std::min(block_size, in.size() - pos);
+            auto count = od.process(in.data() + pos, n, buff.data(), max_onsets);
+
+            // The first max_onsets of the expected onsets in this block
+            std::vector<std::size_t> block_expected;
+            for (auto i : expected)
+               if (i >= pos && i < pos + n && block_expected.size() != max_onsets)
+                  block_expected.push_back(i - pos);
+
+            REQUIRE(count == block_expected.size());
+            CHECK(std::equal(buff.begin(), buff.begin() + count, block_expected.begin()));
+            for (std::size_t i = 0; i != count; ++i)
+               result.push_back(buff[i] + pos);
+         }
+         if (max_onsets >= expected.size())
+            CHECK(result == expected);
+      }
+   }
+}
 
+TEST_CASE("Test_onset_detector_reset")
+{
+   auto in = gen_plucks(pluck_starts);
+
+   // Reset in the middle of a note: the detector starts from a clean
+   // state, the same as a new one.
+   auto od = q::onset_detector{ -36_dB, sps };
+   for (std::size_t i = 0; i != pluck_starts[1] + sps / 100; ++i)
+      od(in[i]);
+   od.reset();
+
+   // No onsets on silence
+   std::vector<float> silence(sps / 10, 0.0f);
+   CHECK(onsets(od, silence).empty());
+
+   od.reset();
+   auto fresh = q::onset_detector{ -36_dB, sps };
+   CHECK(onsets(od, in) == onsets(fresh, in));
+}
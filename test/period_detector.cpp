@@ -11,6 +11,8 @@
 #include <q_io/audio_file.hpp>
 
 #include <vector>
+#include <fstream>
+#include <sstream>
 #include <iostream>
 #include <tuple>
 #include <iostream>
@@ -50,7 +52,6 @@ result_type process(
    auto const&          bits = pd.bits();
    auto const&          edges = pd.edges();
 
-   q::bitstream_acf<>   bacf{ bits };
    auto                 min_period = float(highest_freq.period()) * sps;
 
    float y = 0.15;
@@ -113,7 +114,7 @@ result_type process(
             }
          }
 
-         auto frame = edges.frame() + (edges.window_size() / 2);
+         auto frame = edges.frame() + edges.hop_size();
          auto extra = frame - edges.window_size();
          auto size = bits.size();
 
@@ -129,12 +130,13 @@ result_type process(
 
          // Print the autocorrelation results
          {
+            auto const& acf = pd.correlogram();
             auto weight = 2.0 / size;
             auto out_i = (&out[ch3] - (((size-1) + extra) * n_channels));
             for (auto i = 0; i != size/2; ++i)
             {
                if (i > min_period)
-                  *out_i = 1.0f - (bacf(i) * weight);
+                  *out_i = 1.0f - (acf[i] * weight);
                out_i += n_channels;
             }
          }
@@ -663,3 +665,373 @@ TEST_CASE("Test_violin_range")
 
 
 
+
+TEST_CASE("Test_acf_cache")
+{
+   // Harmonically rich, low pitched: many edge pairs with the same period
+   q::wav_reader src{"audio_files/1a-Low-E.wav"};
+   REQUIRE(src);
+   std::vector<float> in(src.length());
+   src.read(in);
+
+   // The same detector, with and without the cache
+   q::period_detector pd(low_e * 0.8, low_e * 5, src.sps(), -45_dB);
+   q::period_detector ref(low_e * 0.8, low_e * 5, src.sps(), -45_dB);
+   ref.acf_cache(false);
+   CHECK(pd.acf_cache());
+   CHECK(!ref.acf_cache());
+
+   constexpr std::size_t n = 8;
+   float out[n], ref_out[n];
+   std::size_t windows = 0;
+   std::size_t windows_with_hits = 0;
+   for (auto s : in)
+   {
+      auto stats = pd.acf_cache_stats();
+      auto ref_stats = ref.acf_cache_stats();
+      bool ready = pd(s);
+      REQUIRE(ready == ref(s));
+      if (ready)
+      {
+         ++windows;
+         INFO("Window: " << windows);
+
+         // The cache does not change the results
+         CHECK(pd.fundamental()._period == ref.fundamental()._period);
+         CHECK(pd.fundamental()._periodicity == ref.fundamental()._periodicity);
+
+         // Without the cache, each lag requested is correlated: the
+         // correlations made with the cache (misses) and the ones saved
+         // (hits) add up to the same number of requests.
+         auto misses = pd.acf_cache_stats()._misses - stats._misses;
+         auto hits = pd.acf_cache_stats()._hits - stats._hits;
+         auto requests = ref.acf_cache_stats()._misses - ref_stats._misses;
+         CHECK(ref.acf_cache_stats()._hits == ref_stats._hits);
+         CHECK(misses + hits == requests);
+         CHECK((misses > 0) == (requests > 0));
+         if (hits > 0)
+            ++windows_with_hits;
+
+         // Each lag is correlated once per window: requesting the same
+         // lags again gives hits only, and the same values.
+         pd.harmonics(out, n);
+         ref.harmonics(ref_out, n);
+         CHECK(std::equal(out, out + n, ref_out));
+         auto lags = pd.acf_cache_stats()._misses - stats._misses;
+         auto ref_lags = ref.acf_cache_stats()._misses - ref_stats._misses;
+         pd.harmonics(out, n);
+         ref.harmonics(ref_out, n);
+         CHECK(std::equal(out, out + n, ref_out));
+         CHECK(pd.acf_cache_stats()._misses - stats._misses == lags);
+         CHECK(
+            ref.acf_cache_stats()._misses - ref_stats._misses
+            == ref_lags + (ref_lags - requests)
+         );
+      }
+   }
+   REQUIRE(windows > 0);
+   CHECK(windows_with_hits > 0);
+
+   auto const& stats = pd.acf_cache_stats();
+   CHECK(stats._hits > 0);
+   CHECK(stats._misses < ref.acf_cache_stats()._misses);
+
+   pd.reset_acf_cache_stats();
+   CHECK(pd.acf_cache_stats()._hits == 0);
+   CHECK(pd.acf_cache_stats()._misses == 0);
+}
+
+TEST_CASE("Test_harmonics")
+{
+   q::wav_reader src{"audio_files/GLines1.wav"};
+   REQUIRE(src);
+   std::vector<float> in(src.length());
+   src.read(in);
+
+   constexpr std::size_t n = 16;
+   q::period_detector pd(low_e * 0.8, low_e * 5, src.sps(), -45_dB);
+   std::size_t windows = 0;
+   std::size_t mismatches = 0;
+   for (auto s : in)
+   {
+      if (pd(s))
+      {
+         ++windows;
+
+         // The same as calling harmonic(i) for each i, on a copy with the
+         // same correlogram
+         auto ref = pd;
+         float out[n];
+         pd.harmonics(out, n);
+         for (std::size_t i = 0; i != n; ++i)
+            if (out[i] != ref.harmonic(i + 1))
+               ++mismatches;
+      }
+   }
+   REQUIRE(windows > 0);
+   CHECK(mismatches == 0);
+}
+
+TEST_CASE("Test_hop_size")
+{
+   q::wav_reader src{"audio_files/1a-Low-E.wav"};
+   REQUIRE(src);
+   std::vector<float> in(src.length());
+   src.read(in);
+
+   q::period_detector pd(low_e * 0.8, low_e * 5, src.sps(), -45_dB);
+   auto const window = pd.edges().window_size();
+   CHECK(pd.edges().hop_size() == window / 2);
+
+   std::size_t windows = 0;
+   for (auto s : in)
+      if (pd(s))
+         ++windows;
+   REQUIRE(windows > 0);
+
+   q::period_detector pd8(low_e * 0.8, low_e * 5, src.sps(), -45_dB, window / 8);
+   REQUIRE(pd8.edges().hop_size() == window / 8);
+
+   std::size_t windows8 = 0;
+   std::size_t mismatches = 0;
+   for (auto s : in)
+   {
+      if (pd8(s))
+      {
+         ++windows8;
+
+         // The shifted bitstream is the same as one built from scratch
+         auto const& edges = pd8.edges();
+         auto threshold = edges.peak_pulse() * q::period_detector::pulse_threshold;
+         q::bitset<> bits(window);
+         for (auto i = 0; i != edges.num_edges(); ++i)
+         {
+            auto const& info = edges[i];
+            if (info._peak >= threshold)
+            {
+               auto pos = std::max<int>(info._leading_edge, 0);
+               bits.set(pos, info._trailing_edge - pos, 1);
+            }
+         }
+         for (std::size_t i = 0; i != window; ++i)
+         {
+            if (bits.get(i) != pd8.bits().get(i))
+            {
+               ++mismatches;
+               break;
+            }
+         }
+      }
+   }
+
+   // Four times as many analyses
+   CHECK(windows8 >= windows * 3);
+   CHECK(mismatches == 0);
+}
+
+TEST_CASE("Test_edge_arrays")
+{
+   q::wav_reader src{"audio_files/GLines1.wav"};
+   REQUIRE(src);
+   std::vector<float> in(src.length());
+   src.read(in);
+
+   q::period_detector pd(low_e * 0.8, low_e * 5, src.sps(), -45_dB);
+   std::size_t windows = 0;
+   std::size_t mismatches = 0;
+   std::vector<int> strong(pd.edges().capacity());
+   for (auto s : in)
+   {
+      if (pd(s))
+      {
+         ++windows;
+
+         // The arrays are the same as the fields given by the index operator
+         auto const& edges = pd.edges();
+         for (std::size_t i = 0; i != edges.num_edges(); ++i)
+         {
+            auto info = edges[i];
+            if (edges.peaks()[i] != info._peak
+               || edges.leading_edges()[i] != info._leading_edge
+               || edges.trailing_edges()[i] != info._trailing_edge)
+               ++mismatches;
+         }
+
+         // Threshold filtering
+         auto threshold = edges.peak_pulse() * q::period_detector::pulse_threshold;
+         auto n = q::detail::select_at_least(
+            edges.peaks(), edges.num_edges(), threshold, strong.data());
+         std::size_t k = 0;
+         for (std::size_t i = 0; i != edges.num_edges(); ++i)
+         {
+            if (edges[i]._peak >= threshold)
+            {
+               if (k == n || strong[k] != int(i))
+                  ++mismatches;
+               ++k;
+            }
+         }
+         if (k != n)
+            ++mismatches;
+      }
+   }
+   REQUIRE(windows > 0);
+   CHECK(mismatches == 0);
+}
+
+// The exhaustive search for the latest similar edges
+float predict_period_scan(q::zero_crossing const& zc)
+{
+   if (zc.num_edges() > 1)
+   {
+      auto threshold = zc.peak_pulse() * q::period_detector::pulse_threshold;
+      for (int i = zc.num_edges()-1; i > 0; --i)
+      {
+         auto const& edge2 = zc[i];
+         if (edge2._peak >= threshold)
+         {
+            for (int j = i-1; j >= 0; --j)
+            {
+               auto const& edge1 = zc[j];
+               if (edge1.similar(edge2))
+                  return edge1.fractional_period(edge2);
+            }
+         }
+      }
+   }
+   return -1.0f;
+}
+
+TEST_CASE("Test_predict_period")
+{
+   auto test = [](std::vector<float> const& in, q::frequency lowest, q::frequency highest)
+   {
+      q::period_detector pd(lowest, highest, sps, -45_dB);
+      std::size_t predictions = 0;
+      std::size_t mismatches = 0;
+      for (auto s : in)
+      {
+         pd(s);
+         auto predicted = q::detail::predict_period(pd.edges());
+         if (predicted != predict_period_scan(pd.edges()))
+            ++mismatches;
+         if (predicted != -1.0f)
+            ++predictions;
+      }
+      CHECK(predictions > 0);
+      CHECK(mismatches == 0);
+   };
+
+   {
+      q::wav_reader src{"audio_files/GLines1.wav"};
+      REQUIRE(src);
+      std::vector<float> in(src.length());
+      src.read(in);
+      test(in, low_e * 0.8, high_e * 5);
+   }
+
+   // Noise gives many edges, with random peaks and widths
+   {
+      std::vector<float> in(sps);
+      for (auto& s : in)
+         s = (q::fast_rand() / float(0x7fff)) - 0.5f;
+      test(in, low_e * 0.8, high_e * 5);
+   }
+}
+
+TEST_CASE("Test_search_decimation")
+{
+   q::wav_reader src{"audio_files/GLines1.wav"};
+   REQUIRE(src);
+   std::vector<float> in(src.length());
+   src.read(in);
+
+   // A wide frequency range
+   auto const lowest = 30_Hz;
+   auto const highest = 1500_Hz;
+
+   std::vector<float> periods;
+   q::period_detector pd(lowest, highest, src.sps(), -45_dB);
+   CHECK(pd.search_decimation() == 1);
+   for (auto s : in)
+      if (pd(s))
+         periods.push_back(pd.fundamental()._period);
+   REQUIRE(periods.size() > 0);
+
+   for (std::size_t factor : { 2, 4, 8 })
+   {
+      q::period_detector pd2(lowest, highest, src.sps(), -45_dB);
+      pd2.search_decimation(factor);
+      CHECK(pd2.search_decimation() == factor);
+
+      std::size_t i = 0;
+      std::size_t agree = 0;
+      for (auto s : in)
+      {
+         if (pd2(s))
+         {
+            if (q::rel_within(pd2.fundamental()._period, periods[i], 0.01f))
+               ++agree;
+            ++i;
+         }
+      }
+      REQUIRE(i == periods.size());
+
+      INFO("Search decimation: " << factor);
+      CHECK(agree >= periods.size() * 0.98);
+   }
+
+   // Short windows are decimated less
+   q::period_detector pd3(high_e, high_e * 5, src.sps(), -45_dB);
+   pd3.search_decimation(8);
+   CHECK(pd3.search_decimation() < 8);
+
+   CHECK_THROWS(pd.search_decimation(3));
+   CHECK_THROWS(pd.search_decimation(16));
+}
+
+// The output of a default period_detector, compared to the output of the
+// original implementation, saved in golden/period_detector_<name>.csv: the
+// sample index, period and periodicity of each analysis. The zero crossing
+// restarts itself on silence, keeping its running peaks. That must not
+// change.
+void compare_baseline(std::string name, q::frequency lowest_freq, q::frequency highest_freq)
+{
+   q::wav_reader src{"audio_files/" + name + ".wav"};
+   REQUIRE(src);
+   auto const channels = src.num_channels();
+   std::vector<float> in(src.length() * channels);
+   src.read(in);
+
+   std::ifstream golden("golden/period_detector_" + name + ".csv");
+   REQUIRE(golden);
+
+   q::period_detector pd(lowest_freq, highest_freq, src.sps(), -45_dB);
+   std::size_t line = 0;
+   std::string expected;
+   for (std::size_t i = 0; i < in.size(); i += channels)
+   {
+      if (pd(in[i]))
+      {
+         INFO("In test: \"" << name << "\", line: " << line);
+         REQUIRE(std::getline(golden, expected));
+         std::istringstream is{ expected };
+         std::size_t index;
+         float period, periodicity;
+         char comma;
+         is >> index >> comma >> period >> comma >> periodicity;
+         REQUIRE(i / channels == index);
+         CHECK(pd.fundamental()._period == Approx(period));
+         CHECK(pd.fundamental()._periodicity == Approx(periodicity));
+         ++line;
+      }
+   }
+   CHECK(!std::getline(golden, expected));
+}
+
+TEST_CASE("Test_baseline")
+{
+   compare_baseline("1a-Low-E", 65.9_Hz, 6592_Hz);
+   compare_baseline("Slide G", 65.9_Hz, 412_Hz);
+   compare_baseline("-2a-F#", 352_Hz, 2200_Hz);
+}
@@ -0,0 +1,123 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#define CATCH_CONFIG_MAIN
+#include <infra/catch.hpp>
+
+#include <q/support/literals.hpp>
+#include <q/pitch/pitch_analyzer.hpp>
+#include <q_io/audio_file.hpp>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "notes.hpp"
+
+namespace q = cycfi::q;
+using namespace q::literals;
+using namespace notes;
+
+// Reference: a single pitch_detector, processing sample by sample
+q::pitch_analyzer::track reference(
+   std::vector<float> const& in
+ , q::frequency lowest_freq
+ , q::frequency highest_freq
+ , std::uint32_t sps
+)
+{
+   q::pitch_analyzer::track result;
+   q::pitch_detector pd{ lowest_freq, highest_freq, sps, -45_dB };
+   for (std::size_t i = 0; i != in.size(); ++i)
+   {
+      if (pd(in[i]))
+         result.push_back({ i, pd.get_frequency(), pd.periodicity() });
+   }
+   return result;
+}
+
+void check(
+   q::pitch_analyzer::track const& track
+ , q::pitch_analyzer::track const& ref
+)
+{
+   REQUIRE(track.size() == ref.size());
+   for (std::size_t i = 0; i != track.size(); ++i)
+   {
+      INFO("Point: " << i << ", position: " << ref[i].position);
+      REQUIRE(track[i] == ref[i]);
+   }
+}
+
+void test_file(std::string name, q::frequency lowest_freq, q::frequency highest_freq)
+{
+   INFO("File: " << name);
+
+   q::wav_reader src{"audio_files/" + name + ".wav"};
+   REQUIRE(src);
+   std::uint32_t const sps = src.sps();
+
+   std::vector<float> in(src.length());
+   src.read(in);
+   auto ref = reference(in, lowest_freq, highest_freq, sps);
+   REQUIRE(ref.size() > 0);
+
+   // Small segments, so that the analysis windows span the segment
+   // boundaries, and segments with no analysis windows at all.
+   for (std::size_t segment_size : { 100, 997, 8192 })
+   {
+      for (std::size_t num_threads : { 1, 3 })
+      {
+         INFO("Segment size: " << segment_size << ", threads: " << num_threads);
+         q::pitch_analyzer pa{ lowest_freq, highest_freq, sps, -45_dB, num_threads, segment_size };
+         check(pa(in.data(), in.size()), ref);
+      }
+   }
+
+   // Reading directly from the file
+   src.restart();
+   q::pitch_analyzer pa{ lowest_freq, highest_freq, sps, -45_dB, 2 };
+   check(pa(src), ref);
+}
+
+TEST_CASE("Test_low_E")
+{
+   test_file("1a-Low-E", low_e * 0.8, low_e * 5);
+}
+
+TEST_CASE("Test_G")
+{
+   test_file("4a-G", low_e * 0.8, low_e * 5);
+}
+
+TEST_CASE("Test_high_E")
+{
+   test_file("6a-High-E", low_e * 0.8, low_e * 5);
+}
+
+// A reader that fails after a few segments
+struct failing_reader
+{
+   std::size_t read(float* data, std::size_t n)
+   {
+      if (count++ == 8)
+         throw std::runtime_error("Error: read failed.");
+      std::fill(data, data + n, (count % 2)? 0.5f : -0.5f);
+      return n;
+   }
+
+   std::size_t count = 0;
+};
+
+TEST_CASE("Test_read_error")
+{
+   // The exception must reach the caller, with the workers stopped
+   for (std::size_t num_threads : { 1, 3 })
+   {
+      failing_reader src;
+      q::pitch_analyzer pa{ low_e * 0.8, low_e * 5, 44100, -45_dB, num_threads, 1000 };
+      REQUIRE_THROWS_AS(pa(src), std::runtime_error);
+      CHECK(src.count == 9);
+   }
+}
@@ -8,7 +8,10 @@
 
 #include <q/support/literals.hpp>
 #include <q/pitch/pitch_detector.hpp>
+#include <q/pitch/decimating_pitch_detector.hpp>
+#include <q_io/audio_file.hpp>
 
+#include <type_traits>
 #include <vector>
 #include <iostream>
 #include "notes.hpp"
@@ -30,24 +33,19 @@ struct test_result
    float max_error = 0.0f;
 };
 
-test_result process(
-   std::vector<float>&& in
+template <typename Detector>
+test_result measure(
+   std::vector<float> const& in
  , q::frequency actual_frequency
- , q::frequency lowest_freq
- , q::frequency highest_freq
- , std::string name = "")
+ , Detector& pd)
 {
    if (verbosity > 1)
       std::cout << fixed << "Actual Frequency: "
       << double(actual_frequency) << std::endl;
 
-   if (name.empty())
-      name = std::to_string(int(double(actual_frequency)));
-
    ////////////////////////////////////////////////////////////////////////////
    // Process
 
-   q::pitch_detector    pd(lowest_freq, highest_freq, sps, -45_dB);
    auto                 result = test_result{};
    auto                 frames = 0;
 
@@ -88,6 +86,17 @@ test_result process(
    return result;
 }
 
+test_result process(
+   std::vector<float>&& in
+ , q::frequency actual_frequency
+ , q::frequency lowest_freq
+ , q::frequency highest_freq
+ , std::string name = "")
+{
+   q::pitch_detector pd(lowest_freq, highest_freq, sps, -45_dB);
+   return measure(in, actual_frequency, pd);
+}
+
 struct params
 {
    float _offset = 0.0f;         // Waveform offset
@@ -337,3 +346,476 @@ TEST_CASE("Test_missing_fundamental")
 
 
 
+
+TEST_CASE("Test_block_processing")
+{
+   // Notes separated by silence, so that we also go through resets
+   std::vector<float> signal;
+   for (auto freq : { low_e, a, g_12th, high_e })
+   {
+      auto note = gen_harmonics(freq, params{});
+      for (auto i = 0; i != note.size(); ++i)
+         note[i] *= std::exp(-3.0f * i / note.size());
+      signal.insert(signal.end(), note.begin(), note.begin() + sps / 2);
+      signal.insert(signal.end(), sps / 4, 0.0f);
+   }
+
+   // Per-sample reference
+   std::vector<std::pair<std::size_t, float>> expected;
+   {
+      q::pitch_detector pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      for (auto i = 0; i != signal.size(); ++i)
+         if (pd(signal[i]))
+            expected.emplace_back(i, pd.get_frequency());
+   }
+   REQUIRE(expected.size() > 0);
+
+   for (std::size_t block_size : { 1, 7, 64, 480, 4096 })
+   {
+      INFO("Block size: " << block_size);
+      q::pitch_detector pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      std::vector<std::pair<std::size_t, float>> result;
+      for (std::size_t i = 0; i < signal.size(); i += block_size)
+      {
+         auto n = std::min(block_size, signal.size() - i);
+         pd.process(signal.data() + i, n,
+            [&](std::size_t offset)
+            {
+               result.emplace_back(i + offset, pd.get_frequency());
+            }
+         );
+      }
+      CHECK(result == expected);
+   }
+}
+
+TEST_CASE("Test_static_capacity")
+{
+   // Enough for two periods of the lowest frequency (see below)
+   constexpr std::size_t max_window = 2048;
+   using static_pitch_detector = q::basic_pitch_detector<max_window>;
+
+   static_assert(std::is_trivially_copyable<static_pitch_detector>::value,
+      "static_pitch_detector should be trivially copyable");
+
+   std::vector<float> signal;
+   for (auto freq : { low_e, a, g_12th, high_e })
+   {
+      auto note = gen_harmonics(freq, params{});
+      signal.insert(signal.end(), note.begin(), note.begin() + sps / 2);
+      signal.insert(signal.end(), sps / 4, 0.0f);
+   }
+
+   // The static variant gives the same results as the dynamic one, with
+   // windows less than or equal to max_window.
+   for (auto lowest_freq : { low_e * 0.8, a * 0.8 })
+   {
+      q::pitch_detector pd(lowest_freq, high_e * 5, sps, -45_dB);
+      static_pitch_detector spd(lowest_freq, high_e * 5, sps, -45_dB);
+      REQUIRE(spd.edges().window_size() == pd.edges().window_size());
+      REQUIRE(spd.edges().capacity() == pd.edges().capacity());
+
+      std::vector<std::pair<std::size_t, float>> expected, result;
+      for (auto i = 0; i != signal.size(); ++i)
+      {
+         if (pd(signal[i]))
+            expected.emplace_back(i, pd.get_frequency());
+         if (spd(signal[i]))
+            result.emplace_back(i, spd.get_frequency());
+      }
+      REQUIRE(expected.size() > 0);
+      CHECK(result == expected);
+   }
+
+   // The window should not exceed max_window
+   REQUIRE_THROWS(static_pitch_detector(low_e * 0.4, high_e * 5, sps, -45_dB));
+}
+
+TEST_CASE("Test_lazy_analysis")
+{
+   std::vector<float> signal;
+   for (auto freq : { low_e, a, g_12th, high_e })
+   {
+      auto note = gen_harmonics(freq, params{});
+      for (auto i = 0; i != note.size(); ++i)
+         note[i] *= std::exp(-3.0f * i / note.size());
+      signal.insert(signal.end(), note.begin(), note.begin() + sps / 2);
+      signal.insert(signal.end(), sps / 4, 0.0f);
+   }
+
+   // Querying right after each window gives the same results
+   {
+      q::pitch_detector pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      q::pitch_detector lazy_pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      lazy_pd.lazy_analysis(true);
+
+      std::vector<std::pair<std::size_t, float>> expected, result;
+      for (auto i = 0; i != signal.size(); ++i)
+      {
+         if (pd(signal[i]))
+            expected.emplace_back(i, pd.get_frequency());
+         if (lazy_pd(signal[i]))
+         {
+            REQUIRE(lazy_pd.get_period_detector().is_pending() == false);
+            result.emplace_back(i, lazy_pd.get_frequency());
+         }
+      }
+      REQUIRE(expected.size() > 0);
+      CHECK(result == expected);
+   }
+
+   // Querying once per block: only the latest window is analyzed. The
+   // frequency tracking may then differ at the note onsets, where the
+   // skipped windows matter.
+   {
+      constexpr std::size_t block_size = 2048;
+      q::pitch_detector pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      q::pitch_detector lazy_pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      lazy_pd.lazy_analysis(true);
+
+      std::size_t blocks = 0;
+      std::size_t mismatches = 0;
+      for (std::size_t i = 0; i < signal.size(); i += block_size)
+      {
+         auto n = std::min(block_size, signal.size() - i);
+         pd.process(signal.data() + i, n);
+         lazy_pd.process(signal.data() + i, n);
+         auto f = pd.get_frequency();
+         auto lazy_f = lazy_pd.get_frequency();
+         if (f != 0.0f && lazy_f != 0.0f)
+         {
+            ++blocks;
+            if (std::abs(1200.0 * std::log2(lazy_f / f)) > 1.0)
+               ++mismatches;
+         }
+      }
+      CHECK(blocks > 20);
+      CHECK(mismatches <= 4);
+   }
+
+   // Querying some time after each window gives the same results as
+   // querying right away. This includes the windows that are not periodic
+   // enough, where the frequency predicted from the edges of the window
+   // may be taken instead (see bias). The edges that came after the window
+   // do not matter.
+   {
+      q::wav_reader src{"audio_files/Tapping D.wav"};
+      REQUIRE(src);
+      std::vector<float> in(src.length());
+      src.read(in);
+
+      constexpr std::size_t delay = 64;
+      using pd_type = q::pitch_detector;
+      pd_type pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      pd_type lazy_pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      lazy_pd.lazy_analysis(true);
+
+      std::vector<std::pair<std::size_t, float>> expected, result;
+      std::size_t query = 0;
+      std::size_t predictions = 0;
+      float predicted = -1.0f;
+      float periodicity = 0.0f;
+      for (std::size_t i = 0; i != in.size(); ++i)
+      {
+         if (pd(in[i]))
+         {
+            expected.emplace_back(i, pd.get_frequency());
+            predicted = q::detail::predict_period(pd.edges());
+            periodicity = pd.periodicity();
+         }
+         if (lazy_pd(in[i]))
+         {
+            REQUIRE(query == 0);    // No window is skipped
+            query = i + delay;
+         }
+         if (query && i == query)
+         {
+            result.emplace_back(query - delay, lazy_pd.get_frequency());
+            query = 0;
+
+            // The low periodicity windows, where the edges changed since
+            auto const& period_detector = pd.get_period_detector();
+            if (periodicity > pd_type::min_periodicity
+               && periodicity < pd_type::max_deviation
+               && q::detail::predict_period(period_detector.edges()) != predicted)
+               ++predictions;
+         }
+      }
+      REQUIRE(expected.size() > 100);
+      CHECK(predictions > 10);
+      CHECK(result == expected);
+   }
+
+   // The analysis does not run without a query
+   {
+      q::period_detector pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      pd.lazy_analysis(true);
+      CHECK(pd.process(signal.data(), sps / 2));
+      CHECK(pd.is_pending());
+      CHECK(pd.acf_cache_stats()._misses == 0);
+      CHECK(pd.fundamental()._period == -1);
+
+      CHECK(pd.analyze());
+      CHECK(!pd.is_pending());
+      CHECK(pd.fundamental()._period > 0);
+      CHECK(pd.acf_cache_stats()._misses > 0);
+      CHECK(!pd.analyze());
+   }
+}
+
+TEST_CASE("Test_fast_onset")
+{
+   for (auto freq : { a, g_12th, high_e, high_e_12th })
+   {
+      INFO("Frequency: " << double(freq));
+      auto note = gen_harmonics(freq, params{});
+      q::pitch_detector pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      q::pitch_detector fast_pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      fast_pd.fast_onset(true);
+
+      std::size_t first = 0, first_provisional = 0;
+      std::vector<std::pair<std::size_t, float>> expected, result;
+      for (auto i = 0; i != note.size(); ++i)
+      {
+         if (pd(note[i]) && pd.get_frequency() != 0.0f)
+         {
+            if (!first)
+               first = i;
+            expected.emplace_back(i, pd.get_frequency());
+         }
+         if (fast_pd(note[i]) && fast_pd.get_frequency() != 0.0f)
+         {
+            if (fast_pd.is_provisional())
+            {
+               if (!first_provisional)
+               {
+                  first_provisional = i;
+                  CHECK(std::abs(fast_pd.get_frequency() - double(freq)) < double(freq) * 0.01);
+               }
+            }
+            else
+            {
+               result.emplace_back(i, fast_pd.get_frequency());
+            }
+         }
+      }
+
+      // The provisional estimate comes before the first full analysis,
+      // and the full analyses are not affected.
+      REQUIRE(first > 0);
+      CHECK(first_provisional > 0);
+      CHECK(first_provisional < first);
+      CHECK(!fast_pd.is_provisional());
+      CHECK(result == expected);
+   }
+}
+
+TEST_CASE("Test_cycle_tracking")
+{
+   // Vibrato: 5.5 Hz, +/- 3% (approx 1/2 semitone)
+   constexpr auto rate = 5.5;
+   constexpr auto depth = 0.03;
+   for (auto freq : { low_e, a, g_12th, high_e })
+   {
+      INFO("Frequency: " << double(freq));
+      std::vector<float> signal(sps);
+      std::vector<double> phase(sps);
+      double angle = 0;
+      for (auto i = 0; i != sps; ++i)
+      {
+         phase[i] = angle;
+         signal[i] = 0.3 * std::sin(2 * pi * angle)
+            + 0.4 * std::sin(2 * 2 * pi * angle)
+            + 0.3 * std::sin(3 * 2 * pi * angle);
+         angle += double(freq) * (1 + depth * std::sin(2 * pi * rate * i / sps)) / sps;
+      }
+
+      // The actual frequency of the cycle ending at sample i
+      auto actual = [&](std::size_t i)
+      {
+         auto f = double(freq) * (1 + depth * std::sin(2 * pi * rate * i / sps));
+         auto start = i - std::size_t(sps / f);
+         return sps * (phase[i] - phase[start]) / (i - start);
+      };
+
+      q::pitch_detector pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+      pd.cycle_tracking(true);
+
+      std::vector<std::pair<std::size_t, float>> expected;
+      float cycle_error = 0.0f, analysis_error = 0.0f;
+      for (auto i = 0; i != signal.size(); ++i)
+      {
+         if (pd(signal[i]) && i > sps / 4)
+         {
+            auto error = std::abs(pd.get_frequency() / actual(i) - 1);
+            analysis_error = std::max<float>(analysis_error, error);
+         }
+         if (pd.is_new_cycle())
+         {
+            expected.emplace_back(i, pd.cycle_frequency());
+            if (i > sps / 4)
+            {
+               auto error = std::abs(pd.cycle_frequency() / actual(i) - 1);
+               cycle_error = std::max<float>(cycle_error, error);
+            }
+         }
+      }
+
+      // There is a cycle frequency for (almost) every cycle, and it follows
+      // the vibrato closer than the frequency of the analyses.
+      CHECK(expected.size() > 0.9 * double(freq));
+      CHECK(cycle_error < 0.005f);
+      CHECK(cycle_error < analysis_error);
+
+      // Blocks give the same results
+      for (std::size_t block_size : { 7, 480, 4096 })
+      {
+         INFO("Block size: " << block_size);
+         q::pitch_detector pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+         pd.cycle_tracking(true);
+         std::vector<std::pair<std::size_t, float>> result;
+         for (std::size_t i = 0; i < signal.size(); i += block_size)
+         {
+            auto n = std::min(block_size, signal.size() - i);
+            pd.process(signal.data() + i, n, [](std::size_t) {},
+               [&](std::size_t offset)
+               {
+                  result.emplace_back(i + offset, pd.cycle_frequency());
+               }
+            );
+         }
+         CHECK(result == expected);
+      }
+   }
+}
+
+TEST_CASE("Test_reset")
+{
+   auto read = [](char const* name)
+   {
+      q::wav_reader src{std::string{"audio_files/"} + name + ".wav"};
+      REQUIRE(src);
+      std::vector<float> in(src.length());
+      src.read(in);
+      return in;
+   };
+
+   // After a reset, e.g. when the input is gated, the detector starts the
+   // next note from a clean state: the same as a new detector. None of
+   // the previous note's frequencies are held by the median filters.
+   char const* notes[] = {
+      "2a-A", "1a-Low-E", "4a-G", "6a-High-E", "Tapping D", "GLines1"
+   };
+   for (auto first : notes)
+   {
+      for (auto second : notes)
+      {
+         INFO("First: " << first << " second: " << second);
+         auto in1 = read(first);
+         auto in2 = read(second);
+
+         q::pitch_detector pd(low_e * 0.8, high_e * 5, sps, -45_dB);
+         q::pitch_detector fresh(low_e * 0.8, high_e * 5, sps, -45_dB);
+         // Reset in the middle of the first note
+         std::size_t windows = 0;
+         for (std::size_t i = 0; i != in1.size() && windows != 20; ++i)
+         {
+            if (pd(in1[i]) && pd.get_frequency() != 0.0f)
+               ++windows;
+         }
+         REQUIRE(windows == 20);
+         pd.reset();
+         CHECK(pd.get_frequency() == 0.0f);
+
+         std::vector<std::pair<std::size_t, float>> expected, result;
+         for (std::size_t i = 0; i != in2.size(); ++i)
+         {
+            if (fresh(in2[i]))
+               expected.emplace_back(i, fresh.get_frequency());
+            if (pd(in2[i]))
+               result.emplace_back(i, pd.get_frequency());
+         }
+         REQUIRE(expected.size() > 0);
+         CHECK(result == expected);
+      }
+   }
+}
+
+TEST_CASE("Test_decimating")
+{
+   std::vector<float> signal;
+   for (auto freq : { low_e, a, d, low_e_12th })
+   {
+      auto note = gen_harmonics(freq, params{});
+      signal.insert(signal.end(), note.begin(), note.begin() + sps / 2);
+      signal.insert(signal.end(), sps / 4, 0.0f);
+   }
+
+   for (std::size_t factor : { 2, 4, 8 })
+   {
+      INFO("Factor: " << factor);
+      q::decimating_pitch_detector pd(low_e * 0.8, low_e * 5, sps, -45_dB, factor);
+      REQUIRE(pd.factor() == factor);
+
+      // Per-sample
+      std::vector<std::pair<std::size_t, float>> expected;
+      for (auto i = 0; i != signal.size(); ++i)
+         if (pd(signal[i]))
+            expected.emplace_back(i, pd.get_frequency());
+      REQUIRE(expected.size() > 0);
+
+      // The frequencies are refined at the full rate. With a factor of 8,
+      // the analysis at the reduced rate may give an octave error or two at
+      // the onset.
+      for (auto freq : { low_e, a, d, low_e_12th })
+      {
+         q::decimating_pitch_detector pd(low_e * 0.8, low_e * 5, sps, -45_dB, factor);
+         auto result = measure(gen_harmonics(freq, params{}), freq, pd);
+         CHECK(result.min_error < 0.01f);
+         if (factor < 8)
+            CHECK(result.max_error < 0.01f);
+      }
+
+      // Blocks give the same results
+      for (std::size_t block_size : { 7, 480, 4096 })
+      {
+         INFO("Block size: " << block_size);
+         q::decimating_pitch_detector pd(low_e * 0.8, low_e * 5, sps, -45_dB, factor);
+         std::vector<std::pair<std::size_t, float>> result;
+         for (std::size_t i = 0; i < signal.size(); i += block_size)
+         {
+            auto n = std::min(block_size, signal.size() - i);
+            pd.process(signal.data() + i, n,
+               [&](std::size_t offset)
+               {
+                  result.emplace_back(i + offset, pd.get_frequency());
+               }
+            );
+         }
+         CHECK(result == expected);
+      }
+
+      // After a reset (in the middle of a note, and of a group of factor
+      // frames), the results are the same as those of a new detector.
+      {
+         q::decimating_pitch_detector pd(low_e * 0.8, low_e * 5, sps, -45_dB, factor);
+         for (std::size_t i = 0; i != sps / 4 + 1; ++i)
+            pd(signal[i]);
+         pd.reset();
+         CHECK(pd.get_frequency() == 0.0f);
+
+         std::vector<std::pair<std::size_t, float>> result;
+         for (auto i = 0; i != signal.size(); ++i)
+            if (pd(signal[i]))
+               result.emplace_back(i, pd.get_frequency());
+         CHECK(result == expected);
+      }
+   }
+
+   // The factor is reduced for higher frequencies
+   q::decimating_pitch_detector pd(high_e * 0.8, high_e * 5, sps, -45_dB, 8);
+   CHECK(pd.factor() < 8);
+
+   REQUIRE_THROWS(q::decimating_pitch_detector(low_e * 0.8, low_e * 5, sps, -45_dB, 3));
+   REQUIRE_THROWS(q::decimating_pitch_detector(low_e * 0.8, low_e * 5, sps, -45_dB, 16));
+}
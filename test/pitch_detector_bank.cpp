@@ -0,0 +1,127 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#define CATCH_CONFIG_MAIN
+#include <infra/catch.hpp>
+
+#include <q/support/literals.hpp>
+#include <q/pitch/pitch_detector_bank.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "notes.hpp"
+
+namespace q = cycfi::q;
+using namespace q::literals;
+using namespace notes;
+
+constexpr auto pi = q::pi;
+constexpr auto sps = 44100;
+constexpr auto block_size = 128;
+
+// Enough for two periods of the lowest frequency (see below)
+constexpr std::size_t max_window = 2048;
+constexpr std::size_t num_strings = 6;
+using bank = q::pitch_detector_bank<num_strings, max_window>;
+
+bank::frequencies const strings = { low_e, a, d, g, b, high_e };
+
+// Each string plays its open note, starting at a different time
+std::vector<float> gen_string(std::size_t string)
+{
+   auto period = double(sps / strings[string]);
+   std::size_t start = string * sps / 20;
+   std::vector<float> signal(sps);
+   for (auto i = start; i < signal.size(); ++i)
+   {
+      auto angle = (i - start) / period;
+      signal[i] = 0.3 * std::sin(2 * pi * angle)
+         + 0.4 * std::sin(2 * 2 * pi * angle)
+         + 0.3 * std::sin(3 * 2 * pi * angle);
+   }
+   return signal;
+}
+
+void test_bank(std::size_t num_workers)
+{
+   INFO("Workers: " << num_workers);
+
+   std::vector<std::vector<float>> signals;
+   for (std::size_t i = 0; i != num_strings; ++i)
+      signals.push_back(gen_string(i));
+
+   auto lowest = strings;
+   auto highest = strings;
+   for (std::size_t i = 0; i != num_strings; ++i)
+   {
+      lowest[i] = strings[i] * 0.8;
+      highest[i] = strings[i] * 5;
+   }
+
+   // The channels are stored in the bank itself
+   static_assert(sizeof(bank) >= num_strings * sizeof(bank::pitch_detector_type));
+   static_assert(std::is_trivially_copyable<bank::pitch_detector_type>::value);
+
+   auto pdb_ptr = std::make_unique<bank>(lowest, highest, sps, -45_dB, num_workers);
+   auto& pdb = *pdb_ptr;
+   CHECK(pdb.num_workers() == num_workers);
+   for (std::size_t i = 0; i != num_strings; ++i)
+      CHECK(reinterpret_cast<std::uintptr_t>(&pdb[i]) % bank::cache_line_size == 0);
+
+   // Reference: independent pitch detectors
+   std::vector<q::pitch_detector> ref;
+   for (std::size_t i = 0; i != num_strings; ++i)
+      ref.emplace_back(lowest[i], highest[i], sps, -45_dB);
+
+   std::size_t total_ready = 0;
+   for (std::size_t pos = 0; pos + block_size <= sps; pos += block_size)
+   {
+      float const* in[num_strings];
+      for (std::size_t i = 0; i != num_strings; ++i)
+         in[i] = signals[i].data() + pos;
+
+      pdb.process(in, block_size);
+
+      for (std::size_t i = 0; i != num_strings; ++i)
+      {
+         std::size_t num_ready = 0;
+         std::size_t offset = 0;
+         for (std::size_t j = 0; j != block_size; ++j)
+         {
+            if (ref[i](in[i][j]))
+            {
+               ++num_ready;
+               offset = j;
+            }
+         }
+
+         REQUIRE(pdb.num_ready(i) == num_ready);
+         REQUIRE(pdb.is_ready(i) == (num_ready != 0));
+         if (num_ready)
+            REQUIRE(pdb.ready_offset(i) == offset);
+         REQUIRE(pdb.get_frequency(i) == ref[i].get_frequency());
+         REQUIRE(pdb.periodicity(i) == ref[i].periodicity());
+         total_ready += num_ready;
+      }
+   }
+   CHECK(total_ready > 0);
+
+   // All strings should have settled on their notes
+   for (std::size_t i = 0; i != num_strings; ++i)
+      CHECK(pdb.get_frequency(i) == Approx(double(strings[i])).epsilon(0.01));
+}
+
+TEST_CASE("Test_serial")
+{
+   test_bank(0);
+}
+
+TEST_CASE("Test_workers")
+{
+   test_bank(1);
+   test_bank(3);
+}
@@ -33,6 +33,7 @@ int get_num(std::string const& s, int pos, float& num)
 }
 
 constexpr bool skip_tests = true;
+constexpr std::size_t search_decimation = 1; // See period_detector
 constexpr auto break_time = 100.0;
 
 void break_debug() // seconds
@@ -107,9 +108,9 @@ void process(
    ////////////////////////////////////////////////////////////////////////////
    // Process
    q::pitch_detector          pd{ lowest_freq, highest_freq, sps, -40_dB };
+   pd.search_decimation(search_decimation);
    auto const&                bits = pd.bits();
    auto const&                edges = pd.edges();
-   q::bitstream_acf<>         bacf{ bits };
    auto                       min_period = float(highest_freq.period()) * sps;
 
    q::peak_envelope_follower  env{ 30_ms, sps };
@@ -177,7 +178,7 @@ void process(
 
       if (ready)
       {
-         auto frame = edges.frame() + (edges.window_size() / 2);
+         auto frame = edges.frame() + edges.hop_size();
          auto extra = frame - edges.window_size();
          auto size = bits.size();
 
@@ -193,12 +194,13 @@ void process(
 
          // Print the autocorrelation results
          {
+            auto const& acf = pd.get_period_detector().correlogram();
             auto weight = 2.0 / size;
             auto out_i = (&out[ch3] - (((size-1) + extra) * n_channels));
             for (auto i = 0; i != size/2; ++i)
             {
                if (i > min_period)
-                  *out_i = 1.0f - (bacf(i) * weight);
+                  *out_i = 1.0f - (acf[i] * weight);
                out_i += n_channels;
             }
          }
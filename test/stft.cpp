@@ -0,0 +1,139 @@
+/*=============================================================================
+   Copyright (c) 2014-2020 Joel de Guzman. All rights reserved.
+
+   Distributed under the MIT License [ https://opensource.org/licenses/MIT ]
+=============================================================================*/
+#define CATCH_CONFIG_MAIN
+#include <infra/catch.hpp>
+
+#include <q/support/literals.hpp>
+#include <q/fft/stft.hpp>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace q = cycfi::q;
+using namespace q::literals;
+using q::window_type;
+
+// Windows are computed at compile time
+static_assert(q::window_table<window_type::hann, 1024>[0] == 0.0f);
+static_assert(q::window_table<window_type::hann, 1024>[512] == 1.0f);
+static_assert(q::window_table<window_type::rectangular, 16>[7] == 1.0f);
+
+std::vector<float> random_signal(std::size_t n)
+{
+   std::mt19937 gen(n);
+   std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+   std::vector<float> r(n);
+   for (auto& x : r)
+      x = dist(gen);
+   return r;
+}
+
+// Process in blocks of block_size. Returns the output.
+template <typename STFT, typename F>
+std::vector<float> process(
+   STFT& stft, std::vector<float> const& in, std::size_t block_size, F&& f)
+{
+   std::vector<float> out(in.size());
+   for (std::size_t i = 0; i < in.size(); i += block_size)
+   {
+      auto n = std::min(block_size, in.size() - i);
+      stft.process(in.data() + i, out.data() + i, n, f);
+   }
+   return out;
+}
+
+template <std::size_t N, window_type W>
+void test_reconstruction(std::size_t hop, std::size_t block_size)
+{
+   INFO("N: " << N << " window: " << int(W) << " hop: " << hop << " block: " << block_size);
+
+   q::stft<N, W> stft{ hop };
+   auto in = random_signal(N * 8);
+   std::size_t frames = 0;
+   auto out = process(stft, in, block_size, [&](float*) { ++frames; });
+
+   CHECK(frames == in.size() / hop);
+
+   // The output is the input, delayed by the latency (before that, the
+   // output is zero, within rounding errors)
+   auto latency = stft.latency();
+   float error = 0;
+   for (std::size_t i = 0; i != latency; ++i)
+      error = std::max(error, std::abs(out[i]));
+   for (std::size_t i = latency; i != in.size(); ++i)
+      error = std::max(error, std::abs(out[i] - in[i - latency]));
+   CHECK(error < 1e-5);
+}
+
+TEST_CASE("Test_stft_reconstruction")
+{
+   // 75% overlap
+   test_reconstruction<1024, window_type::hann>(256, 1);
+   test_reconstruction<1024, window_type::hann>(256, 7);
+   test_reconstruction<1024, window_type::hann>(256, 4096);
+   test_reconstruction<256, window_type::hamming>(64, 100);
+   test_reconstruction<256, window_type::blackman>(64, 100);
+   test_reconstruction<256, window_type::blackman_harris>(64, 100);
+
+   // 50%, 87.5% and no overlap
+   test_reconstruction<512, window_type::hann>(256, 33);
+   test_reconstruction<512, window_type::blackman_harris>(64, 33);
+   test_reconstruction<64, window_type::rectangular>(64, 5);
+   test_reconstruction<64, window_type::hamming>(64, 5);
+
+   CHECK_THROWS(q::stft<1024>{ 0 });
+   CHECK_THROWS(q::stft<1024>{ 300 });
+   CHECK_THROWS(q::stft<1024>{ 2048 });
+
+   // No overlap, with windows that are zero at the ends
+   CHECK_THROWS(q::stft<64, window_type::hann>{ 64 });
+   CHECK_THROWS(q::stft<64, window_type::blackman>{ 64 });
+   CHECK_THROWS(q::stft<64, window_type::blackman_harris>{ 64 });
+}
+
+TEST_CASE("Test_stft_spectrum")
+{
+   // A sine at bin 32 gives a peak in bin 32
+   constexpr std::size_t n = 1024;
+   constexpr std::size_t bin = 32;
+   std::vector<float> in(n * 4);
+   for (std::size_t i = 0; i != in.size(); ++i)
+      in[i] = std::sin(2_pi * i * bin / n);
+
+   q::stft<n> stft{ n/4 };
+   std::size_t frames = 0;
+   auto peak_bin = [&](float* spectrum)
+   {
+      // Skip the first frames, partially filled
+      if (++frames < 4)
+         return;
+      std::size_t peak = 0;
+      float peak_mag = 0;
+      for (std::size_t k = 1; k != n/2; ++k)
+      {
+         auto mag = std::hypot(spectrum[2*k], spectrum[2*k+1]);
+         if (mag > peak_mag)
+         {
+            peak_mag = mag;
+            peak = k;
+         }
+      }
+      CHECK(peak == bin);
+
+      // Hann window: the peak is a quarter of N
+      CHECK(std::abs(peak_mag - n/4.0f) < 1e-2);
+   };
+   process(stft, in, 256, peak_bin);
+   CHECK(frames == 16);
+
+   // Zeroing the spectrum gives silence
+   q::stft<n> stft2{ n/4 };
+   auto out = process(stft2, in, 256,
+      [](float* spectrum) { std::fill(spectrum, spectrum + n, 0.0f); }
+   );
+   CHECK(*std::max_element(out.begin(), out.end()) == 0.0f);
+}